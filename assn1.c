@@ -2,74 +2,274 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <getopt.h>
 
 #include "sieve/common.h"
-#include "sieve/process.h"
-#include "sieve/thread.h"
+#include "sieve/pi.h"
+#include "sieve/segmented.h"
+#include "sieve/shard.h"
+#include "sieve/sieve.h"
+#include "sieve/topology.h"
+#include "sieve/tune.h"
+#include "sieve/output.h"
+#include "sieve/prime_table.h"
+#include "perf.h"
 #include "timing.h"
+#include "trace.h"
 
 const size_t DEFAULT_LIMIT = 100000;
 const size_t DEFAULT_NUM_JOBS = 5;
 
+// A mode is one of the engines, or one of these
+#define MODE_NONE -1
+#define MODE_PI -2 // Count with prime_pi() instead of sieving
+
+void set_mode(int* mode, int new_mode, char const* prog_name) {
+    if (*mode != MODE_NONE && *mode != new_mode) {
+        fprintf(stderr, "-t, -p, -s, -m, -n and -x flags are mutually exclusive. See %s -h for help.\n", prog_name);
+        exit(EXIT_FAILURE);
+    }
+    *mode = new_mode;
+}
+
+// Counts the primes <= x with prime_pi() and says how the time was split
+size_t count_pi(size_t x, size_t num_jobs) {
+    size_t count;
+    prime_pi_stats_t stats;
+    if (prime_pi(x, num_jobs, &count, &stats) == -1) {
+        perror("Error while counting primes");
+        exit(EXIT_FAILURE);
+    }
+
+    if (stats.y > 0) {
+        printf("pi(%lu): tables up to y = %lu in %.4fms, ordinary leaves in %.4fms, %lu special leaves below z = %lu in "
+               "%.4fms, P2 in %.4fms.\n", x, stats.y, stats.ms_tables, stats.ms_s1, stats.special_leaves, stats.z,
+               stats.ms_s2, stats.ms_p2);
+    }
+    return count;
+}
+
+// Sets the engine, number of jobs and segment size from the tuning file, calibrating and saving them first if this
+// machine hasn't been tuned yet, and says what was picked
+int auto_tune(sieve_config_t* config) {
+    tune_hardware_t hw;
+    tune_read_hardware(&hw);
+    printf("Tuning for %s: %lu CPUs, %lu NUMA nodes, L1d %lu, L2 %lu, L3 %lu bytes.\n", hw.model, hw.num_cpus,
+           hw.num_nodes, hw.l1d, hw.l2, hw.l3);
+
+    tune_choice_t choice;
+    int found = tune_load(TUNE_FILENAME, &hw, config->format, &choice);
+    if (found == -1) {
+        perror("Error reading " TUNE_FILENAME);
+        exit(EXIT_FAILURE);
+    } else if (found) {
+        printf("Using the tuning cached in %s.\n", TUNE_FILENAME);
+    } else {
+        struct timespec start, end;
+        CTIME(int ret = tune_calibrate(&hw, config->format, &choice))
+        if (ret == -1) {
+            perror("Error while calibrating");
+            exit(EXIT_FAILURE);
+        }
+        if (tune_save(TUNE_FILENAME, &hw, config->format, &choice) == -1) {
+            perror("Error writing " TUNE_FILENAME);
+            exit(EXIT_FAILURE);
+        }
+        printf("Calibrated in %.4fms and saved to %s.\n", get_delay(start, end), TUNE_FILENAME);
+    }
+
+    // The calibration sieve may have split into more jobs than this limit can
+    config->engine = choice.engine;
+    config->num_jobs = choice.num_jobs;
+    if (config->num_jobs > wheel_bytes(config->hi)) {
+        config->num_jobs = wheel_bytes(config->hi);
+    }
+    config->segment_size = choice.segment_size;
+
+    printf("Picked %s with %lu jobs", tune_engine_name(choice.engine), config->num_jobs);
+    if (choice.segment_size > 0) {
+        printf(" and %lu byte segments", choice.segment_size);
+    }
+    printf(" (%.4fms up to %d).\n", choice.ms, TUNE_LIMIT);
+
+    // Before any engine forks, so the children don't print it again
+    fflush(stdout);
+    return choice.engine;
+}
+
 void print_help(char const* prog_name) {
     printf("calculates the primes below a limit using the sieve of Eratsothenes.\n");
-    printf("usage: %s [-t | -p] [-j jobs] [-l limit]\n", prog_name);
-    printf("\t-t: perform the sieve using threads. Cannot be used with the -p option.\n");
-    printf("\t-p: perform the sieve using processes. Cannot be used with the -t option.\n");
+    printf("usage: %s [-t | -p | -s | -m | -n [-N processes] | -x] [-b] [-P] [-j jobs] [-l limit | -L lo -H hi]\n"
+           "       [-z segment_size] [-c checkpoint] [-C]\n", prog_name);
+    printf("       %s -s --shard i/N [-b] [-j jobs] [-l limit | -L lo -H hi] [-z segment_size]\n", prog_name);
+    printf("       %s --auto [-b] [-P] [-l limit]\n", prog_name);
+    printf("\t-t: perform the sieve using threads.\n");
+    printf("\t-p: perform the sieve using processes.\n");
+    printf("\t-s: perform a cache-blocked segmented sieve using threads.\n");
+    printf("\t-m: perform a segmented sieve using processes that share memory. Primes are written to one file.\n");
+    printf("\t-n: perform a segmented sieve using one process per NUMA node (as read from %s), each with\n",
+           TOPOLOGY_NODE_PATH);
+    printf("\t    threads pinned to the node's CPUs, and each node's share of the memory placed on that node.\n");
+    printf("\t-x: count the primes below the limit with the Lagarias-Miller-Odlyzko method instead of sieving. It takes\n");
+    printf("\t    about O(limit^(2/3)) time, and memory for the primes up to sqrt(limit), about\n");
+    printf("\t    sqrt(limit) / log(limit) of them. Nothing is written. Limits below %d are just sieved.\n",
+           PRIME_PI_SIEVE_BELOW);
+    printf("\t    Only one of -t, -p, -s, -m, -n and -x can be given.\n");
+    printf("\t-N: optional argument to specify the number of processes for -n. Default is one per node. Processes\n");
+    printf("\t    are dealt out to the nodes in turn, and the jobs are split between them.\n");
+    printf("\t-b: write a binary prime table to %s instead of writing the primes as text to %s.\n",
+           PRIME_TABLE_FILENAME, PRIMES_FILENAME);
+    printf("\t    Use prime_query to query it.\n");
+    printf("\t-P: count cycles, instructions, LLC misses, branch misses and context switches for each job's phases with\n");
+    printf("\t    perf_event_open(), and write them and the phase times to %s instead of one .time file per job.\n",
+           PERF_REPORT_FILENAME);
+    printf("\t    Counters the kernel won't give us are left out.\n");
     printf("\t-j: optional argument to specify the number of jobs (threads or processes).\n");
-    printf("\t    Default is %lu. If -l is given, the number of jobs must be <= limit - 3.\n", DEFAULT_NUM_JOBS);
+    printf("\t    Default is %lu. Each job gets at least one block of 30 numbers, so the number of jobs must be\n", DEFAULT_NUM_JOBS);
+    printf("\t    <= (limit + 29) / 30 - lo / 30.\n");
     printf("\t-l: optional argument to specify the limit for the sieve. Must be >= 10.\n");
     printf("\t    Default is %lu.\n", DEFAULT_LIMIT);
+    printf("\t-L: optional argument to only find the primes >= lo. Only supported with -s and -x, and not with -b\n");
+    printf("\t    unless --shard is given.\n");
+    printf("\t    Memory use doesn't grow with the width of the range. Default is 0.\n");
+    printf("\t-H: the same as -l: find the primes < hi. Must be <= %lu.\n", SIEVE_RANGE_MAX);
+    printf("\t-z: optional argument to specify the segment size in bytes for -t, -s, -m and -n. Each byte holds\n");
+    printf("\t    30 numbers.\n");
+    printf("\t    Default is the size of the L1 data cache (%lu).\n", default_segment_size());
+    printf("\t-c: optional checkpoint cache file for -s (without -L). Whatever it already holds is copied rather than\n");
+    printf("\t    sieved, and everything newly sieved is added to it, so a rerun with a higher limit, or after an\n");
+    printf("\t    interrupted run, only sieves the new part. It's created if it doesn't exist, and started again if\n");
+    printf("\t    its checksum doesn't match.\n");
+    printf("\t-C: with -s, count the primes instead of writing them anywhere. Each segment is counted while it's\n");
+    printf("\t    still in cache, so there's no output cost at all. Not supported with -b or -c.\n");
+    printf("\t--auto: pick the engine, number of jobs and segment size for this machine instead. They're read from\n");
+    printf("\t    %s in the current directory, keyed by CPU model, number of CPUs and -b. If it has nothing for this\n",
+           TUNE_FILENAME);
+    printf("\t    machine yet, a short sieve up to %d is timed for each candidate (based on the number of CPUs,\n",
+           TUNE_LIMIT);
+    printf("\t    the cache sizes and the NUMA nodes) first, and the fastest is saved there.\n");
+    printf("\t    Not supported with a mode, -j, -z, -L, -c, -C, -N or --shard.\n");
+    printf("\t--shard: with -s, split the range into N shards of about the same size and only sieve shard i (from 0),\n");
+    printf("\t    finding its own sieving primes, so the shards can run at the same time on different machines. The\n");
+    printf("\t    shard's primes go to %s.i-of-N (or, with -b, its part of the packed bitmap to %s.i-of-N,\n",
+           PRIMES_FILENAME, SHARD_BITMAP_FILENAME);
+    printf("\t    which works with -L too), and its range, prime count and checksum to that file plus %s.\n",
+           SHARD_MANIFEST_SUFFIX);
+    printf("\t    Use shard_merge to check the manifests and join the shards. N must be <= (limit + 29) / 30 - lo / 30.\n");
+    printf("\t    Not supported with -c or -C.\n");
     printf("\t-h: print this help message and exit.\n");
 }
 
 int main(int argc, char** argv) {
-    int thread_flag = 0;
-    int process_flag = 0;
+    sieve_config_t config;
+    sieve_config_init(&config, DEFAULT_LIMIT);
+    config.num_jobs = DEFAULT_NUM_JOBS;
 
-    size_t limit = DEFAULT_LIMIT;
-    size_t num_jobs = DEFAULT_NUM_JOBS;
+    int mode = MODE_NONE;
+    int count_only = 0;
+    int count_events = 0;
+    int tune = 0;
+    int jobs_given = 0;
+    size_t shard_index = 0;
+    size_t shard_count = 0;
+
+    static struct option const long_options[] = {
+        {"auto", no_argument, NULL, 'a'},
+        {"shard", required_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0}
+    };
 
     opterr = 0;
     int c;
-    while((c = getopt(argc, argv, "tphj:l:")) != -1) {
+    while((c = getopt_long(argc, argv, "tpsmnxbPChj:l:z:L:H:N:c:", long_options, NULL)) != -1) {
         switch(c) {
+            case 'a':
+                tune = 1;
+                break;
             case 't':
-                thread_flag = 1;
-                if(process_flag) {
-                    fprintf(stderr, "-t and -p flags are mutually exclusive. See %s -h for help.\n", argv[0]);
-                    exit(EXIT_FAILURE);
-                }
+                set_mode(&mode, SIEVE_ENGINE_THREAD, argv[0]);
                 break;
             case 'p':
-                process_flag = 1;
-                if (thread_flag) {
-                    fprintf(stderr, "-t and -p flags are mutually exclusive. See %s -h for help.\n", argv[0]);
-                    exit(EXIT_FAILURE);
-                }
+                set_mode(&mode, SIEVE_ENGINE_PROCESS, argv[0]);
+                break;
+            case 's':
+                set_mode(&mode, SIEVE_ENGINE_SEGMENTED, argv[0]);
+                break;
+            case 'm':
+                set_mode(&mode, SIEVE_ENGINE_SHARED, argv[0]);
+                break;
+            case 'n':
+                set_mode(&mode, SIEVE_ENGINE_HYBRID, argv[0]);
+                break;
+            case 'x':
+                set_mode(&mode, MODE_PI, argv[0]);
+                break;
+            case 'b':
+                config.format = OUTPUT_TABLE;
+                break;
+            case 'P':
+                count_events = 1;
+                break;
+            case 'C':
+                count_only = 1;
                 break;
             case 'h':
                 print_help(argv[0]);
                 exit(EXIT_SUCCESS);
                 break;
             case 'j':
-                if(sscanf(optarg, "%lu", &num_jobs) != 1) {
+                if(sscanf(optarg, "%lu", &config.num_jobs) != 1) {
                     fprintf(stderr, "Invalid argument %s for -j. See %s -h for help.\n", optarg, argv[0]);
                     exit(EXIT_FAILURE);
                 }
+                jobs_given = 1;
                 break;
             case 'l':
-                if(sscanf(optarg, "%lu", &limit) != 1) {
-                    fprintf(stderr, "Invalid argument %s for -l. See %s -h for help.\n", optarg, argv[0]);
+            case 'H':
+                if(sscanf(optarg, "%lu", &config.hi) != 1) {
+                    fprintf(stderr, "Invalid argument %s for -%c. See %s -h for help.\n", optarg, c, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                if(sscanf(optarg, "%lu", &config.lo) != 1) {
+                    fprintf(stderr, "Invalid argument %s for -L. See %s -h for help.\n", optarg, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'z':
+                if(sscanf(optarg, "%lu", &config.segment_size) != 1 || config.segment_size == 0) {
+                    fprintf(stderr, "Invalid argument %s for -z. See %s -h for help.\n", optarg, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                config.checkpoint = optarg;
+                break;
+            case 'S': {
+                char end;
+                if(sscanf(optarg, "%lu/%lu%c", &shard_index, &shard_count, &end) != 2 || shard_index >= shard_count) {
+                    fprintf(stderr, "Invalid argument %s for --shard. See %s -h for help.\n", optarg, argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'N':
+                if(sscanf(optarg, "%lu", &config.num_processes) != 1 || config.num_processes == 0) {
+                    fprintf(stderr, "Invalid argument %s for -N. See %s -h for help.\n", optarg, argv[0]);
                     exit(EXIT_FAILURE);
                 }
                 break;
             case '?':
-                if (optopt == 'j') {
-                    fprintf(stderr, "No argument given for -j. See %s -h for help.\n", argv[0]);
+                if (optopt == 'j' || optopt == 'l' || optopt == 'z' || optopt == 'L' || optopt == 'H' || optopt == 'N' ||
+                    optopt == 'c') {
+                    fprintf(stderr, "No argument given for -%c. See %s -h for help.\n", optopt, argv[0]);
                     exit(EXIT_FAILURE);
-                } else if (optopt == 'l') {
-                    fprintf(stderr, "No argument given for -l. See %s -h for help.\n", argv[0]);
+                } else if (optopt == 'S') {
+                    fprintf(stderr, "No argument given for --shard. See %s -h for help.\n", argv[0]);
+                    exit(EXIT_FAILURE);
+                } else if (optopt == 0) {
+                    fprintf(stderr, "Unknown option %s. See %s -h for help.\n", argv[optind - 1], argv[0]);
                     exit(EXIT_FAILURE);
                 } else {
                     fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
@@ -82,25 +282,131 @@ int main(int argc, char** argv) {
         }
     }
 
-    if(limit < 10) {
+    if (tune) {
+        if (mode != MODE_NONE || jobs_given || config.segment_size > 0 || config.lo > 0 || config.checkpoint ||
+            count_only || config.num_processes > 0 || shard_count > 0) {
+            fprintf(stderr, "--auto isn't supported with a mode, -j, -z, -L, -c, -C, -N or --shard. See %s -h for "
+                    "help.\n", argv[0]);
+            exit(EXIT_FAILURE);
+        } else if (config.hi < 10) {
+            fprintf(stderr, "Limit must be >= 10.\n");
+            exit(EXIT_FAILURE);
+        } else if (config.hi > SIEVE_RANGE_MAX) {
+            fprintf(stderr, "Limit must be <= %lu.\n", SIEVE_RANGE_MAX);
+            exit(EXIT_FAILURE);
+        }
+        mode = auto_tune(&config);
+    }
+
+    int segmented = mode == SIEVE_ENGINE_SEGMENTED;
+    if (mode == MODE_NONE) {
+        fprintf(stderr, "Must specify a mode (-t, -p, -s, -m, -n or -x); see %s -h for help.\n", argv[0]);
+        exit(EXIT_FAILURE);
+    } else if (config.hi < 10) {
         fprintf(stderr, "Limit must be >= 10.\n");
         exit(EXIT_FAILURE);
-    } else if (num_jobs > limit - 3) {
-        fprintf(stderr, "Number of jobs must be <= limit -3.\n");
+    } else if (config.hi > SIEVE_RANGE_MAX) {
+        fprintf(stderr, "Limit must be <= %lu.\n", SIEVE_RANGE_MAX);
+        exit(EXIT_FAILURE);
+    } else if (config.lo >= config.hi) {
+        fprintf(stderr, "-L must be below the limit.\n");
+        exit(EXIT_FAILURE);
+    } else if (shard_count > 0 && (!segmented || config.checkpoint || count_only)) {
+        fprintf(stderr, "--shard is only supported with -s, and not with -c or -C.\n");
+        exit(EXIT_FAILURE);
+    } else if (shard_count > wheel_bytes(config.hi) - config.lo / WHEEL_MODULUS) {
+        fprintf(stderr, "Number of shards must be <= (limit + 29) / 30 - lo / 30.\n");
+        exit(EXIT_FAILURE);
+    } else if (config.lo > 0 && (!(segmented || mode == MODE_PI) || (config.format == OUTPUT_TABLE && !shard_count))) {
+        fprintf(stderr, "-L is only supported with -s and -x, and not with -b unless --shard is given.\n");
+        exit(EXIT_FAILURE);
+    } else if (config.checkpoint && (!segmented || config.lo > 0)) {
+        fprintf(stderr, "-c is only supported with -s, and not with -L.\n");
+        exit(EXIT_FAILURE);
+    } else if (count_only && (!segmented || config.format == OUTPUT_TABLE || config.checkpoint)) {
+        fprintf(stderr, "-C is only supported with -s, and not with -b or -c.\n");
+        exit(EXIT_FAILURE);
+    } else if (mode == MODE_PI && config.format == OUTPUT_TABLE) {
+        fprintf(stderr, "-b isn't supported with -x, since nothing is written.\n");
+        exit(EXIT_FAILURE);
+    } else if (config.num_processes > 0 && mode != SIEVE_ENGINE_HYBRID) {
+        fprintf(stderr, "-N is only supported with -n.\n");
+        exit(EXIT_FAILURE);
+    } else if (config.num_jobs == 0 || config.num_jobs > wheel_bytes(config.hi) - config.lo / WHEEL_MODULUS) {
+        fprintf(stderr, "Number of jobs must be between 1 and (limit + 29) / 30 - lo / 30.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (mode != MODE_PI) {
+        config.engine = (sieve_engine_t)mode;
+    }
+
+    if (count_events && perf_session_start(config.num_jobs) == -1) {
+        perror("Error starting performance counters");
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef SIEVE_TRACE
+    // One track for each job, and one for the master
+    if (trace_start(config.num_jobs + 1) == -1) {
+        perror("Error starting trace");
         exit(EXIT_FAILURE);
     }
+#endif
 
     struct timespec start, end;
-    if(thread_flag) {
-        CTIME(concurrent_sieve_thread(limit, num_jobs))
-    } else if (process_flag) {
-        CTIME(concurrent_sieve_process(limit, num_jobs))
+    if (mode == MODE_PI) {
+        CTIME
+        (
+            size_t count = count_pi(config.hi - 1, config.num_jobs);
+            if (config.lo > 0) {
+                count -= count_pi(config.lo - 1, config.num_jobs);
+            }
+        )
+        printf("Found %lu primes in [%lu, %lu).\n", count, config.lo, config.hi);
+    } else if (shard_count > 0) {
+        shard_manifest_t manifest;
+        CTIME(int ret = shard_run(&config, shard_index, shard_count, &manifest))
+        if (ret == -1) {
+            perror("Error while sieving shard");
+            exit(EXIT_FAILURE);
+        }
+        printf("Shard %lu/%lu: %lu primes in [%lu, %lu), written to %s (manifest %s%s).\n", shard_index, shard_count,
+               manifest.num_primes, manifest.lo, manifest.hi, manifest.data_file, manifest.data_file,
+               SHARD_MANIFEST_SUFFIX);
+    } else if (count_only) {
+        size_t count;
+        CTIME(int ret = sieve_count(&config, &count))
+        if (ret == -1) {
+            perror("Error while counting primes");
+            exit(EXIT_FAILURE);
+        }
+        printf("Found %lu primes in [%lu, %lu).\n", count, config.lo, config.hi);
     } else {
-        fprintf(stderr, "Must specify threads or processes; see %s -h for help.\n", argv[0]);
-        exit(EXIT_FAILURE);
+        CTIME(int ret = sieve_run(&config))
+        if (ret == -1) {
+            perror("Error while sieving");
+            exit(EXIT_FAILURE);
+        }
     }
     double total_ms = get_delay(start, end);
     printf("Total time: %.4fms\n", total_ms);
 
+    if (count_events) {
+        if (perf_session_finish(PERF_REPORT_FILENAME) == -1) {
+            perror("Error writing performance counters");
+            exit(EXIT_FAILURE);
+        }
+        printf("Performance counters written to %s.\n", PERF_REPORT_FILENAME);
+    }
+
+#ifdef SIEVE_TRACE
+    if (trace_finish(TRACE_FILENAME) == -1) {
+        perror("Error writing trace");
+        exit(EXIT_FAILURE);
+    }
+    printf("Trace written to %s.\n", TRACE_FILENAME);
+#endif
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <mqueue.h>
+#include <semaphore.h>
+
+#include "../sieve/ipc.h"
+#include "../timing.h"
+
+/*
+ * Measures the round-trip latency of one round of the process engine's protocol: the parent hands a prime to every
+ * job, and every job sends a result back. It's run once over the old POSIX message queue + named semaphore
+ * transport and once over the shared-memory rings in sieve/ipc.h.
+ */
+
+#define BENCH_SEM "/comp_8005_assn1_bench_sem"
+#define BENCH_SHM "/comp_8005_assn1_bench_shm"
+#define BENCH_MQ "/comp_8005_assn1_bench_mq"
+
+#define SEM_NAME_BUFSIZE 256
+
+const size_t DEFAULT_ITERATIONS = 100000;
+const size_t DEFAULT_NUM_JOBS = 1;
+
+typedef struct {
+    size_t job_id;
+    size_t prime;
+} job_result_msg;
+
+static int compare_doubles(void const* a, void const* b) {
+    double x = *(double const*)a;
+    double y = *(double const*)b;
+    return (x > y) - (x < y);
+}
+
+static void report(char const* name, double* us, size_t iterations) {
+    double total = 0.0;
+    for (size_t i = 0; i < iterations; ++i) {
+        total += us[i];
+    }
+    qsort(us, iterations, sizeof(double), compare_doubles);
+
+    printf("%-8s mean %8.3fus  p50 %8.3fus  p99 %8.3fus  max %8.3fus\n", name, total / iterations,
+           us[iterations / 2], us[iterations * 99 / 100], us[iterations - 1]);
+}
+
+static void bench_mq(size_t num_jobs, size_t iterations, double* us) {
+    struct mq_attr attr = {0};
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = sizeof(job_result_msg);
+
+    mq_unlink(BENCH_MQ);
+    mqd_t msg_queue = mq_open(BENCH_MQ, O_CREAT | O_RDWR, 0666, &attr);
+    int shared_mem = shm_open(BENCH_SHM, O_CREAT | O_RDWR, 0666);
+    if (msg_queue == -1 || shared_mem == -1 || ftruncate(shared_mem, sizeof(size_t)) == -1) {
+        perror("Error setting up message queue and shared memory");
+        exit(EXIT_FAILURE);
+    }
+    size_t* value = mmap(NULL, sizeof(size_t), PROT_READ | PROT_WRITE, MAP_SHARED, shared_mem, 0);
+
+    sem_t** semaphores = malloc(sizeof(sem_t*) * num_jobs);
+    for (size_t i = 0; i < num_jobs; ++i) {
+        char sem_name[SEM_NAME_BUFSIZE];
+        snprintf(sem_name, SEM_NAME_BUFSIZE, "%s%lu", BENCH_SEM, i);
+        sem_unlink(sem_name);
+        semaphores[i] = sem_open(sem_name, O_CREAT | O_RDWR, 0666, 0);
+
+        if (!fork()) {
+            while (1) {
+                sem_wait(semaphores[i]);
+                job_result_msg msg = {i, *value};
+                if (msg.prime == (size_t)-1) {
+                    _exit(EXIT_SUCCESS);
+                }
+                mq_send(msg_queue, (char*)&msg, sizeof(msg), 0);
+            }
+        }
+    }
+
+    struct timespec start, end;
+    for (size_t n = 0; n <= iterations; ++n) {
+        CTIME
+        (
+            *value = n == iterations ? (size_t)-1 : n;
+            for (size_t i = 0; i < num_jobs; ++i) {
+                sem_post(semaphores[i]);
+            }
+
+            for (size_t i = 0; n < iterations && i < num_jobs; ++i) {
+                char buf[sizeof(job_result_msg) + 1];
+                mq_receive(msg_queue, buf, sizeof(buf), NULL);
+            }
+        )
+        if (n < iterations) {
+            us[n] = get_delay(start, end) * 1000.0;
+        }
+    }
+
+    for (size_t i = 0; i < num_jobs; ++i) {
+        wait(NULL);
+
+        char sem_name[SEM_NAME_BUFSIZE];
+        snprintf(sem_name, SEM_NAME_BUFSIZE, "%s%lu", BENCH_SEM, i);
+        sem_close(semaphores[i]);
+        sem_unlink(sem_name);
+    }
+
+    munmap(value, sizeof(size_t));
+    shm_unlink(BENCH_SHM);
+    mq_close(msg_queue);
+    mq_unlink(BENCH_MQ);
+    free(semaphores);
+}
+
+static void bench_ring(size_t num_jobs, size_t iterations, double* us) {
+    ipc_ring_t* results = ipc_ring_create(num_jobs, sizeof(job_result_msg), 1);
+    ipc_ring_t** commands = malloc(sizeof(ipc_ring_t*) * num_jobs);
+    for (size_t i = 0; i < num_jobs; ++i) {
+        commands[i] = ipc_ring_create(1, sizeof(size_t), 0);
+
+        if (!fork()) {
+            while (1) {
+                job_result_msg msg = {i, 0};
+                ipc_ring_pop(commands[i], &msg.prime, 1);
+                if (msg.prime == (size_t)-1) {
+                    _exit(EXIT_SUCCESS);
+                }
+                ipc_ring_push(results, &msg, 1);
+            }
+        }
+    }
+
+    job_result_msg* msgs = malloc(sizeof(job_result_msg) * num_jobs);
+
+    struct timespec start, end;
+    for (size_t n = 0; n <= iterations; ++n) {
+        CTIME
+        (
+            size_t value = n == iterations ? (size_t)-1 : n;
+            for (size_t i = 0; i < num_jobs; ++i) {
+                ipc_ring_push(commands[i], &value, 1);
+            }
+
+            for (size_t received = 0; n < iterations && received < num_jobs;) {
+                received += ipc_ring_pop(results, msgs, num_jobs - received);
+            }
+        )
+        if (n < iterations) {
+            us[n] = get_delay(start, end) * 1000.0;
+        }
+    }
+
+    for (size_t i = 0; i < num_jobs; ++i) {
+        wait(NULL);
+        ipc_ring_destroy(commands[i]);
+    }
+    ipc_ring_destroy(results);
+    free(commands);
+    free(msgs);
+}
+
+int main(int argc, char** argv) {
+    size_t num_jobs = DEFAULT_NUM_JOBS;
+    size_t iterations = DEFAULT_ITERATIONS;
+
+    int c;
+    while ((c = getopt(argc, argv, "j:n:h")) != -1) {
+        switch (c) {
+            case 'j':
+                if (sscanf(optarg, "%lu", &num_jobs) != 1 || num_jobs == 0) {
+                    fprintf(stderr, "Invalid argument %s for -j.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'n':
+                if (sscanf(optarg, "%lu", &iterations) != 1 || iterations == 0) {
+                    fprintf(stderr, "Invalid argument %s for -n.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                printf("usage: %s [-j jobs] [-n iterations]\n", argv[0]);
+                printf("\tmeasures the round-trip latency of the process engine's IPC, mq/sem vs. rings.\n");
+                exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    double* us = malloc(sizeof(double) * iterations);
+    if (!us) {
+        perror("Error allocating results");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%lu round trips to %lu jobs:\n", iterations, num_jobs);
+    fflush(stdout);
+
+    bench_mq(num_jobs, iterations, us);
+    report("mq/sem", us, iterations);
+    fflush(stdout);
+
+    bench_ring(num_jobs, iterations, us);
+    report("ring", us, iterations);
+
+    free(us);
+    return EXIT_SUCCESS;
+}
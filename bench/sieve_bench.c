@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "../sieve/common.h"
+#include "../sieve/output.h"
+#include "../sieve/prime_table.h"
+#include "../sieve/process.h"
+#include "../sieve/segmented.h"
+#include "../sieve/shared.h"
+#include "../sieve/thread.h"
+#include "../sieve/tune.h"
+
+/*
+ * Sweeps the engines over limits, job counts and segment sizes and reports the wall time of each combination as
+ * JSON or CSV, so runs can be kept as baselines and compared across commits.
+ *
+ * Every run happens in a child process in a scratch directory, so the engines can write their output and timing
+ * files (and fork, and exit on errors) as usual. The child times the engine call itself; the parent then counts the
+ * primes that were written and adds up the phases in the jobs' *.time files. After the warmup runs, each
+ * combination is repeated and reported as its min, median and p95.
+ */
+
+#ifndef SIEVE_REVISION
+#define SIEVE_REVISION "unknown"
+#endif
+
+#define MAX_LIST 32
+#define MAX_PHASES 16
+#define PHASE_NAME_SIZE 64
+#define LINE_SIZE 256
+
+const size_t DEFAULT_WARMUP = 1;
+const size_t DEFAULT_REPETITIONS = 5;
+const double DEFAULT_THRESHOLD = 5.0;
+
+typedef enum {
+    ENGINE_SERIAL,
+    ENGINE_THREAD,
+    ENGINE_PROCESS,
+    ENGINE_SEGMENTED,
+    ENGINE_SHARED,
+    NUM_ENGINES
+} engine_t;
+
+static char const* const engine_names[NUM_ENGINES] = {"serial", "thread", "process", "segmented", "shared"};
+
+typedef struct {
+    char name[PHASE_NAME_SIZE];
+    double ms[MAX_LIST]; // The phase's total over every job, for each repetition
+} phase_t;
+
+// One combination of parameters and its results
+typedef struct {
+    engine_t engine;
+    size_t limit;
+    size_t num_jobs;
+    size_t segment_size;
+    output_format_t format;
+
+    size_t repetitions;
+    double ms[MAX_LIST];
+    size_t primes;
+
+    phase_t phases[MAX_PHASES];
+    size_t num_phases;
+} bench_result_t;
+
+static void print_help(char const* prog_name) {
+    printf("usage: %s [-e engines] [-l limits] [-j jobs] [-z segment_sizes] [-w warmup] [-r repetitions] [-b]\n"
+           "       [-f json | csv] [-o file] [-c baseline.csv] [-T percent]\n", prog_name);
+    printf("\truns every combination of the given engines, limits, job counts and segment sizes.\n");
+    printf("\tLists are comma separated, and numbers can be written like 1e9.\n");
+    printf("\t-e: engines out of serial, thread, process, segmented and shared. Default is all of them.\n");
+    printf("\t    serial only runs with 1 job, and process ignores the segment size.\n");
+    printf("\t-l: limits. Default is 10000000.\n");
+    printf("\t-j: job counts. Default is 1.\n");
+    printf("\t-z: segment sizes in bytes, or 0 for the default (%lu). Default is 0.\n", default_segment_size());
+    printf("\t-w: warmup runs before the timed ones. Default is %lu.\n", DEFAULT_WARMUP);
+    printf("\t-r: timed runs of each combination, up to %d. Default is %lu.\n", MAX_LIST, DEFAULT_REPETITIONS);
+    printf("\t-b: write binary prime tables instead of text. serial can't, so it's skipped.\n");
+    printf("\t-f: json or csv. Default is json.\n");
+    printf("\t-o: the file to write results to. Default is stdout.\n");
+    printf("\t-c: a CSV file from an earlier run. Each combination's median is compared with the one in the file,\n");
+    printf("\t    and the exit status is 2 if any got slower by more than the threshold.\n");
+    printf("\t-T: the threshold for -c in percent. Default is %.1f.\n", DEFAULT_THRESHOLD);
+    printf("\t-h: print this help message and exit.\n");
+}
+
+static size_t parse_size_list(char const* arg, size_t* values, char opt) {
+    char* copy = strdup(arg);
+    size_t count = 0;
+
+    for (char* tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        char* end;
+        double value = strtod(tok, &end);
+        if (*end != '\0' || value < 0 || value != floor(value) || value >= 18446744073709551616.0 || count == MAX_LIST) {
+            fprintf(stderr, "Invalid list %s for -%c.\n", arg, opt);
+            exit(EXIT_FAILURE);
+        }
+        values[count++] = (size_t)value;
+    }
+
+    free(copy);
+    if (count == 0) {
+        fprintf(stderr, "Empty list for -%c.\n", opt);
+        exit(EXIT_FAILURE);
+    }
+    return count;
+}
+
+static size_t parse_engine_list(char const* arg, engine_t* engines) {
+    char* copy = strdup(arg);
+    size_t count = 0;
+
+    for (char* tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        size_t e = 0;
+        while (e < NUM_ENGINES && strcmp(tok, engine_names[e]) != 0) {
+            ++e;
+        }
+        if (e == NUM_ENGINES || count == MAX_LIST) {
+            fprintf(stderr, "Unknown engine %s.\n", tok);
+            exit(EXIT_FAILURE);
+        }
+        engines[count++] = (engine_t)e;
+    }
+
+    free(copy);
+    return count;
+}
+
+static int compare_doubles(void const* a, void const* b) {
+    double x = *(double const*)a;
+    double y = *(double const*)b;
+    return (x > y) - (x < y);
+}
+
+// The value at rank ceil(p * n) of n sorted values
+static double percentile(double const* values, size_t n, double p) {
+    double sorted[MAX_LIST];
+    memcpy(sorted, values, sizeof(double) * n);
+    qsort(sorted, n, sizeof(double), compare_doubles);
+
+    size_t rank = (size_t)ceil(p * n);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Runs the engine; this is the part of each run that's timed
+static int run_engine(void const* arg) {
+    bench_result_t const* r = (bench_result_t const*)arg;
+    switch (r->engine) {
+        case ENGINE_SERIAL:
+            serial_sieve(r->limit);
+            break;
+        case ENGINE_THREAD:
+            concurrent_sieve_thread(r->limit, r->num_jobs, r->segment_size, r->format);
+            break;
+        case ENGINE_PROCESS:
+            concurrent_sieve_process(r->limit, r->num_jobs, r->format);
+            break;
+        case ENGINE_SEGMENTED:
+            concurrent_sieve_segmented(0, r->limit, r->num_jobs, r->segment_size, r->format, NULL);
+            break;
+        default:
+            concurrent_sieve_shared(r->limit, r->num_jobs, r->segment_size, r->format);
+            break;
+    }
+    return 0;
+}
+
+// Runs the engine in a child process in dir and returns how long the engine took, or -1 if it failed
+static double run_once(bench_result_t const* r, char const* dir) {
+    // The serial sieve writes its primes to stdout; everyone else's stdout is just progress messages
+    return tune_run_child(dir, r->engine == ENGINE_SERIAL ? PRIMES_FILENAME : "stdout.txt", run_engine, r);
+}
+
+static size_t count_primes(bench_result_t const* r, char const* dir) {
+    char path[PATH_MAX];
+
+    if (r->format == OUTPUT_TABLE) {
+        snprintf(path, sizeof(path), "%s/%s", dir, PRIME_TABLE_FILENAME);
+        prime_table_t table;
+        if (prime_table_open(&table, path) == -1) {
+            return 0;
+        }
+        size_t count = table.header->num_primes;
+        prime_table_close(&table);
+        return count;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, PRIMES_FILENAME);
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    size_t count = 0;
+    char buf[1 << 16];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+        for (char const* p = buf; (p = memchr(p, '\n', buf + len - p)); ++p) {
+            ++count;
+        }
+    }
+    fclose(f);
+    return count;
+}
+
+// Adds up every "name (ms): value" line in the jobs' timing files, by name
+static void collect_phases(bench_result_t* r, size_t rep, char const* dir) {
+    for (size_t i = 0; i < r->num_phases; ++i) {
+        r->phases[i].ms[rep] = 0.0;
+    }
+
+    DIR* d = opendir(dir);
+    if (!d) {
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(d))) {
+        size_t name_len = strlen(entry->d_name);
+        if (name_len < 5 || strcmp(entry->d_name + name_len - 5, ".time") != 0) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        FILE* f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+
+        char line[LINE_SIZE];
+        while (fgets(line, sizeof(line), f)) {
+            char* sep = strstr(line, " (ms): ");
+            if (!sep) {
+                continue;
+            }
+            *sep = '\0';
+
+            size_t p = 0;
+            while (p < r->num_phases && strcmp(r->phases[p].name, line) != 0) {
+                ++p;
+            }
+            if (p == r->num_phases) {
+                if (p == MAX_PHASES) {
+                    continue;
+                }
+                snprintf(r->phases[p].name, PHASE_NAME_SIZE, "%.*s", PHASE_NAME_SIZE - 1, line);
+                memset(r->phases[p].ms, 0, sizeof(r->phases[p].ms));
+                ++r->num_phases;
+            }
+            r->phases[p].ms[rep] += strtod(sep + strlen(" (ms): "), NULL);
+        }
+        fclose(f);
+    }
+    closedir(d);
+}
+
+static double baseline_median(char const* baseline, bench_result_t const* r) {
+    FILE* f = fopen(baseline, "r");
+    if (!f) {
+        perror("Error opening baseline");
+        exit(EXIT_FAILURE);
+    }
+
+    char line[LINE_SIZE * 4];
+    double median = -1.0;
+    while (median < 0 && fgets(line, sizeof(line), f)) {
+        char engine[PHASE_NAME_SIZE];
+        char format[PHASE_NAME_SIZE];
+        size_t limit, num_jobs, segment_size, repetitions;
+        double min_ms, median_ms;
+
+        if (line[0] != '#' &&
+            sscanf(line, "%63[^,],%63[^,],%lu,%lu,%lu,%lu,%lf,%lf", engine, format, &limit, &num_jobs, &segment_size,
+                   &repetitions, &min_ms, &median_ms) == 8 &&
+            strcmp(engine, engine_names[r->engine]) == 0 &&
+            strcmp(format, r->format == OUTPUT_TABLE ? "table" : "text") == 0 && limit == r->limit &&
+            num_jobs == r->num_jobs && segment_size == r->segment_size) {
+            median = median_ms;
+        }
+    }
+
+    fclose(f);
+    return median;
+}
+
+static void print_metadata(FILE* out, int json) {
+    tune_hardware_t hw;
+    tune_read_hardware(&hw);
+    hw.model[strcspn(hw.model, "\"")] = '\0';
+
+    if (json) {
+        fprintf(out, "{\n  \"revision\": \"%s\",\n  \"cpu\": \"%s\",\n  \"cpus\": %lu,\n  \"results\": [", SIEVE_REVISION,
+                hw.model, hw.num_cpus);
+    } else {
+        fprintf(out, "# revision %s, cpu %s, %lu cpus\n", SIEVE_REVISION, hw.model, hw.num_cpus);
+        fprintf(out, "engine,format,limit,jobs,segment_size,repetitions,min_ms,median_ms,p95_ms,primes,"
+                     "primes_per_sec,phases_median_ms\n");
+    }
+}
+
+static void print_result(FILE* out, int json, bench_result_t const* r, int first) {
+    double min_ms = percentile(r->ms, r->repetitions, 0.0);
+    double median_ms = percentile(r->ms, r->repetitions, 0.5);
+    double p95_ms = percentile(r->ms, r->repetitions, 0.95);
+    double primes_per_sec = median_ms > 0 ? r->primes / (median_ms / 1000.0) : 0.0;
+    char const* format = r->format == OUTPUT_TABLE ? "table" : "text";
+
+    if (json) {
+        fprintf(out, "%s\n    {\"engine\": \"%s\", \"format\": \"%s\", \"limit\": %lu, \"jobs\": %lu, "
+                     "\"segment_size\": %lu, \"repetitions\": %lu,\n     \"min_ms\": %.4f, \"median_ms\": %.4f, "
+                     "\"p95_ms\": %.4f, \"primes\": %lu, \"primes_per_sec\": %.1f,\n     \"phases_median_ms\": {",
+                first ? "" : ",", engine_names[r->engine], format, r->limit, r->num_jobs, r->segment_size,
+                r->repetitions, min_ms, median_ms, p95_ms, r->primes, primes_per_sec);
+        for (size_t i = 0; i < r->num_phases; ++i) {
+            fprintf(out, "%s\"%s\": %.4f", i ? ", " : "", r->phases[i].name,
+                    percentile(r->phases[i].ms, r->repetitions, 0.5));
+        }
+        fprintf(out, "}}");
+    } else {
+        fprintf(out, "%s,%s,%lu,%lu,%lu,%lu,%.4f,%.4f,%.4f,%lu,%.1f,", engine_names[r->engine], format, r->limit,
+                r->num_jobs, r->segment_size, r->repetitions, min_ms, median_ms, p95_ms, r->primes, primes_per_sec);
+        for (size_t i = 0; i < r->num_phases; ++i) {
+            fprintf(out, "%s%s=%.4f", i ? ";" : "", r->phases[i].name,
+                    percentile(r->phases[i].ms, r->repetitions, 0.5));
+        }
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
+
+int main(int argc, char** argv) {
+    engine_t engines[MAX_LIST] = {ENGINE_SERIAL, ENGINE_THREAD, ENGINE_PROCESS, ENGINE_SEGMENTED, ENGINE_SHARED};
+    size_t num_engines = NUM_ENGINES;
+    size_t limits[MAX_LIST] = {10000000};
+    size_t num_limits = 1;
+    size_t jobs[MAX_LIST] = {1};
+    size_t num_job_counts = 1;
+    size_t segment_sizes[MAX_LIST] = {0};
+    size_t num_segment_sizes = 1;
+
+    size_t warmup = DEFAULT_WARMUP;
+    size_t repetitions = DEFAULT_REPETITIONS;
+    output_format_t format = OUTPUT_TEXT;
+    int json = 1;
+    char const* out_path = NULL;
+    char const* baseline = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+
+    int c;
+    while ((c = getopt(argc, argv, "e:l:j:z:w:r:bf:o:c:T:h")) != -1) {
+        switch (c) {
+            case 'e':
+                num_engines = parse_engine_list(optarg, engines);
+                break;
+            case 'l':
+                num_limits = parse_size_list(optarg, limits, 'l');
+                break;
+            case 'j':
+                num_job_counts = parse_size_list(optarg, jobs, 'j');
+                break;
+            case 'z':
+                num_segment_sizes = parse_size_list(optarg, segment_sizes, 'z');
+                break;
+            case 'w':
+                if (sscanf(optarg, "%lu", &warmup) != 1) {
+                    fprintf(stderr, "Invalid argument %s for -w.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                if (sscanf(optarg, "%lu", &repetitions) != 1 || repetitions == 0 || repetitions > MAX_LIST) {
+                    fprintf(stderr, "Invalid argument %s for -r.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b':
+                format = OUTPUT_TABLE;
+                break;
+            case 'f':
+                if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0) {
+                    fprintf(stderr, "Invalid argument %s for -f.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                json = strcmp(optarg, "json") == 0;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'c':
+                baseline = optarg;
+                break;
+            case 'T':
+                if (sscanf(optarg, "%lf", &threshold) != 1) {
+                    fprintf(stderr, "Invalid argument %s for -T.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                print_help(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "See %s -h for help.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    FILE* out = out_path ? fopen(out_path, "w") : stdout;
+    char dir[] = "/tmp/sieve_bench.XXXXXX";
+    if (!out || !mkdtemp(dir)) {
+        perror("Error setting up");
+        exit(EXIT_FAILURE);
+    }
+
+    print_metadata(out, json);
+
+    int first = 1;
+    int regressed = 0;
+    for (size_t e = 0; e < num_engines; ++e) {
+        for (size_t l = 0; l < num_limits; ++l) {
+            for (size_t j = 0; j < num_job_counts; ++j) {
+                for (size_t z = 0; z < num_segment_sizes; ++z) {
+                    bench_result_t r;
+                    memset(&r, 0, sizeof(r));
+                    r.engine = engines[e];
+                    r.limit = limits[l];
+                    r.num_jobs = jobs[j];
+                    r.segment_size = segment_sizes[z] ? segment_sizes[z] : default_segment_size();
+                    r.format = format;
+                    r.repetitions = repetitions;
+
+                    // Skip what the engine can't do, or what would just repeat another combination
+                    if ((r.engine == ENGINE_SERIAL && (r.num_jobs != 1 || z > 0 || format == OUTPUT_TABLE)) ||
+                        (r.engine == ENGINE_PROCESS && z > 0)) {
+                        continue;
+                    }
+                    if (r.limit < 10 || r.limit > SIEVE_RANGE_MAX || r.num_jobs == 0 ||
+                        r.num_jobs > wheel_bytes(r.limit)) {
+                        fprintf(stderr, "Skipping %s with limit %lu and %lu jobs: out of range.\n",
+                                engine_names[r.engine], r.limit, r.num_jobs);
+                        continue;
+                    }
+
+                    int failed = 0;
+                    for (size_t rep = 0; rep < warmup + repetitions && !failed; ++rep) {
+                        tune_clear_dir(dir);
+                        double ms = run_once(&r, dir);
+                        failed = ms < 0;
+
+                        if (!failed && rep >= warmup) {
+                            r.ms[rep - warmup] = ms;
+                            r.primes = count_primes(&r, dir);
+                            collect_phases(&r, rep - warmup, dir);
+                        }
+                    }
+
+                    if (failed) {
+                        fprintf(stderr, "%s with limit %lu and %lu jobs failed.\n", engine_names[r.engine], r.limit,
+                                r.num_jobs);
+                        continue;
+                    }
+
+                    print_result(out, json, &r, first);
+                    first = 0;
+
+                    if (baseline) {
+                        double before = baseline_median(baseline, &r);
+                        double after = percentile(r.ms, r.repetitions, 0.5);
+                        if (before > 0) {
+                            double change = (after - before) / before * 100.0;
+                            int slower = change > threshold;
+                            regressed |= slower;
+                            fprintf(stderr, "%-9s limit %lu, %lu jobs, segment %lu: %.4fms -> %.4fms (%+.1f%%)%s\n",
+                                    engine_names[r.engine], r.limit, r.num_jobs, r.segment_size, before, after, change,
+                                    slower ? " REGRESSION" : "");
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (json) {
+        fprintf(out, "\n  ]\n}\n");
+    }
+
+    tune_clear_dir(dir);
+    rmdir(dir);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return regressed ? 2 : EXIT_SUCCESS;
+}
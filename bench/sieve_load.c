@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <unistd.h>
+
+#include "../sieve/server.h"
+#include "../timing.h"
+
+/*
+ * Load generator for the sieve server (see sieve/server.h). Each connection is a thread that sends batches of
+ * random queries back to back, waiting for each response before sending the next batch; the batches' round-trip
+ * times are then reported as throughput and latency percentiles.
+ */
+
+const size_t DEFAULT_CONNECTIONS = 4;
+const size_t DEFAULT_REQUESTS = 1000;
+const size_t DEFAULT_BATCH = 16;
+const size_t DEFAULT_MAX = 1000000000;
+const size_t DEFAULT_WIDTH = 10000;
+
+#define NUM_OPS 4
+
+static char const* const op_names[NUM_OPS] = {"is_prime", "next_prime", "count", "range"};
+
+typedef struct {
+    char const* socket_path;
+    size_t requests;
+    size_t batch;
+    size_t max; // Queries are about numbers below this
+    size_t width; // The width of count and range queries
+    server_op_t ops[NUM_OPS];
+    size_t num_ops;
+} load_t;
+
+typedef struct {
+    load_t const* load;
+    pthread_t thread;
+    uint64_t seed;
+
+    double* us; // Each request's round trip
+    size_t failed; // Queries that came back with an error
+    size_t primes; // Primes listed by range queries
+} connection_t;
+
+static void print_help(char const* prog_name) {
+    printf("usage: %s [-S socket] [-c connections] [-n requests] [-B batch] [-o ops] [-l max] [-w width] [-s seed]\n",
+           prog_name);
+    printf("\tsends batches of random queries to a sieve server and reports throughput and latency.\n");
+    printf("\t-S: the server's socket. Default is %s.\n", SERVER_SOCKET_PATH);
+    printf("\t-c: the number of connections, each with its own thread. Default is %lu.\n", DEFAULT_CONNECTIONS);
+    printf("\t-n: the number of requests each connection sends. Default is %lu.\n", DEFAULT_REQUESTS);
+    printf("\t-B: the number of queries in each request, up to %d. Default is %lu.\n", SERVER_MAX_BATCH, DEFAULT_BATCH);
+    printf("\t-o: the queries to pick from at random, out of is_prime, next_prime, count and range, comma\n");
+    printf("\t    separated. Default is all of them.\n");
+    printf("\t-l: queries are about numbers below this; it must be below the server's limit. Default is %lu.\n",
+           DEFAULT_MAX);
+    printf("\t-w: the width of the count and range queries. Default is %lu.\n", DEFAULT_WIDTH);
+    printf("\t-s: the random seed. Default is 1.\n");
+    printf("\t-h: print this help message and exit.\n");
+}
+
+static size_t parse_ops(char const* arg, server_op_t* ops) {
+    char* copy = strdup(arg);
+    size_t count = 0;
+
+    for (char* tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+        size_t op = 0;
+        while (op < NUM_OPS && strcmp(tok, op_names[op]) != 0) {
+            ++op;
+        }
+        if (op == NUM_OPS || count == NUM_OPS) {
+            fprintf(stderr, "Unknown query %s.\n", tok);
+            exit(EXIT_FAILURE);
+        }
+        ops[count++] = (server_op_t)(SERVER_OP_IS_PRIME + op);
+    }
+
+    free(copy);
+    return count;
+}
+
+// xorshift64*
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dull;
+}
+
+static void* do_connection(void* connection_params) {
+    connection_t* conn = (connection_t*)connection_params;
+    load_t const* load = conn->load;
+
+    int fd = server_connect(load->socket_path);
+    server_query_t* queries = malloc(sizeof(server_query_t) * load->batch);
+    server_result_t* results = malloc(sizeof(server_result_t) * load->batch);
+    if (fd == -1 || !queries || !results) {
+        perror("Error connecting to server");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start, end;
+    for (size_t r = 0; r < load->requests; ++r) {
+        for (size_t i = 0; i < load->batch; ++i) {
+            uint64_t a = next_random(&conn->seed) % load->max;
+            uint64_t b = a + load->width < load->max ? a + load->width : load->max;
+            queries[i] = (server_query_t){load->ops[next_random(&conn->seed) % load->num_ops], 0, a, b};
+        }
+
+        CTIME(int ret = server_call(fd, queries, load->batch, results, NULL, 0))
+        if (ret == -1) {
+            perror("Error sending queries");
+            exit(EXIT_FAILURE);
+        }
+        conn->us[r] = get_delay(start, end) * 1000.0;
+
+        for (size_t i = 0; i < load->batch; ++i) {
+            conn->failed += results[i].status != 0;
+            conn->primes += results[i].num_primes;
+        }
+    }
+
+    close(fd);
+    free(queries);
+    free(results);
+    return NULL;
+}
+
+static int compare_doubles(void const* a, void const* b) {
+    double x = *(double const*)a;
+    double y = *(double const*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    load_t load = {SERVER_SOCKET_PATH, DEFAULT_REQUESTS, DEFAULT_BATCH, DEFAULT_MAX, DEFAULT_WIDTH,
+                   {SERVER_OP_IS_PRIME, SERVER_OP_NEXT_PRIME, SERVER_OP_COUNT, SERVER_OP_RANGE}, NUM_OPS};
+    size_t num_connections = DEFAULT_CONNECTIONS;
+    uint64_t seed = 1;
+
+    int c;
+    while ((c = getopt(argc, argv, "S:c:n:B:o:l:w:s:h")) != -1) {
+        switch (c) {
+            case 'S':
+                load.socket_path = optarg;
+                break;
+            case 'c':
+                if (sscanf(optarg, "%lu", &num_connections) != 1 || num_connections == 0) {
+                    fprintf(stderr, "Invalid argument %s for -c.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'n':
+                if (sscanf(optarg, "%lu", &load.requests) != 1 || load.requests == 0) {
+                    fprintf(stderr, "Invalid argument %s for -n.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'B':
+                if (sscanf(optarg, "%lu", &load.batch) != 1 || load.batch == 0 || load.batch > SERVER_MAX_BATCH) {
+                    fprintf(stderr, "Invalid argument %s for -B.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'o':
+                load.num_ops = parse_ops(optarg, load.ops);
+                break;
+            case 'l':
+                if (sscanf(optarg, "%lu", &load.max) != 1 || load.max == 0) {
+                    fprintf(stderr, "Invalid argument %s for -l.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'w':
+                if (sscanf(optarg, "%lu", &load.width) != 1) {
+                    fprintf(stderr, "Invalid argument %s for -w.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                if (sscanf(optarg, "%lu", &seed) != 1) {
+                    fprintf(stderr, "Invalid argument %s for -s.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                print_help(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "See %s -h for help.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    connection_t* conns = calloc(num_connections, sizeof(connection_t));
+    double* us = malloc(sizeof(double) * num_connections * load.requests);
+    if (!conns || !us) {
+        perror("Error allocating");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start, end;
+    CTIME
+    (
+        for (size_t i = 0; i < num_connections; ++i) {
+            conns[i].load = &load;
+            // xorshift needs a nonzero state
+            conns[i].seed = (seed + i) * 0x9e3779b97f4a7c15ull | 1;
+            conns[i].us = us + i * load.requests;
+            if ((errno = pthread_create(&conns[i].thread, NULL, do_connection, &conns[i])) != 0) {
+                perror("Error creating thread");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (size_t i = 0; i < num_connections; ++i) {
+            pthread_join(conns[i].thread, NULL);
+        }
+    )
+    double total_ms = get_delay(start, end);
+
+    size_t failed = 0;
+    size_t primes = 0;
+    for (size_t i = 0; i < num_connections; ++i) {
+        failed += conns[i].failed;
+        primes += conns[i].primes;
+    }
+
+    size_t requests = num_connections * load.requests;
+    double mean = 0.0;
+    for (size_t i = 0; i < requests; ++i) {
+        mean += us[i] / requests;
+    }
+    qsort(us, requests, sizeof(double), compare_doubles);
+
+    printf("%lu requests of %lu queries over %lu connections in %.4fms: %.0f requests/s, %.0f queries/s.\n",
+           requests, load.batch, num_connections, total_ms, requests / total_ms * 1000.0,
+           requests * load.batch / total_ms * 1000.0);
+    printf("Latency per request: mean %.3fus  p50 %.3fus  p90 %.3fus  p99 %.3fus  p99.9 %.3fus  max %.3fus\n", mean,
+           us[requests / 2], us[requests * 90 / 100], us[requests * 99 / 100], us[requests * 999 / 1000],
+           us[requests - 1]);
+    printf("%lu primes listed, %lu queries failed.\n", primes, failed);
+
+    free(conns);
+    free(us);
+    return EXIT_SUCCESS;
+}
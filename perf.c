@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+static const struct {
+    char const* name;
+    uint32_t type;
+    uint64_t config;
+} counter_events[PERF_NUM_COUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"ctx switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+// The report: a header, then PERF_MAX_PHASES phases for each job
+typedef struct {
+    size_t num_jobs;
+    int available[PERF_NUM_COUNTERS]; // Set by any job that managed to open the counter
+} report_header_t;
+
+static report_header_t* report;
+static size_t report_size;
+
+static long perf_event_open(struct perf_event_attr* attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+int perf_session_start(size_t num_jobs) {
+    report_size = sizeof(report_header_t) + sizeof(perf_phase_t) * PERF_MAX_PHASES * num_jobs;
+
+    // Shared, so that forked jobs fill in the same report
+    report = mmap(NULL, report_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (report == MAP_FAILED) {
+        report = NULL;
+        return -1;
+    }
+
+    report->num_jobs = num_jobs;
+    return 0;
+}
+
+int perf_session_active(void) {
+    return report != NULL;
+}
+
+static void print_row(FILE* out, report_header_t const* header, char const* name, char const* job,
+                      perf_phase_t const* phase) {
+    fprintf(out, "%-28s %-5s %10lu %12.4f", name, job, phase->calls, phase->ms);
+    for (size_t c = 0; c < PERF_NUM_COUNTERS; ++c) {
+        if (header->available[c]) {
+            fprintf(out, " %15lu", (unsigned long)phase->counts[c]);
+        } else {
+            fprintf(out, " %15s", "-");
+        }
+    }
+
+    if (header->available[PERF_CYCLES] && header->available[PERF_INSTRUCTIONS] && phase->counts[PERF_CYCLES]) {
+        fprintf(out, " %6.2f\n", (double)phase->counts[PERF_INSTRUCTIONS] / phase->counts[PERF_CYCLES]);
+    } else {
+        fprintf(out, " %6s\n", "-");
+    }
+}
+
+int perf_session_finish(char const* path) {
+    if (!report) {
+        return 0;
+    }
+
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        munmap(report, report_size);
+        report = NULL;
+        return -1;
+    }
+
+    perf_phase_t const* rows = (perf_phase_t const*)(report + 1);
+
+    fprintf(out, "%-28s %-5s %10s %12s", "phase", "job", "calls", "ms");
+    for (size_t c = 0; c < PERF_NUM_COUNTERS; ++c) {
+        fprintf(out, " %15s", counter_events[c].name);
+    }
+    fprintf(out, " %6s\n", "IPC");
+
+    // Every phase that any job timed, per job and then in total
+    for (size_t j = 0; j < report->num_jobs; ++j) {
+        for (size_t p = 0; p < PERF_MAX_PHASES && rows[j * PERF_MAX_PHASES + p].name[0]; ++p) {
+            char const* name = rows[j * PERF_MAX_PHASES + p].name;
+
+            // Only the first job to have the phase prints it
+            int seen = 0;
+            for (size_t k = 0; k < j && !seen; ++k) {
+                for (size_t q = 0; q < PERF_MAX_PHASES && !seen; ++q) {
+                    seen = strcmp(rows[k * PERF_MAX_PHASES + q].name, name) == 0;
+                }
+            }
+            if (seen) {
+                continue;
+            }
+
+            perf_phase_t total;
+            memset(&total, 0, sizeof(total));
+            for (size_t k = j; k < report->num_jobs; ++k) {
+                for (size_t q = 0; q < PERF_MAX_PHASES; ++q) {
+                    perf_phase_t const* phase = &rows[k * PERF_MAX_PHASES + q];
+                    if (strcmp(phase->name, name) != 0) {
+                        continue;
+                    }
+
+                    char job[24];
+                    snprintf(job, sizeof(job), "%lu", k);
+                    print_row(out, report, name, job, phase);
+
+                    total.calls += phase->calls;
+                    total.ms += phase->ms;
+                    for (size_t c = 0; c < PERF_NUM_COUNTERS; ++c) {
+                        total.counts[c] += phase->counts[c];
+                    }
+                }
+            }
+            print_row(out, report, name, "all", &total);
+        }
+    }
+
+    int ret = fclose(out);
+    munmap(report, report_size);
+    report = NULL;
+    return ret;
+}
+
+void perf_job_open(perf_job_t* job, size_t job_id) {
+    job->phases = NULL;
+    job->leader = -1;
+    job->num_open = 0;
+    for (size_t c = 0; c < PERF_NUM_COUNTERS; ++c) {
+        job->fds[c] = -1;
+    }
+
+    if (!report || job_id >= report->num_jobs) {
+        return;
+    }
+    job->phases = (perf_phase_t*)(report + 1) + job_id * PERF_MAX_PHASES;
+
+    // One group, so a phase boundary is a single read. Counters that won't open are just left out.
+    for (size_t c = 0; c < PERF_NUM_COUNTERS; ++c) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_events[c].type;
+        attr.config = counter_events[c].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_hv = 1;
+
+        // Context switches only ever happen in the kernel, so they're counted there if we're allowed to
+        attr.exclude_kernel = counter_events[c].type != PERF_TYPE_SOFTWARE;
+        int fd = perf_event_open(&attr, 0, -1, job->leader, 0);
+        if (fd == -1 && !attr.exclude_kernel) {
+            attr.exclude_kernel = 1;
+            fd = perf_event_open(&attr, 0, -1, job->leader, 0);
+        }
+        if (fd == -1) {
+            continue;
+        }
+
+        if (job->leader == -1) {
+            job->leader = fd;
+        }
+        job->fds[c] = fd;
+        job->order[job->num_open++] = (int)c;
+        __atomic_store_n(&report->available[c], 1, __ATOMIC_RELAXED);
+    }
+
+    if (job->leader != -1) {
+        ioctl(job->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(job->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void perf_job_close(perf_job_t* job) {
+    for (size_t c = 0; c < PERF_NUM_COUNTERS; ++c) {
+        if (job->fds[c] != -1 && job->fds[c] != job->leader) {
+            close(job->fds[c]);
+        }
+    }
+    if (job->leader != -1) {
+        close(job->leader);
+    }
+    job->leader = -1;
+    job->phases = NULL;
+}
+
+// Reads the group into values, indexed by counter
+static int read_counters(perf_job_t const* job, uint64_t* values) {
+    uint64_t buf[1 + PERF_NUM_COUNTERS];
+    size_t size = sizeof(uint64_t) * (1 + job->num_open);
+
+    // The group has to report every counter that was opened, or the values can't be lined up
+    if (read(job->leader, buf, size) != (ssize_t)size || buf[0] != job->num_open) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < job->num_open; ++i) {
+        values[job->order[i]] = buf[1 + i];
+    }
+    return 0;
+}
+
+void perf_phase_begin(perf_job_t* job) {
+    if (job->phases && job->leader != -1) {
+        read_counters(job, job->begin);
+    }
+}
+
+void perf_phase_end(perf_job_t* job, char const* phase, double ms) {
+    if (!job->phases) {
+        return;
+    }
+
+    size_t p = 0;
+    while (p < PERF_MAX_PHASES && job->phases[p].name[0] && strcmp(job->phases[p].name, phase) != 0) {
+        ++p;
+    }
+    if (p == PERF_MAX_PHASES) {
+        return;
+    }
+
+    perf_phase_t* totals = &job->phases[p];
+    if (!totals->name[0]) {
+        snprintf(totals->name, PERF_PHASE_NAME_SIZE, "%s", phase);
+    }
+    ++totals->calls;
+    totals->ms += ms;
+
+    uint64_t end[PERF_NUM_COUNTERS];
+    if (job->leader != -1 && read_counters(job, end) == 0) {
+        for (size_t i = 0; i < job->num_open; ++i) {
+            int c = job->order[i];
+            totals->counts[c] += end[c] - job->begin[c];
+        }
+    }
+}
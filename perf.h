@@ -0,0 +1,113 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the aggregated report goes
+#define PERF_REPORT_FILENAME "perf.report"
+
+// The most distinct phases a job can time, and the longest phase name
+#define PERF_MAX_PHASES 8
+#define PERF_PHASE_NAME_SIZE 32
+
+/*
+ * Hardware performance counters, as an optional layer on top of timing.h.
+ *
+ * While a session is running, every job opens its own counters with perf_event_open() and reads them around the same
+ * phases that it times with CTIME (see PTIME below). Each job keeps its totals in its own row of a shared mapping, so
+ * it works the same for threads and for forked processes, and the main process writes one report for every job at
+ * the end. Counters that can't be opened (no PMU in a VM, or perf_event_paranoid too high) are left out of the
+ * report rather than failing the run; with none at all, the report still has the wall-clock times.
+ */
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_NUM_COUNTERS
+} perf_counter_t;
+
+/**
+ * A phase's totals for one job.
+ */
+typedef struct {
+    char name[PERF_PHASE_NAME_SIZE];
+    size_t calls;
+    double ms;
+    uint64_t counts[PERF_NUM_COUNTERS];
+} perf_phase_t;
+
+/**
+ * A job's counters, and its row of the report. Everything is a no-op if there's no session.
+ */
+typedef struct {
+    int fds[PERF_NUM_COUNTERS]; // -1 for counters that couldn't be opened
+    int leader; // The fd the group is read through, or -1 if none of the counters could be opened
+    int order[PERF_NUM_COUNTERS]; // Which counter each value in a group read belongs to
+    size_t num_open;
+
+    uint64_t begin[PERF_NUM_COUNTERS];
+    perf_phase_t* phases; // This job's row of the report, or NULL if there's no session
+} perf_job_t;
+
+/**
+ * Starts a session for a number of jobs. Call it before creating the jobs, so that forked ones share the report.
+ *
+ * @param num_jobs The number of jobs.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int perf_session_start(size_t num_jobs);
+
+/**
+ * Checks whether a session is running.
+ *
+ * @return 1 if it is, 0 if it isn't.
+ */
+int perf_session_active(void);
+
+/**
+ * Writes the report for every job that has finished and ends the session.
+ *
+ * @param path The file to write the report to.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int perf_session_finish(char const* path);
+
+/**
+ * Opens a job's counters for the calling thread.
+ *
+ * @param job    The job's counters.
+ * @param job_id The job's ID, which picks its row of the report.
+ */
+void perf_job_open(perf_job_t* job, size_t job_id);
+
+/**
+ * Closes a job's counters.
+ *
+ * @param job The job's counters.
+ */
+void perf_job_close(perf_job_t* job);
+
+/**
+ * Reads the counters at the start of a phase.
+ *
+ * @param job The job's counters.
+ */
+void perf_phase_begin(perf_job_t* job);
+
+/**
+ * Reads the counters at the end of a phase and adds what changed to the phase's totals.
+ *
+ * @param job   The job's counters.
+ * @param phase The phase's name. At most PERF_MAX_PHASES distinct names are kept per job.
+ * @param ms    The wall-clock time the phase took.
+ */
+void perf_phase_end(perf_job_t* job, char const* phase, double ms);
+
+// CTIME, but also reads a job's counters around the statement and adds them to the named phase. Like CTIME, it
+// assumes the names: the counters are a perf_job_t called perf. Include timing.h as well to use it.
+#define PTIME(phase, ...) \
+    perf_phase_begin(&perf); \
+    CTIME(__VA_ARGS__) \
+    perf_phase_end(&perf, phase, get_delay(start, end));
@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/mman.h>
+
+#include "arena.h"
+
+#define HUGE_2M ((size_t)1 << 21)
+#define HUGE_1G ((size_t)1 << 30)
+
+// The arena kept by the last arena_release(), if any
+static sieve_arena_t released;
+static int have_released = 0;
+
+static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+// Maps len bytes of huge pages (MAP_HUGE_2MB or MAP_HUGE_1GB), or returns NULL if there aren't enough reserved
+static unsigned char* map_huge(size_t len, int huge_flag, int flags) {
+    int share = flags & ARENA_SHARED ? MAP_SHARED : MAP_PRIVATE;
+    void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, share | MAP_ANONYMOUS | MAP_HUGETLB | huge_flag, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// Maps len bytes of normal pages on a 2MiB boundary, so that transparent huge pages can back all of it
+static unsigned char* map_thp(size_t len, int flags) {
+    int share = flags & ARENA_SHARED ? MAP_SHARED : MAP_PRIVATE;
+    unsigned char* p = mmap(NULL, len + HUGE_2M, PROT_READ | PROT_WRITE, share | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    // Trim the mapping down to the aligned part
+    unsigned char* base = (unsigned char*)round_up((uintptr_t)p, HUGE_2M);
+    if (base > p) {
+        munmap(p, base - p);
+    }
+    munmap(base + len, p + len + HUGE_2M - (base + len));
+    return base;
+}
+
+int arena_init(sieve_arena_t* arena, size_t size, int flags) {
+    arena->base = NULL;
+    arena->used = 0;
+    arena->flags = flags;
+
+    if (size == 0) {
+        size = 1;
+    }
+
+    // Huge pages only pay off, and only get used, once an arena is at least a page
+    if (size >= HUGE_1G) {
+        arena->size = round_up(size, HUGE_1G);
+        arena->pages = ARENA_PAGES_1G;
+        arena->base = map_huge(arena->size, MAP_HUGE_1GB, flags);
+    }
+
+    if (!arena->base && size >= HUGE_2M) {
+        arena->size = round_up(size, HUGE_2M);
+        arena->pages = ARENA_PAGES_2M;
+        arena->base = map_huge(arena->size, MAP_HUGE_2MB, flags);
+    }
+
+    if (!arena->base && size >= HUGE_2M) {
+        arena->size = round_up(size, HUGE_2M);
+        arena->pages = ARENA_PAGES_THP;
+        arena->base = map_thp(arena->size, flags);
+        if (arena->base) {
+            // Only a hint: it fails harmlessly where THP is disabled
+            madvise(arena->base, arena->size, MADV_HUGEPAGE);
+        }
+    }
+
+    if (!arena->base) {
+        arena->size = round_up(size, (size_t)sysconf(_SC_PAGESIZE));
+        arena->pages = ARENA_PAGES_NORMAL;
+        int share = flags & ARENA_SHARED ? MAP_SHARED : MAP_PRIVATE;
+        void* p = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, share | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return -1;
+        }
+        arena->base = p;
+    }
+
+    return 0;
+}
+
+int arena_acquire(sieve_arena_t* arena, size_t size, int flags) {
+    if (have_released && released.flags == flags && released.size >= size) {
+        *arena = released;
+        have_released = 0;
+        arena_reset(arena);
+        return 0;
+    }
+
+    return arena_init(arena, size, flags);
+}
+
+void arena_release(sieve_arena_t* arena) {
+    if (have_released) {
+        arena_destroy(&released);
+    }
+
+    released = *arena;
+    have_released = 1;
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+void* arena_alloc(sieve_arena_t* arena, size_t size) {
+    size_t offset = round_up(arena->used, ARENA_ALIGN);
+    if (offset > arena->size || size > arena->size - offset) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+void arena_reset(sieve_arena_t* arena) {
+    arena->used = 0;
+}
+
+void arena_destroy(sieve_arena_t* arena) {
+    if (arena->base) {
+        munmap(arena->base, arena->size);
+    }
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+size_t arena_page_size(sieve_arena_t const* arena) {
+    switch (arena->pages) {
+        case ARENA_PAGES_1G:
+            return HUGE_1G;
+        case ARENA_PAGES_2M:
+        case ARENA_PAGES_THP:
+            return HUGE_2M;
+        default:
+            return (size_t)sysconf(_SC_PAGESIZE);
+    }
+}
+
+char const* arena_pages_name(sieve_arena_t const* arena) {
+    switch (arena->pages) {
+        case ARENA_PAGES_1G:
+            return "1GiB";
+        case ARENA_PAGES_2M:
+            return "2MiB";
+        case ARENA_PAGES_THP:
+            return "THP";
+        default:
+            return "normal";
+    }
+}
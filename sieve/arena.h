@@ -0,0 +1,105 @@
+#pragma once
+#include <stddef.h>
+
+/*
+ * Arenas for the big sieve buffers.
+ *
+ * An arena is one mapping that buffers are carved out of in order and that's only ever given back as a whole. It's
+ * backed by the biggest pages available: 1GiB or 2MiB huge pages if the kernel has any reserved (see
+ * /proc/sys/vm/nr_hugepages), or otherwise normal pages on a 2MiB boundary with transparent huge pages asked for.
+ * Either way there are far fewer TLB misses and page faults over a multi-GB array.
+ *
+ * Nothing is zeroed or touched up front, so that pages are faulted in by whichever job first writes to them: the jobs
+ * pre-sieve their own parts in parallel, rather than the master clearing the lot. For the same reason, buffers aren't
+ * zeroed when an arena is reused.
+ */
+
+// Arena flags
+#define ARENA_SHARED 1 // Shared with forked children, rather than copied on write
+
+// Every buffer is aligned to this, so an arena needs up to this much more than the buffers add up to
+#define ARENA_ALIGN 64
+
+typedef enum {
+    ARENA_PAGES_NORMAL,
+    ARENA_PAGES_THP, // Normal pages, with transparent huge pages asked for
+    ARENA_PAGES_2M,
+    ARENA_PAGES_1G
+} arena_pages_t;
+
+typedef struct {
+    unsigned char* base;
+    size_t size; // Length of the mapping in bytes
+    size_t used;
+    int flags;
+    arena_pages_t pages;
+} sieve_arena_t;
+
+/**
+ * Maps a new arena.
+ *
+ * @param arena The arena.
+ * @param size  The number of bytes it needs to hold, counting up to ARENA_ALIGN bytes of padding per buffer.
+ * @param flags ARENA_SHARED, or 0.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int arena_init(sieve_arena_t* arena, size_t size, int flags);
+
+/**
+ * Gets an arena of at least size bytes, reusing the last one that was released if it's big enough and has the same
+ * flags, and mapping a new one otherwise. The arena starts out empty.
+ *
+ * @param arena The arena.
+ * @param size  The number of bytes it needs to hold.
+ * @param flags ARENA_SHARED, or 0.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int arena_acquire(sieve_arena_t* arena, size_t size, int flags);
+
+/**
+ * Gives an arena back to be reused by the next arena_acquire(), unmapping whichever one was kept before. Only one
+ * arena is kept at a time.
+ *
+ * @param arena The arena.
+ */
+void arena_release(sieve_arena_t* arena);
+
+/**
+ * Carves a buffer out of an arena. Buffers start on a cache line.
+ *
+ * @param arena The arena.
+ * @param size  The size of the buffer in bytes.
+ * @return The buffer, or NULL if the arena doesn't have room (with errno set).
+ */
+void* arena_alloc(sieve_arena_t* arena, size_t size);
+
+/**
+ * Empties an arena so that its memory can be handed out again, without unmapping it.
+ *
+ * @param arena The arena.
+ */
+void arena_reset(sieve_arena_t* arena);
+
+/**
+ * Unmaps an arena.
+ *
+ * @param arena The arena.
+ */
+void arena_destroy(sieve_arena_t* arena);
+
+/**
+ * Gets the size of the pages backing an arena. Parts of it that are meant for different NUMA nodes should be split
+ * on this.
+ *
+ * @param arena The arena.
+ * @return The page size in bytes, counting transparent huge pages as 2MiB.
+ */
+size_t arena_page_size(sieve_arena_t const* arena);
+
+/**
+ * Gets the name of the pages backing an arena.
+ *
+ * @param arena The arena.
+ * @return "1GiB", "2MiB", "THP" or "normal".
+ */
+char const* arena_pages_name(sieve_arena_t const* arena);
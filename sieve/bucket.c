@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#include "bucket.h"
+#include "common.h"
+
+// Bits of a bucket entry's position that hold its wheel index
+#define WHEEL_INDEX_BITS 6
+#define WHEEL_INDEX_MASK ((1u << WHEEL_INDEX_BITS) - 1)
+
+/*
+ * How to get from one multiple of a prime to the next multiple that's coprime to 30, for each wheel index. If the
+ * multiple is at byte b, the next one is at byte b + (prime / 30) * delta + carry and lands on the bit in mask.
+ * delta is the gap to the multiplier's next residue and carry is what prime % 30 contributes to the byte.
+ */
+typedef struct {
+    unsigned char delta;
+    unsigned char carry;
+    unsigned char mask; // The bit that the current multiple lands on
+    unsigned char next; // The wheel index of the next multiple
+} wheel_step_t;
+
+static const wheel_step_t wheel_steps[WHEEL_SPOKES * WHEEL_SPOKES] = {
+    // prime % 30 == 1
+    {6, 0, 0x01, 1}, {4, 0, 0x02, 2}, {2, 0, 0x04, 3}, {4, 0, 0x08, 4},
+    {2, 0, 0x10, 5}, {4, 0, 0x20, 6}, {6, 0, 0x40, 7}, {2, 1, 0x80, 0},
+    // prime % 30 == 7
+    {6, 1, 0x02, 9}, {4, 1, 0x20, 10}, {2, 1, 0x10, 11}, {4, 0, 0x01, 12},
+    {2, 1, 0x80, 13}, {4, 1, 0x08, 14}, {6, 1, 0x04, 15}, {2, 1, 0x40, 8},
+    // prime % 30 == 11
+    {6, 2, 0x04, 17}, {4, 2, 0x10, 18}, {2, 0, 0x01, 19}, {4, 2, 0x40, 20},
+    {2, 0, 0x02, 21}, {4, 2, 0x80, 22}, {6, 2, 0x08, 23}, {2, 1, 0x20, 16},
+    // prime % 30 == 13
+    {6, 3, 0x08, 25}, {4, 1, 0x01, 26}, {2, 1, 0x40, 27}, {4, 2, 0x20, 28},
+    {2, 1, 0x04, 29}, {4, 1, 0x02, 30}, {6, 3, 0x80, 31}, {2, 1, 0x10, 24},
+    // prime % 30 == 17
+    {6, 3, 0x10, 33}, {4, 3, 0x80, 34}, {2, 1, 0x02, 35}, {4, 2, 0x04, 36},
+    {2, 1, 0x20, 37}, {4, 3, 0x40, 38}, {6, 3, 0x01, 39}, {2, 1, 0x08, 32},
+    // prime % 30 == 19
+    {6, 4, 0x20, 41}, {4, 2, 0x08, 42}, {2, 2, 0x80, 43}, {4, 2, 0x02, 44},
+    {2, 2, 0x40, 45}, {4, 2, 0x01, 46}, {6, 4, 0x10, 47}, {2, 1, 0x04, 40},
+    // prime % 30 == 23
+    {6, 5, 0x40, 49}, {4, 3, 0x04, 50}, {2, 1, 0x08, 51}, {4, 4, 0x80, 52},
+    {2, 1, 0x01, 53}, {4, 3, 0x10, 54}, {6, 5, 0x20, 55}, {2, 1, 0x02, 48},
+    // prime % 30 == 29
+    {6, 6, 0x80, 57}, {4, 4, 0x40, 58}, {2, 2, 0x20, 59}, {4, 4, 0x10, 60},
+    {2, 2, 0x08, 61}, {4, 4, 0x04, 62}, {6, 6, 0x02, 63}, {2, 1, 0x01, 56},
+};
+
+// Takes a block from the free list, carving a new slab into it if it's empty
+static bucket_block_t* take_block(bucket_sieve_t* bs) {
+    if (!bs->free_blocks) {
+        if (bs->num_slabs == bs->slab_cap) {
+            size_t cap = bs->slab_cap ? bs->slab_cap * 2 : 8;
+            bucket_block_t** slabs = realloc(bs->slabs, sizeof(bucket_block_t*) * cap);
+            if (!slabs) {
+                return NULL;
+            }
+            bs->slabs = slabs;
+            bs->slab_cap = cap;
+        }
+
+        bucket_block_t* slab = malloc(sizeof(bucket_block_t) * BUCKET_SLAB_BLOCKS);
+        if (!slab) {
+            return NULL;
+        }
+        bs->slabs[bs->num_slabs++] = slab;
+
+        for (size_t i = 0; i < BUCKET_SLAB_BLOCKS; ++i) {
+            slab[i].next = bs->free_blocks;
+            bs->free_blocks = &slab[i];
+        }
+    }
+
+    bucket_block_t* block = bs->free_blocks;
+    bs->free_blocks = block->next;
+    return block;
+}
+
+static void give_block(bucket_sieve_t* bs, bucket_block_t* block) {
+    block->next = bs->free_blocks;
+    bs->free_blocks = block;
+}
+
+static int push(bucket_sieve_t* bs, size_t index, uint32_t prime_q, uint32_t position) {
+    bucket_block_t* block = bs->buckets[index];
+
+    if (!block || block->count == BUCKET_BLOCK_ENTRIES) {
+        bucket_block_t* fresh = take_block(bs);
+        if (!fresh) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        fresh->next = block;
+        fresh->count = 0;
+        bs->buckets[index] = block = fresh;
+    }
+
+    block->entries[block->count++] = (bucket_entry_t){prime_q, position};
+    return 0;
+}
+
+int bucket_sieve_init(bucket_sieve_t* bs, size_t segment_size, size_t max_segments) {
+    bs->segment_size = segment_size;
+    bs->max_segments = max_segments;
+    bs->num_segments = 0;
+
+    bs->free_blocks = NULL;
+    bs->slabs = NULL;
+    bs->num_slabs = 0;
+    bs->slab_cap = 0;
+
+    bs->buckets = calloc(max_segments, sizeof(bucket_block_t*));
+    return bs->buckets ? 0 : -1;
+}
+
+void bucket_sieve_free(bucket_sieve_t* bs) {
+    for (size_t i = 0; i < bs->num_slabs; ++i) {
+        free(bs->slabs[i]);
+    }
+    free(bs->slabs);
+    free(bs->buckets);
+}
+
+int bucket_sieve_seed(bucket_sieve_t* bs, size_t const* primes, size_t num_primes, size_t chunk_start,
+                      size_t num_segments) {
+    // Anything left over from the last chunk ran past its end
+    for (size_t i = 0; i < bs->num_segments; ++i) {
+        while (bs->buckets[i]) {
+            bucket_block_t* block = bs->buckets[i];
+            bs->buckets[i] = block->next;
+            give_block(bs, block);
+        }
+    }
+    bs->num_segments = num_segments;
+
+    size_t chunk_len = num_segments * bs->segment_size;
+    size_t start = chunk_start * WHEEL_MODULUS;
+
+    for (size_t i = 0; i < num_primes; ++i) {
+        size_t prime = primes[i];
+
+        // Primes are sorted, so once one's square is past the chunk, so are the rest
+        if (prime * prime / WHEEL_MODULUS >= chunk_start + chunk_len) {
+            break;
+        }
+
+        // The first multiplier >= max(prime, start / prime) that is coprime to 30; 31 wraps around to residue 1
+        size_t first_mult = start / prime + (start % prime != 0);
+        if (first_mult < prime) {
+            first_mult = prime;
+        }
+        size_t residue = first_mult % WHEEL_MODULUS;
+        size_t k = wheel_residue_ceil[residue];
+        size_t mult = first_mult - residue + (k < WHEEL_SPOKES ? wheel_residues[k] : WHEEL_MODULUS + 1);
+
+        // A multiple past 2^64 is past any chunk too
+        if (mult > (size_t)-1 / prime) {
+            continue;
+        }
+
+        size_t offset = prime * mult / WHEEL_MODULUS - chunk_start;
+        if (offset >= chunk_len) {
+            continue;
+        }
+
+        uint32_t wheel = wheel_residue_ceil[prime % WHEEL_MODULUS] * WHEEL_SPOKES + k % WHEEL_SPOKES;
+        uint32_t position = (offset % bs->segment_size) << WHEEL_INDEX_BITS | wheel;
+        if (push(bs, offset / bs->segment_size, prime / WHEEL_MODULUS, position) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int bucket_sieve_segment(bucket_sieve_t* bs, unsigned char* segment, size_t len, size_t index) {
+    bucket_block_t* block = bs->buckets[index];
+    bs->buckets[index] = NULL;
+
+    while (block) {
+        for (uint32_t i = 0; i < block->count; ++i) {
+            size_t prime_q = block->entries[i].prime_q;
+            size_t offset = block->entries[i].position >> WHEEL_INDEX_BITS;
+            uint32_t wheel = block->entries[i].position & WHEEL_INDEX_MASK;
+
+            // Consecutive multiples are only prime * 2 / 30 bytes apart, so an entry can strike a segment more than
+            // once
+            while (offset < len) {
+                wheel_step_t const* step = &wheel_steps[wheel];
+                segment[offset] |= step->mask;
+                offset += prime_q * step->delta + step->carry;
+                wheel = step->next;
+            }
+
+            // A short segment is the last one in the range, so anything left in it is done
+            size_t next = index + offset / bs->segment_size;
+            if (next == index || next >= bs->num_segments) {
+                continue;
+            }
+
+            uint32_t position = (offset % bs->segment_size) << WHEEL_INDEX_BITS | wheel;
+            if (push(bs, next, prime_q, position) == -1) {
+                return -1;
+            }
+        }
+
+        bucket_block_t* done = block;
+        block = block->next;
+        give_block(bs, done);
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Entries per bucket block; a block is just under 8KiB so a bucket being filled or drained stays in L1
+#define BUCKET_BLOCK_ENTRIES 1022
+
+// Blocks allocated at once when a pool runs dry
+#define BUCKET_SLAB_BLOCKS 64
+
+// The largest segment a bucket sieve can handle, since offsets into a segment are stored in 26 bits
+#define BUCKET_MAX_SEGMENT_SIZE ((size_t)1 << 26)
+
+/**
+ * A large sieving prime and its next multiple, packed into 8 bytes.
+ *
+ * The prime is stored as prime / 30. The position holds the offset of the multiple's byte in the segment it falls
+ * in (the top 26 bits) and its wheel index (the bottom 6 bits): the index of prime % 30 in wheel_residues times 8,
+ * plus the index of the multiplier's residue.
+ */
+typedef struct {
+    uint32_t prime_q;
+    uint32_t position;
+} bucket_entry_t;
+
+/**
+ * A block of bucket entries. Buckets are linked lists of blocks, newest first.
+ */
+typedef struct bucket_block {
+    struct bucket_block* next;
+    uint32_t count;
+    bucket_entry_t entries[BUCKET_BLOCK_ENTRIES];
+} bucket_block_t;
+
+/**
+ * Sieves the multiples of large primes into a chunk of consecutive segments (Oliveira e Silva's bucket sieve).
+ *
+ * A prime is large when it's bigger than a segment, so it strikes each segment at most once per multiplier residue
+ * and misses most segments entirely. Rather than checking every large prime against every segment, each one sits in
+ * the bucket of the segment its next multiple falls in. Sieving a segment empties its bucket: every entry strikes
+ * its multiple and moves on to the bucket of the segment its following multiple falls in, or is dropped once it's
+ * past the end of the chunk.
+ *
+ * Each large prime has at most one entry at a time, so memory use is 8 bytes per large prime plus a partly filled
+ * block per segment. Blocks are recycled through a free list rather than freed, so a bucket sieve only allocates
+ * while it grows to its working size.
+ */
+typedef struct {
+    size_t segment_size;
+    size_t max_segments;
+
+    bucket_block_t** buckets; // The bucket for each segment of the chunk
+    size_t num_segments; // The number of segments in the current chunk
+
+    // Free blocks, and the slabs they were carved from
+    bucket_block_t* free_blocks;
+    bucket_block_t** slabs;
+    size_t num_slabs;
+    size_t slab_cap;
+} bucket_sieve_t;
+
+/**
+ * Sets up an empty bucket sieve.
+ *
+ * @param bs           The bucket sieve.
+ * @param segment_size The size of each segment in bytes. Must be <= BUCKET_MAX_SEGMENT_SIZE.
+ * @param max_segments The most segments a chunk can have.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int bucket_sieve_init(bucket_sieve_t* bs, size_t segment_size, size_t max_segments);
+
+/**
+ * Frees a bucket sieve and all of its blocks.
+ *
+ * @param bs The bucket sieve.
+ */
+void bucket_sieve_free(bucket_sieve_t* bs);
+
+/**
+ * Empties the buckets and fills them with the first multiple of each large prime in a new chunk, i.e. the first
+ * multiple >= max(prime * prime, 30 * chunk_start) that is coprime to 30.
+ *
+ * @param bs           The bucket sieve.
+ * @param primes       The large primes, sorted in increasing order. Each must be > segment_size and < 2^32.
+ * @param num_primes   The number of large primes.
+ * @param chunk_start  The index of the chunk's first byte in the packed composites array.
+ * @param num_segments The number of segments in the chunk. Must be <= max_segments.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int bucket_sieve_seed(bucket_sieve_t* bs, size_t const* primes, size_t num_primes, size_t chunk_start,
+                      size_t num_segments);
+
+/**
+ * Strikes the multiples of the large primes in one segment of the chunk and moves each entry on to its next
+ * segment. Segments must be sieved in order.
+ *
+ * @param bs      The bucket sieve.
+ * @param segment The segment, already cleared and struck by the small primes.
+ * @param len     The length of the segment in bytes. Only the chunk's last segment can be shorter than segment_size.
+ * @param index   The index of the segment in the chunk.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int bucket_sieve_segment(bucket_sieve_t* bs, unsigned char* segment, size_t len, size_t index);
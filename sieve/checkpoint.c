@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "common.h"
+
+// Checks a header read from a file of file_size bytes, before trusting any of it
+static int header_valid(checkpoint_header_t const* header, size_t file_size) {
+    return memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == CHECKPOINT_VERSION && header->bitmap_offset == sizeof(checkpoint_header_t) &&
+           header->sieved_bytes <= file_size - sizeof(checkpoint_header_t);
+}
+
+// Syncs a range of the mapping; msync wants it to start on a page
+static int sync_range(checkpoint_t const* cp, size_t offset, size_t len) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset / page * page;
+    return msync((unsigned char*)cp->map + start, offset + len - start, MS_SYNC);
+}
+
+// Makes the first `bytes` bytes of the bitmap the checkpoint: the bitmap goes to disk before the header that vouches
+// for it
+static int commit(checkpoint_t* cp, size_t bytes) {
+    if (bytes <= cp->header->sieved_bytes) {
+        return 0;
+    }
+
+    if (bytes > cp->hashed_bytes) {
+        cp->hash = fnv1a(cp->hash, cp->bitmap + cp->hashed_bytes, bytes - cp->hashed_bytes);
+        cp->hashed_bytes = bytes;
+    }
+
+    size_t synced = cp->header->sieved_bytes;
+    if (sync_range(cp, cp->header->bitmap_offset + synced, bytes - synced) == -1) {
+        return -1;
+    }
+
+    cp->header->sieved_bytes = bytes;
+    cp->header->checksum = cp->hash;
+    return sync_range(cp, 0, sizeof(checkpoint_header_t));
+}
+
+int checkpoint_open(checkpoint_t* cp, char const* path, size_t hi) {
+    cp->done = NULL;
+    cp->discarded = 0;
+    cp->chunk_size = 0;
+    cp->num_chunks = 0;
+    cp->next_chunk = 0;
+
+    cp->fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (cp->fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(cp->fd, &st) == -1) {
+        close(cp->fd);
+        return -1;
+    }
+
+    // Anything that isn't a checkpoint is started again, but an empty file is just a new one
+    checkpoint_header_t header;
+    size_t sieved = 0;
+    if ((size_t)st.st_size >= sizeof(header) && pread(cp->fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header_valid(&header, st.st_size)) {
+        sieved = header.sieved_bytes;
+    } else if (st.st_size > 0) {
+        cp->discarded = 1;
+    }
+
+    size_t run_bytes = wheel_bytes(hi);
+    size_t bitmap_bytes = run_bytes > sieved ? run_bytes : sieved;
+
+    cp->map_size = sizeof(checkpoint_header_t) + bitmap_bytes;
+    if ((size_t)st.st_size < cp->map_size && ftruncate(cp->fd, cp->map_size) == -1) {
+        close(cp->fd);
+        return -1;
+    }
+
+    cp->map = mmap(NULL, cp->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cp->fd, 0);
+    if (cp->map == MAP_FAILED) {
+        close(cp->fd);
+        return -1;
+    }
+    cp->header = cp->map;
+    cp->bitmap = (unsigned char*)cp->map + sizeof(checkpoint_header_t);
+
+    cp->hash = fnv1a(FNV_OFFSET_BASIS, cp->bitmap, sieved);
+    if (sieved > 0 && cp->hash != header.checksum) {
+        cp->discarded = 1;
+        sieved = 0;
+        cp->hash = FNV_OFFSET_BASIS;
+    }
+
+    // A new or discarded checkpoint gets a header for nothing, and keeps it until there's something to commit
+    if (sieved == 0) {
+        memset(cp->header, 0, sizeof(checkpoint_header_t));
+        memcpy(cp->header->magic, CHECKPOINT_MAGIC, sizeof(cp->header->magic));
+        cp->header->version = CHECKPOINT_VERSION;
+        cp->header->bitmap_offset = sizeof(checkpoint_header_t);
+        cp->header->checksum = FNV_OFFSET_BASIS;
+        if (sync_range(cp, 0, sizeof(checkpoint_header_t)) == -1) {
+            munmap(cp->map, cp->map_size);
+            close(cp->fd);
+            return -1;
+        }
+    }
+
+    // Only whole bytes below hi are final: the last byte can hold numbers whose smallest factor wasn't sieved with
+    cp->target_bytes = hi / WHEEL_MODULUS > sieved ? hi / WHEEL_MODULUS : sieved;
+    cp->cached_bytes = sieved;
+    cp->hashed_bytes = sieved;
+    pthread_mutex_init(&cp->lock, NULL);
+    return 0;
+}
+
+int checkpoint_track(checkpoint_t* cp, size_t chunk_size, size_t num_chunks) {
+    cp->done = calloc(num_chunks ? num_chunks : 1, 1);
+    if (!cp->done) {
+        return -1;
+    }
+
+    cp->chunk_size = chunk_size;
+    cp->num_chunks = num_chunks;
+    cp->next_chunk = 0;
+    return 0;
+}
+
+// How many bytes from the start are done and can be committed
+static size_t done_bytes(checkpoint_t const* cp) {
+    size_t bytes = cp->next_chunk * cp->chunk_size;
+    if (cp->next_chunk == cp->num_chunks || bytes > cp->target_bytes) {
+        bytes = cp->target_bytes;
+    }
+    return bytes;
+}
+
+int checkpoint_chunk_done(checkpoint_t* cp, size_t chunk) {
+    int ret = 0;
+
+    pthread_mutex_lock(&cp->lock);
+    cp->done[chunk] = 1;
+    while (cp->next_chunk < cp->num_chunks && cp->done[cp->next_chunk]) {
+        ++cp->next_chunk;
+    }
+
+    size_t bytes = done_bytes(cp);
+    if (bytes >= cp->header->sieved_bytes + CHECKPOINT_COMMIT_BYTES) {
+        ret = commit(cp, bytes);
+    }
+    pthread_mutex_unlock(&cp->lock);
+
+    return ret;
+}
+
+int checkpoint_close(checkpoint_t* cp) {
+    int ret = cp->done ? commit(cp, done_bytes(cp)) : 0;
+
+    pthread_mutex_destroy(&cp->lock);
+    free(cp->done);
+    munmap(cp->map, cp->map_size);
+    if (close(cp->fd) == -1) {
+        ret = -1;
+    }
+    return ret;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define CHECKPOINT_MAGIC "SIEVECKP"
+#define CHECKPOINT_VERSION 1
+
+// How much newly sieved bitmap builds up before it's committed, so an interrupted run loses at most this much
+#define CHECKPOINT_COMMIT_BYTES ((size_t)64 << 20)
+
+/*
+ * Checkpoint cache.
+ *
+ * A checkpoint is a header, then the packed composites array (see common.h) from 0 up to however far it's been
+ * sieved. Only the first sieved_bytes bytes are trusted, and only if they match the checksum: a 64-bit FNV-1a of
+ * those bytes. A run with a cache copies the chunks that the checkpoint already covers instead of sieving them,
+ * sieves the rest into the checkpoint as well as its output, and commits the sieved prefix as it grows: the bitmap
+ * is synced first and the header second, so a run that's interrupted leaves a checkpoint that's still valid, just
+ * shorter. All fields are native-endian.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t bitmap_offset;
+    uint64_t sieved_bytes;
+    uint64_t checksum;
+} checkpoint_header_t;
+
+/**
+ * A checkpoint mapped into memory for a run.
+ */
+typedef struct {
+    int fd;
+    void* map;
+    size_t map_size;
+
+    checkpoint_header_t* header;
+    unsigned char* bitmap; // At least as long as the run's packed composites array
+
+    size_t cached_bytes; // What the checkpoint held when it was opened, and can be copied rather than sieved
+    size_t target_bytes; // What it will hold once every chunk of the run is done
+    int discarded; // Set if the file was there but wasn't a valid checkpoint
+
+    // Tracks which chunks are done, so the sieved prefix can be committed as it grows
+    pthread_mutex_t lock;
+    size_t chunk_size;
+    size_t num_chunks;
+    unsigned char* done;
+    size_t next_chunk; // The first chunk that isn't done
+    size_t hashed_bytes;
+    uint64_t hash;
+} checkpoint_t;
+
+/**
+ * Opens a checkpoint for a run over [0, hi), creating it if it doesn't exist. A file that isn't a valid checkpoint,
+ * or whose checksum doesn't match, is started again from nothing.
+ *
+ * @param cp   The checkpoint.
+ * @param path The file.
+ * @param hi   The number below which the run will find all primes.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int checkpoint_open(checkpoint_t* cp, char const* path, size_t hi);
+
+/**
+ * Sets how the run is split into chunks, so that finished chunks can be committed.
+ *
+ * @param cp         The checkpoint.
+ * @param chunk_size The size of each chunk in bytes.
+ * @param num_chunks The number of chunks.
+ * @return 0 on success, or -1 if allocation failed.
+ */
+int checkpoint_track(checkpoint_t* cp, size_t chunk_size, size_t num_chunks);
+
+/**
+ * Checks whether a chunk is already in the checkpoint, so it can be copied rather than sieved.
+ *
+ * @param cp        The checkpoint.
+ * @param chunk_end The index of the byte after the chunk's last byte.
+ * @return 1 if it is, 0 if it isn't.
+ */
+static inline int checkpoint_has(checkpoint_t const* cp, size_t chunk_end) {
+    return chunk_end <= cp->cached_bytes;
+}
+
+/**
+ * Marks a chunk as done, once its bytes are in cp->bitmap, and commits the sieved prefix if it's grown by at least
+ * CHECKPOINT_COMMIT_BYTES. Safe to call from any job.
+ *
+ * @param cp    The checkpoint.
+ * @param chunk The chunk.
+ * @return 0 on success, or -1 if committing failed (with errno set).
+ */
+int checkpoint_chunk_done(checkpoint_t* cp, size_t chunk);
+
+/**
+ * Commits everything that's done and unmaps the checkpoint.
+ *
+ * @param cp The checkpoint.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int checkpoint_close(checkpoint_t* cp);
@@ -1,48 +1,311 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "common.h"
+#include "output.h"
+#include "presieve.h"
+#include "wheel_kernels.h"
 
-size_t strike_multiples(char* composites, size_t len, size_t start, size_t unmarked) {
-    size_t min_unmarked = (size_t)-1;
-    size_t mult_start = unmarked + 1; // The first number that's a candidate for crossing out
+const unsigned char wheel_residues[WHEEL_SPOKES] = {1, 7, 11, 13, 17, 19, 23, 29};
 
-    // Any numbers that can be evenly divided by the current unmarked number are not prime
-    for (size_t i = mult_start > start ? mult_start - start : 0; i < len; ++i) {
-        size_t num = i + start;
-        if (num % unmarked == 0) {
-            composites[i] = 1;
-        } else if (min_unmarked == (size_t)-1) {
-            min_unmarked = num;
+const unsigned char wheel_residue_ceil[WHEEL_MODULUS] = {
+    0, 0, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 4, 4, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7
+};
+
+void sieving_prime_init(sieving_prime_t* sp, size_t prime, size_t start_byte) {
+    sp->prime = prime;
+
+    // The smallest multiplier worth striking: prime itself, or whatever reaches start_byte. Rounded up without
+    // adding first, since start_byte can be close to the top of the 64-bit range.
+    size_t start = start_byte * WHEEL_MODULUS;
+    size_t first_mult = start / prime + (start % prime != 0);
+    if (first_mult < prime) {
+        first_mult = prime;
+    }
+
+    for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+        // The first multiplier >= first_mult that has residue wheel_residues[j]
+        size_t mult = first_mult + (wheel_residues[j] + WHEEL_MODULUS - first_mult % WHEEL_MODULUS) % WHEEL_MODULUS;
+
+        // A multiple past 2^64 is past any range too
+        if (mult > (size_t)-1 / prime) {
+            sp->next[j] = (size_t)-1;
+            sp->masks[j] = 0;
+            continue;
+        }
+
+        size_t num = prime * mult;
+        sp->next[j] = num / WHEEL_MODULUS;
+        sp->masks[j] = 1 << wheel_residue_ceil[num % WHEEL_MODULUS];
+    }
+}
+
+// Strikes each residue's multiples on its own, for when there isn't a whole cycle of them to hand to a kernel
+static void strike_segment_streams(unsigned char* segment, size_t len, size_t start_byte, sieving_prime_t* sp) {
+    size_t end_byte = start_byte + len;
+
+    for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+        size_t byte = sp->next[j];
+        unsigned char mask = sp->masks[j];
+
+        for (; byte < end_byte; byte += sp->prime) {
+            segment[byte - start_byte] |= mask;
+        }
+        sp->next[j] = byte;
+    }
+}
+
+void strike_segment_wheel(unsigned char* segment, size_t len, size_t start_byte, sieving_prime_t* sp) {
+    size_t prime = sp->prime;
+    size_t q = prime / WHEEL_MODULUS;
+    size_t cls = wheel_residue_ceil[prime % WHEEL_MODULUS];
+
+    // Each residue's next multiple is in either the same cycle of prime bytes as the slowest one, or the cycle after
+    size_t offsets[WHEEL_SPOKES];
+    size_t base = (size_t)-1;
+    for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+        // A residue with no multiples left can't be kept in step with the others
+        if (sp->masks[j] == 0 || prime < WHEEL_MODULUS) {
+            strike_segment_streams(segment, len, start_byte, sp);
+            return;
+        }
+
+        offsets[j] = q * wheel_residues[j] + wheel_kernel_carries[cls][j];
+        base = sp->next[j] - offsets[j] < base ? sp->next[j] - offsets[j] : base;
+    }
+
+    // Not worth it unless at least one whole cycle fits once the slowest residues have caught up
+    if (base + prime + offsets[WHEEL_SPOKES - 1] >= start_byte + len) {
+        strike_segment_streams(segment, len, start_byte, sp);
+        return;
+    }
+
+    // Catch the slowest residues up, then strike whole cycles, then whatever's left of the last one. Indices are
+    // relative to the segment from here on, and base can wrap below it.
+    for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+        if (sp->next[j] - offsets[j] == base) {
+            segment[sp->next[j] - start_byte] |= sp->masks[j];
+        }
+    }
+
+    base = wheel_kernels[cls](segment, base + prime - start_byte, len, prime);
+
+    for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+        size_t byte = base + offsets[j];
+        if (byte < len) {
+            segment[byte] |= sp->masks[j];
+            byte += prime;
+        }
+        sp->next[j] = byte + start_byte;
+    }
+}
+
+void sieve_segment_wheel(unsigned char* segment, size_t len, size_t start_byte, sieving_prime_t* sieving, size_t num_primes) {
+    size_t end_num = (start_byte + len) * WHEEL_MODULUS;
+
+    presieve_fill(segment, len, start_byte);
+
+    // Apply every other sieving prime to the segment while it's in cache. Primes are sorted, so once one starts past
+    // the end of the segment, so do the rest.
+    size_t i = 0;
+    while (i < num_primes && sieving[i].prime < PRESIEVE_NEXT_PRIME) {
+        ++i;
+    }
+    for (; i < num_primes && sieving[i].prime * sieving[i].prime < end_num; ++i) {
+        strike_segment_wheel(segment, len, start_byte, &sieving[i]);
+    }
+}
+
+void strike_multiples_wheel(unsigned char* composites, size_t len, size_t start_byte, size_t prime) {
+    sieving_prime_t sp;
+    sieving_prime_init(&sp, prime, start_byte);
+    strike_segment_wheel(composites, len, start_byte, &sp);
+}
+
+size_t next_unmarked_wheel(unsigned char const* composites, size_t len, size_t start_byte, size_t after) {
+    size_t first_bit = start_byte * WHEEL_SPOKES;
+    size_t bit = after + 1 > start_byte * WHEEL_MODULUS ? wheel_index(after + 1) - first_bit : 0;
+
+    for (size_t i = bit / WHEEL_SPOKES; i < len; ++i) {
+        // Only look at the bits at or after the starting bit in the first byte
+        unsigned char unmarked = ~composites[i];
+        if (i == bit / WHEEL_SPOKES) {
+            unmarked &= 0xff << (bit % WHEEL_SPOKES);
+        }
+
+        if (unmarked) {
+            return wheel_value(first_bit + i * WHEEL_SPOKES + __builtin_ctz(unmarked));
+        }
+    }
+
+    return (size_t)-1;
+}
+
+size_t count_unmarked(unsigned char const* composites, size_t len) {
+    size_t count = 0;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, composites + i, sizeof(word));
+        count += __builtin_popcountll(~word);
+    }
+    for (; i < len; ++i) {
+        count += __builtin_popcount((unsigned char)~composites[i]);
+    }
+
+    return count;
+}
+
+size_t count_primes_wheel(unsigned char const* composites, size_t len, size_t start_byte, size_t lo, size_t hi) {
+    size_t count = 0;
+
+    if (start_byte == 0) {
+        for (size_t p = 2; p <= 5; p += p == 2 ? 1 : 2) {
+            count += p >= lo && p < hi;
         }
     }
 
-    return min_unmarked;
+    size_t i = 0;
+    while (i < len) {
+        size_t base = (start_byte + i) * WHEEL_MODULUS;
+
+        // A run of bytes that are all in the range
+        if (base >= lo && base + WHEEL_MODULUS <= hi) {
+            size_t run_end = hi / WHEEL_MODULUS - start_byte < len ? hi / WHEEL_MODULUS - start_byte : len;
+            count += count_unmarked(composites + i, run_end - i);
+            i = run_end;
+            continue;
+        }
+
+        unsigned char unmarked = ~composites[i];
+        while (unmarked) {
+            size_t num = base + wheel_residues[__builtin_ctz(unmarked)];
+            count += num >= lo && num < hi;
+            unmarked &= unmarked - 1;
+        }
+        ++i;
+    }
+
+    return count;
+}
+
+#define FNV_PRIME 1099511628211ULL
+
+uint64_t fnv1a(uint64_t hash, unsigned char const* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
 }
 
 void serial_sieve(size_t limit) {
-    char* composites = calloc(1, limit - 1);
-    size_t root = (size_t)sqrt(limit);
+    size_t len = wheel_bytes(limit);
+    unsigned char* composites = malloc(len);
+    size_t root = isqrt(limit);
+
+    presieve_fill(composites, len, 0);
 
     /* Find the primes below the limit */
-    for (size_t i = 2; i <= root;) {
-        i = strike_multiples(composites + 2, limit - 3, 3, i);
+    for (size_t i = PRESIEVE_NEXT_PRIME; i <= root; i = next_unmarked_wheel(composites, len, 0, i)) {
+        strike_multiples_wheel(composites, len, 0, i);
     }
 
-    for (size_t i = 0; i < limit - 1; ++i) {
-        if(!composites[i]) {
-            printf("%lu\n", i + 1);
-        }
+    fflush(stdout);
+    if (write_primes_wheel(STDOUT_FILENO, -1, composites, len, 0, limit) == -1) {
+        perror("Error writing primes");
+        exit(EXIT_FAILURE);
     }
 
     free(composites);
 }
 
-void get_slices(size_t num_jobs, size_t limit, size_t* slice_size, size_t* extra) {
-    size_t end = limit - 1;
+size_t* sieving_primes(size_t limit, size_t* count) {
+    // The largest root with root * root < limit
+    size_t root = limit > 0 ? isqrt(limit - 1) : 0;
+
+    // Sieve up to and including the root
+    size_t len = wheel_bytes(root + 1);
+    unsigned char* composites = malloc(len);
+    if (!composites) {
+        return NULL;
+    }
+    presieve_fill(composites, len, 0);
+
+    for (size_t i = PRESIEVE_NEXT_PRIME; i != (size_t)-1 && i * i <= root; i = next_unmarked_wheel(composites, len, 0, i)) {
+        strike_multiples_wheel(composites, len, 0, i);
+    }
 
-    size_t range = end - 2;
+    // Count them first; a high limit has hundreds of millions of sieving primes, so the array should be exact
+    size_t num_primes = 0;
+    for (size_t i = 7; i <= root; i = next_unmarked_wheel(composites, len, 0, i)) {
+        ++num_primes;
+    }
+
+    size_t* primes = malloc(sizeof(size_t) * (num_primes + 1));
+    if (!primes) {
+        free(composites);
+        return NULL;
+    }
+
+    num_primes = 0;
+    for (size_t i = 7; i <= root; i = next_unmarked_wheel(composites, len, 0, i)) {
+        primes[num_primes++] = i;
+    }
+
+    free(composites);
+    *count = num_primes;
+    return primes;
+}
+
+void get_slices(size_t num_jobs, size_t limit, size_t* slice_size, size_t* extra) {
+    size_t range = wheel_bytes(limit);
     *slice_size = range / num_jobs;
     *extra = range % num_jobs;
-}
\ No newline at end of file
+}
+
+int sieve_range_init(sieve_range_t* range, size_t lo, size_t hi, size_t max_small) {
+    if (lo >= hi || hi > SIEVE_RANGE_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    range->lo = lo;
+    range->hi = hi;
+    range->start_byte = lo / WHEEL_MODULUS;
+    range->end_byte = wheel_bytes(hi);
+
+    range->primes = sieving_primes(hi, &range->num_primes);
+    if (!range->primes) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    range->num_small = 0;
+    while (range->num_small < range->num_primes && range->primes[range->num_small] <= max_small) {
+        ++range->num_small;
+    }
+
+    return 0;
+}
+
+void sieve_range_free(sieve_range_t* range) {
+    free(range->primes);
+    range->primes = NULL;
+}
+
+void sieve_range_seek(sieve_range_t const* range, sieving_prime_t* sieving, size_t start_byte) {
+    for (size_t i = 0; i < range->num_small; ++i) {
+        sieving_prime_init(&sieving[i], range->primes[i], start_byte);
+    }
+}
+
+void sieve_range_segment(sieve_range_t const* range, sieving_prime_t* sieving, unsigned char* segment,
+                         size_t seg_start, size_t seg_len) {
+    sieve_segment_wheel(segment, seg_len, seg_start, sieving, range->num_small);
+}
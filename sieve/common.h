@@ -1,15 +1,179 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+/*
+ * Packed composite storage.
+ *
+ * Only the numbers coprime to 30 can be prime (other than 2, 3 and 5), and there are 8 of them in every block of
+ * 30 numbers. Each byte of a packed composites array holds one block: bit j of byte b is set if 30 * b +
+ * wheel_residues[j] is composite. Bit indices count bits from the start of the array, so bit index i is bit i % 8
+ * of byte i / 8.
+ */
+#define WHEEL_MODULUS 30
+#define WHEEL_SPOKES 8
+
+// The numbers in [0, 30) that are coprime to 30, in bit order
+extern const unsigned char wheel_residues[WHEEL_SPOKES];
+
+// For each n in [0, 30), the index of the first residue >= n (WHEEL_SPOKES if there isn't one)
+extern const unsigned char wheel_residue_ceil[WHEEL_MODULUS];
+
+/**
+ * Gets the bit index of n in a packed composites array starting at 0. If n isn't coprime to 30, the index of the
+ * next number that is gets returned instead.
+ *
+ * @param n The number.
+ * @return The bit index of n, or of the first candidate after n.
+ */
+static inline size_t wheel_index(size_t n) {
+    return (n / WHEEL_MODULUS) * WHEEL_SPOKES + wheel_residue_ceil[n % WHEEL_MODULUS];
+}
+
+/**
+ * Gets the number stored at a bit index in a packed composites array starting at 0.
+ *
+ * @param i The bit index.
+ * @return The number stored at bit i.
+ */
+static inline size_t wheel_value(size_t i) {
+    return (i / WHEEL_SPOKES) * WHEEL_MODULUS + wheel_residues[i % WHEEL_SPOKES];
+}
+
+/**
+ * Gets the number of bytes needed to hold every candidate below limit in a packed composites array.
+ *
+ * @param limit The number below which all primes will be calculated.
+ * @return The number of bytes.
+ */
+static inline size_t wheel_bytes(size_t limit) {
+    return (limit + WHEEL_MODULUS - 1) / WHEEL_MODULUS;
+}
+
+/**
+ * Gets the integer square root of n, exactly, for any 64-bit n.
+ *
+ * @param n The number.
+ * @return The largest r with r * r <= n.
+ */
+static inline size_t isqrt(size_t n) {
+    size_t r = (size_t)sqrtl((long double)n);
+
+    // sqrtl() can be off by one either way for large n; fix it up without overflowing
+    while (r > 0 && r > n / r) {
+        --r;
+    }
+    while (r + 1 <= n / (r + 1)) {
+        ++r;
+    }
+    return r;
+}
+
+/**
+ * A sieving prime and the next multiple of it to strike in a packed composites array, for each residue of the
+ * multiplier. Striking a segment advances the multiples past it, so consecutive segments can be sieved without
+ * recomputing where each prime's multiples start.
+ */
+typedef struct {
+    size_t prime;
+    size_t next[WHEEL_SPOKES]; // Index of the byte holding the next multiple with multiplier residue wheel_residues[j]
+    unsigned char masks[WHEEL_SPOKES]; // The bit that those multiples land on
+} sieving_prime_t;
+
+/**
+ * Initialises a sieving prime so that its next multiples are the first ones >= max(prime * prime, 30 * start_byte).
+ *
+ * @param sp         The sieving prime to initialise.
+ * @param prime      The prime. Must be > 5.
+ * @param start_byte The index of the byte that striking will start from.
+ */
+void sieving_prime_init(sieving_prime_t* sp, size_t prime, size_t start_byte);
+
+/**
+ * Strikes out the multiples of a sieving prime that fall in a segment of a packed composites array, and advances
+ * the sieving prime's next multiples past the end of the segment.
+ *
+ * @param segment    The segment of the packed composites array.
+ * @param len        The length of the segment in bytes.
+ * @param start_byte The index of the segment's first byte.
+ * @param sp         The sieving prime. Its next multiples must all be >= start_byte.
+ */
+void strike_segment_wheel(unsigned char* segment, size_t len, size_t start_byte, sieving_prime_t* sp);
+
+/**
+ * Sieves one segment of a packed composites array from scratch: pre-sieves it (see presieve.h), then strikes the
+ * multiples of every other sieving prime that falls in it, advancing each sieving prime past the end of the segment.
+ * Sieving primes below PRESIEVE_NEXT_PRIME are skipped and left where they are.
+ *
+ * @param segment    The segment of the packed composites array.
+ * @param len        The length of the segment in bytes.
+ * @param start_byte The index of the segment's first byte.
+ * @param sieving    The sieving primes, sorted in increasing order. Their next multiples must all be >= start_byte.
+ * @param num_primes The number of sieving primes.
+ */
+void sieve_segment_wheel(unsigned char* segment, size_t len, size_t start_byte, sieving_prime_t* sieving, size_t num_primes);
+
+/**
+ * Strikes out the multiples of prime in a packed composites array.
+ *
+ * Only multiples that are coprime to 30 are stored, so for each of the 8 residues r of the multiplier, the
+ * multiples prime * (30k + r) all land on the same bit and are exactly prime bytes apart. Striking starts at the
+ * first multiple >= max(prime * prime, 30 * start_byte).
+ *
+ * @param composites The packed composites array.
+ * @param len        The length of the composites array in bytes.
+ * @param start_byte The index of the array's first byte, i.e. the array starts at the number 30 * start_byte.
+ * @param prime      The prime whose multiples will be struck. Must be > 5.
+ */
+void strike_multiples_wheel(unsigned char* composites, size_t len, size_t start_byte, size_t prime);
 
 /**
- * Strikes out all multiples of unmarked in the composites array.
+ * Finds the first unmarked number greater than after in a packed composites array.
  *
- * @param composites The list of bools indicating whether each number is composite or prime.
- * @param len        The length of the composites list.
- * @param start      The starting number for the composites list.
- * @param unmarked   The unmarked number whose multiples will be struck.
+ * @param composites The packed composites array.
+ * @param len        The length of the composites array in bytes.
+ * @param start_byte The index of the array's first byte.
+ * @param after      The number after which to start searching.
+ * @return The first unmarked number > after, or (size_t)-1 if there is none.
  */
-size_t strike_multiples(char* composites, size_t len, size_t start, size_t unmarked);
+size_t next_unmarked_wheel(unsigned char const* composites, size_t len, size_t start_byte, size_t after);
+
+/**
+ * Counts the unmarked bits in a packed composites array, a word at a time.
+ *
+ * @param composites The packed composites array.
+ * @param len        The length of the composites array in bytes.
+ * @return The number of unmarked bits.
+ */
+size_t count_unmarked(unsigned char const* composites, size_t len);
+
+/**
+ * Counts the primes in [lo, hi) in a packed composites array, including 2, 3 and 5 if the array starts at 0. Bytes
+ * that lie wholly inside the range are popcounted; only the ones at either end are looked at a bit at a time.
+ *
+ * @param composites The packed composites array.
+ * @param len        The length of the composites array in bytes.
+ * @param start_byte The index of the array's first byte.
+ * @param lo         The smallest number that will be counted.
+ * @param hi         The number below which all primes will be counted.
+ * @return The number of primes.
+ */
+size_t count_primes_wheel(unsigned char const* composites, size_t len, size_t start_byte, size_t lo, size_t hi);
+
+// The hash of no bytes, to start an fnv1a() hash from
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+/**
+ * Adds bytes to a 64-bit FNV-1a hash, which checkpoints and shards use to check their data.
+ *
+ * @param hash The hash so far, or FNV_OFFSET_BASIS to start one.
+ * @param data The bytes.
+ * @param len  The number of bytes.
+ * @return The hash with the bytes added.
+ */
+uint64_t fnv1a(uint64_t hash, unsigned char const* data, size_t len);
 
 /**
  * Runs the sieve of Eratosthenes entirely on the current thread and prints the results to stdout (for now).
@@ -18,10 +182,87 @@ size_t strike_multiples(char* composites, size_t len, size_t start, size_t unmar
 void serial_sieve(size_t limit);
 
 /**
- * Gets the size of number ranges assigned to each job and the extra numbers for the last job (if any).
- * @param num_jobs    The number of jobs that the range is to be divided between. Must be > limit - 2.
+ * Finds the sieving primes for a limit: every prime p > 5 with p * p < limit.
+ *
+ * @param limit The number below which all primes will be calculated.
+ * @param count Set to the number of sieving primes found.
+ * @return A malloc'd array of the sieving primes in increasing order, or NULL if allocation failed.
+ */
+size_t* sieving_primes(size_t limit, size_t* count);
+
+/**
+ * Gets the number of packed composites bytes assigned to each job and the extra bytes for the last job (if any).
+ *
+ * Slices are measured in whole bytes of the packed composites array, so every slice starts on a multiple of 30 and
+ * no two jobs ever share a byte.
+ *
+ * @param num_jobs    The number of jobs that the range is to be divided between. Must be <= wheel_bytes(limit).
  * @param limit       The number below which all primes will be calculated.
- * @param slice_size  The number of numbers that each job will process.
- * @param extra       The extra numbers processed by the last job (may be zero).
+ * @param slice_size  The number of bytes that each job will process.
+ * @param extra       The extra bytes processed by the last job (may be zero).
+ */
+void get_slices(size_t num_jobs, size_t limit, size_t* slice_size, size_t* extra);
+
+// The largest hi a range can have, so that every byte of the packed composites array up to hi can be addressed
+#define SIEVE_RANGE_MAX ((size_t)-1 - WHEEL_MODULUS)
+
+/**
+ * A range [lo, hi) of numbers to sieve, and the sieving primes it needs.
+ *
+ * Only the sieving primes are held in memory, so a range takes O(sqrt(hi)) memory however wide it is. The numbers
+ * themselves are sieved a segment at a time into buffers owned by the caller.
+ *
+ * The sieving primes are split into small ones, which are struck directly from a sieving_prime_t each, and large
+ * ones, which are left to a bucket sieve (see bucket.h) since they miss most segments.
+ */
+typedef struct {
+    size_t lo;
+    size_t hi;
+    size_t start_byte; // The byte of the packed composites array that holds lo
+    size_t end_byte; // One past the byte that holds hi - 1
+    size_t* primes; // Every prime p > 5 with p * p < hi
+    size_t num_primes;
+    size_t num_small; // The number of primes that are small; the rest come after them
+} sieve_range_t;
+
+/**
+ * Sets up a range and finds its sieving primes.
+ *
+ * @param range     The range.
+ * @param lo        The first number in the range.
+ * @param hi        The number below which all primes will be calculated. Must be > lo and <= SIEVE_RANGE_MAX.
+ * @param max_small The largest prime that counts as small. Pass (size_t)-1 to strike every prime directly.
+ * @return 0 on success, or -1 on error (with errno set: EINVAL for a bad range, ENOMEM if allocation failed).
+ */
+int sieve_range_init(sieve_range_t* range, size_t lo, size_t hi, size_t max_small);
+
+/**
+ * Frees a range's sieving primes.
+ *
+ * @param range The range.
+ */
+void sieve_range_free(sieve_range_t* range);
+
+/**
+ * Initialises the small sieving primes so that a range can be sieved from a given byte onwards.
+ *
+ * @param range      The range.
+ * @param sieving    The sieving primes to initialise, with room for range->num_small.
+ * @param start_byte The byte of the packed composites array where sieving will start.
+ */
+void sieve_range_seek(sieve_range_t const* range, sieving_prime_t* sieving, size_t start_byte);
+
+/**
+ * Sieves the next segment of a range with its small primes. Segments must be sieved in order from where the sieving
+ * primes were last initialised with sieve_range_seek().
+ *
+ * Bits for numbers outside [lo, hi) are left as they are; pass the range's bounds on when reading the segment.
+ *
+ * @param range     The range.
+ * @param sieving   The sieving primes.
+ * @param segment   The segment to sieve into.
+ * @param seg_start The index of the segment's first byte in the packed composites array.
+ * @param seg_len   The length of the segment in bytes.
  */
-void get_slices(size_t num_jobs, size_t limit, size_t* slice_size, size_t* extra);
\ No newline at end of file
+void sieve_range_segment(sieve_range_t const* range, sieving_prime_t* sieving, unsigned char* segment,
+                         size_t seg_start, size_t seg_len);
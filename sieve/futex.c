@@ -0,0 +1,37 @@
+#include <unistd.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "futex.h"
+
+void futex_wait(atomic_uint* addr, unsigned expected) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, expected, NULL, NULL, 0);
+}
+
+void futex_wake(atomic_uint* addr, int count) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+void futex_barrier_init(futex_barrier_t* barrier, unsigned parties) {
+    atomic_store(&barrier->arrived, 0);
+    atomic_store(&barrier->generation, 0);
+    barrier->parties = parties;
+}
+
+void futex_barrier_wait(futex_barrier_t* barrier) {
+    unsigned generation = atomic_load(&barrier->generation);
+
+    if (atomic_fetch_add(&barrier->arrived, 1) + 1 == barrier->parties) {
+        // Last one in: reset the count before opening the barrier so that nobody can arrive early for the next
+        // generation and be counted in this one
+        atomic_store(&barrier->arrived, 0);
+        atomic_fetch_add(&barrier->generation, 1);
+        futex_wake(&barrier->generation, INT_MAX);
+        return;
+    }
+
+    while (atomic_load(&barrier->generation) == generation) {
+        futex_wait(&barrier->generation, generation);
+    }
+}
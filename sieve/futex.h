@@ -0,0 +1,45 @@
+#pragma once
+#include <stdatomic.h>
+
+/**
+ * Sleeps until the futex word at addr is woken, as long as it still holds expected. Returns straight away if it
+ * doesn't, or if the sleep is interrupted, so callers should re-check their condition in a loop.
+ *
+ * The futex isn't process-private, so addr can be in memory shared between processes.
+ *
+ * @param addr     The futex word.
+ * @param expected The value the futex word is expected to hold.
+ */
+void futex_wait(atomic_uint* addr, unsigned expected);
+
+/**
+ * Wakes up to count threads or processes sleeping on the futex word at addr.
+ *
+ * @param addr  The futex word.
+ * @param count The maximum number of waiters to wake.
+ */
+void futex_wake(atomic_uint* addr, int count);
+
+/**
+ * A reusable barrier whose waiters sleep on a futex rather than spinning.
+ */
+typedef struct {
+    atomic_uint arrived; // Parties that have reached the barrier in the current generation
+    atomic_uint generation; // Bumped every time the barrier opens; this is the futex word
+    unsigned parties;
+} futex_barrier_t;
+
+/**
+ * Initialises a barrier.
+ *
+ * @param barrier The barrier.
+ * @param parties The number of threads or processes that must reach the barrier before it opens.
+ */
+void futex_barrier_init(futex_barrier_t* barrier, unsigned parties);
+
+/**
+ * Waits until every party has reached the barrier. The barrier resets itself once it opens.
+ *
+ * @param barrier The barrier.
+ */
+void futex_barrier_wait(futex_barrier_t* barrier);
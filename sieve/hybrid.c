@@ -0,0 +1,316 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "hybrid.h"
+#include "arena.h"
+#include "common.h"
+#include "output.h"
+#include "prime_table.h"
+#include "scheduler.h"
+#include "topology.h"
+#include "../perf.h"
+#include "../timing.h"
+#include "../trace.h"
+
+// One process's share of the work, set up by the parent before forking
+typedef struct {
+    numa_node_t const* node;
+    size_t first_cpu; // Index into the node's CPUs of the first one this process's threads are pinned to
+    size_t first_job; // Global ID of this process's first thread
+    size_t num_threads;
+    size_t start_byte; // This process's part of the packed composites array
+    size_t len;
+} node_share_t;
+
+// Shared by the threads of one process
+typedef struct {
+    size_t const* primes;
+    size_t num_primes;
+    unsigned char* composites;
+    size_t start_byte;
+    size_t len;
+    size_t segment_size;
+    segment_scheduler_t sched;
+} node_work_t;
+
+typedef struct {
+    size_t job_id;
+    size_t worker; // Index within the process
+    int cpu;
+    node_work_t* work;
+} worker_params_t;
+
+// Sent once by each process when all of its threads have finished
+typedef struct {
+    size_t process;
+    int node;
+    size_t num_threads;
+    double ms_working;
+} node_done_msg;
+
+static void* do_sieve(void* worker_params) {
+    worker_params_t* params = (worker_params_t*)worker_params;
+    node_work_t* work = params->work;
+
+    if (topology_pin_cpu(params->cpu) == -1) {
+        perror("Error pinning thread");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start, end;
+
+    perf_job_t perf;
+    perf_job_open(&perf, params->job_id);
+
+    sieving_prime_t* sieving = malloc(sizeof(sieving_prime_t) * (work->num_primes ? work->num_primes : 1));
+    if (!sieving) {
+        perror("Error while allocating sieving primes");
+        exit(EXIT_FAILURE);
+    }
+
+    TRACE_BEGIN(params->job_id, TRACE_STRIKE, 0);
+    PTIME
+    (
+        "working",
+        // A worker's segments are contiguous unless it stole them, so the sieving primes only need moving then
+        size_t segment;
+        size_t next_byte = (size_t)-1;
+        while (scheduler_next(&work->sched, params->worker, &segment)) {
+            size_t seg_start = work->start_byte + segment * work->segment_size;
+            size_t seg_end = work->start_byte + work->len;
+            size_t seg_len = seg_end - seg_start < work->segment_size ? seg_end - seg_start : work->segment_size;
+
+            if (seg_start != next_byte) {
+                for (size_t i = 0; i < work->num_primes; ++i) {
+                    sieving_prime_init(&sieving[i], work->primes[i], seg_start);
+                }
+            }
+
+            sieve_segment_wheel(work->composites + seg_start, seg_len, seg_start, sieving, work->num_primes);
+            next_byte = seg_start + seg_len;
+        }
+    )
+    TRACE_END(params->job_id, TRACE_STRIKE, 0);
+
+    perf_job_close(&perf);
+    free(sieving);
+    return NULL;
+}
+
+static void sieve_node(size_t process, node_share_t const* share, size_t const* primes, size_t num_primes,
+                       unsigned char* composites, size_t segment_size, int done_pipe) {
+    struct timespec start, end;
+
+    // Keep the process on its node from here on, so that everything it allocates is local
+    if (topology_pin_node(share->node) == -1) {
+        perror("Error pinning process");
+        exit(EXIT_FAILURE);
+    }
+
+    // Only a hint: without NUMA support this fails, and first touch from the pinned threads does the same job
+    if (share->len > 0) {
+        topology_bind_memory(composites + share->start_byte, share->len, share->node->id);
+    }
+
+    // Every thread reads every sieving prime for every segment, so take a local copy
+    node_work_t work;
+    size_t* local_primes = malloc(sizeof(size_t) * (num_primes ? num_primes : 1));
+    worker_params_t* params = malloc(sizeof(worker_params_t) * share->num_threads);
+    pthread_t* threads = malloc(sizeof(pthread_t) * share->num_threads);
+    if (!local_primes || !params || !threads ||
+        scheduler_init(&work.sched, (share->len + segment_size - 1) / segment_size, share->num_threads) == -1) {
+        perror("Error while setting up jobs");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(local_primes, primes, sizeof(size_t) * num_primes);
+
+    work.primes = local_primes;
+    work.num_primes = num_primes;
+    work.composites = composites;
+    work.start_byte = share->start_byte;
+    work.len = share->len;
+    work.segment_size = segment_size;
+
+    CTIME
+    (
+        for (size_t i = 0; i < share->num_threads; ++i) {
+            params[i].job_id = share->first_job + i;
+            params[i].worker = i;
+            params[i].cpu = share->node->cpus[(share->first_cpu + i) % share->node->num_cpus];
+            params[i].work = &work;
+
+            pthread_create(&threads[i], NULL, do_sieve, &params[i]);
+        }
+
+        for (size_t i = 0; i < share->num_threads; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+    )
+
+    node_done_msg msg;
+    msg.process = process;
+    msg.node = share->node->id;
+    msg.num_threads = share->num_threads;
+    msg.ms_working = get_delay(start, end);
+
+    // Messages this small are written atomically, so the processes can share the pipe
+    if (write(done_pipe, &msg, sizeof(msg)) != sizeof(msg)) {
+        perror("Error sending completion message");
+        exit(EXIT_FAILURE);
+    }
+
+    scheduler_destroy(&work.sched);
+    free(threads);
+    free(params);
+    free(local_primes);
+    exit(EXIT_SUCCESS);
+}
+
+void concurrent_sieve_hybrid(size_t limit, size_t num_jobs, size_t num_processes, size_t segment_size,
+                             output_format_t format) {
+    struct timespec start, end;
+
+    numa_topology_t topo;
+    if (topology_read(&topo) == -1) {
+        perror("Error reading NUMA topology");
+        exit(EXIT_FAILURE);
+    }
+
+    if (num_processes == 0) {
+        num_processes = topo.num_nodes;
+    }
+    if (num_processes > num_jobs) {
+        num_processes = num_jobs;
+    }
+
+    size_t num_primes;
+    size_t* primes = sieving_primes(limit, &num_primes);
+    if (!primes) {
+        perror("Error while allocating sieving primes");
+        exit(EXIT_FAILURE);
+    }
+
+    // An arena of its own, so that it starts on a page and every process's part can be too
+    size_t len = wheel_bytes(limit);
+    sieve_arena_t arena;
+    if (arena_acquire(&arena, len, ARENA_SHARED) == -1) {
+        perror("Failed to map memory");
+        exit(EXIT_FAILURE);
+    }
+    unsigned char* composites = arena_alloc(&arena, len);
+
+    node_share_t* shares = malloc(sizeof(node_share_t) * num_processes);
+    size_t* cpus_used = calloc(topo.num_nodes, sizeof(size_t));
+    if (!shares || !cpus_used) {
+        perror("Error while allocating job parameters");
+        exit(EXIT_FAILURE);
+    }
+
+    // Deal the processes out to the nodes in turn and the threads out to the processes, then give each process a
+    // share of the array in proportion to its threads, rounded down to whole (possibly huge) pages
+    size_t page_size = arena_page_size(&arena);
+    size_t next_byte = 0;
+    size_t next_job = 0;
+    for (size_t i = 0; i < num_processes; ++i) {
+        node_share_t* share = &shares[i];
+        size_t node = i % topo.num_nodes;
+
+        share->node = &topo.nodes[node];
+        share->first_cpu = cpus_used[node];
+        share->first_job = next_job;
+        share->num_threads = num_jobs / num_processes + (i < num_jobs % num_processes ? 1 : 0);
+        cpus_used[node] += share->num_threads;
+        next_job += share->num_threads;
+
+        share->start_byte = next_byte;
+        if (i == num_processes - 1) {
+            share->len = len - next_byte;
+        } else {
+            share->len = (size_t)((double)len * next_job / num_jobs) / page_size * page_size - next_byte;
+        }
+        next_byte += share->len;
+    }
+
+    int done_pipe[2];
+    if (pipe(done_pipe) == -1) {
+        perror("Error creating pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    // Output from before the fork would otherwise be flushed by every child as well
+    fflush(stdout);
+
+    for (size_t i = 0; i < num_processes; ++i) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("Error while forking");
+            exit(EXIT_FAILURE);
+        } else if (pid == 0) {
+            close(done_pipe[0]);
+            sieve_node(i, &shares[i], primes, num_primes, composites, segment_size, done_pipe[1]);
+        }
+    }
+    close(done_pipe[1]);
+
+    // Each process reports in exactly once
+    TRACE_BEGIN(num_jobs, TRACE_WAIT, 0);
+    for (size_t i = 0; i < num_processes; ++i) {
+        node_done_msg msg;
+        if (read(done_pipe[0], &msg, sizeof(msg)) != sizeof(msg)) {
+            perror("Error while receiving completion message");
+            exit(EXIT_FAILURE);
+        }
+        printf("Process %lu (node %d, %lu threads) finished sieving in %.4fms.\n", msg.process, msg.node,
+               msg.num_threads, msg.ms_working);
+    }
+    close(done_pipe[0]);
+
+    for (size_t i = 0; i < num_processes; ++i) {
+        wait(NULL);
+    }
+    TRACE_END(num_jobs, TRACE_WAIT, 0);
+
+    // Everything's in shared memory, so write the primes straight out of it in order
+    TRACE_BEGIN(num_jobs, TRACE_OUTPUT, 0);
+    if (format == OUTPUT_TABLE) {
+        CTIME
+        (
+            prime_table_t table;
+            if (prime_table_create(&table, PRIME_TABLE_FILENAME, limit) == -1) {
+                perror("Error while creating " PRIME_TABLE_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+
+            memcpy(table.bitmap, composites, len);
+            if (prime_table_finish(&table) == -1) {
+                perror("Error writing " PRIME_TABLE_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+        )
+        printf("Prime table written to %s in %.4fms.\n", PRIME_TABLE_FILENAME, get_delay(start, end));
+    } else {
+        CTIME
+        (
+            int primes_fd = open(PRIMES_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (primes_fd == -1 || write_primes_wheel(primes_fd, 0, composites, len, 0, limit) == -1) {
+                perror("Error writing " PRIMES_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+            close(primes_fd);
+        )
+        printf("Primes written to %s in %.4fms.\n", PRIMES_FILENAME, get_delay(start, end));
+    }
+    TRACE_END(num_jobs, TRACE_OUTPUT, 0);
+
+    free(cpus_used);
+    free(shares);
+    free(primes);
+    arena_release(&arena);
+    topology_free(&topo);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stddef.h>
+
+#include "output.h"
+
+/**
+ * Runs the sieve using one process per NUMA node, each with threads pinned to that node's CPUs.
+ *
+ * The packed composites array is one shared mapping, split between the processes along page boundaries in
+ * proportion to their threads. Each process asks for its part to be placed on its own node, and its threads sieve
+ * it in segments handed out by a work-stealing scheduler, so every page is first touched (and written to) from the
+ * node it lives on. There's no per-prime IPC: the processes only report back once they're done, and the parent
+ * writes every prime straight from the shared array, as with concurrent_sieve_shared().
+ *
+ * @param limit         The number below which all primes will be calculated.
+ * @param num_jobs      The total number of jobs (threads) to use, split between the processes.
+ * @param num_processes The number of processes, or 0 for one per NUMA node. If there are more processes than nodes,
+ *                      they're dealt out to the nodes in turn.
+ * @param segment_size  The size of each segment in bytes of the packed composites array.
+ * @param format        Whether to write the primes as text or as a binary prime table.
+ */
+void concurrent_sieve_hybrid(size_t limit, size_t num_jobs, size_t num_processes, size_t segment_size,
+                             output_format_t format);
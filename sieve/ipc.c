@@ -0,0 +1,148 @@
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ipc.h"
+#include "futex.h"
+
+#define SLOT_SEQ(ring, pos) ((atomic_size_t*)((ring)->slots + ((pos) & ((ring)->capacity - 1)) * (ring)->slot_size))
+#define SLOT_DATA(ring, pos) ((unsigned char*)SLOT_SEQ(ring, pos) + sizeof(atomic_size_t))
+
+static size_t mapping_size(size_t capacity, size_t slot_size) {
+    return sizeof(ipc_ring_t) + capacity * slot_size;
+}
+
+ipc_ring_t* ipc_ring_create(size_t capacity, size_t msg_size, int multi_producer) {
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    // Each slot is its sequence number followed by the message, padded to keep the sequence numbers aligned
+    size_t slot_size = sizeof(atomic_size_t) + msg_size;
+    slot_size = (slot_size + sizeof(atomic_size_t) - 1) / sizeof(atomic_size_t) * sizeof(atomic_size_t);
+
+    ipc_ring_t* ring = mmap(NULL, mapping_size(rounded, slot_size), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return NULL;
+    }
+
+    ring->capacity = rounded;
+    ring->msg_size = msg_size;
+    ring->slot_size = slot_size;
+    ring->multi_producer = multi_producer;
+    atomic_store(&ring->head, 0);
+    atomic_store(&ring->tail, 0);
+    atomic_store(&ring->data_seq, 0);
+    atomic_store(&ring->data_waiters, 0);
+    atomic_store(&ring->space_seq, 0);
+    atomic_store(&ring->space_waiters, 0);
+
+    // A slot is free to write at position pos when its sequence number is pos
+    for (size_t i = 0; i < rounded; ++i) {
+        atomic_store(SLOT_SEQ(ring, i), i);
+    }
+
+    return ring;
+}
+
+void ipc_ring_destroy(ipc_ring_t* ring) {
+    munmap(ring, mapping_size(ring->capacity, ring->slot_size));
+}
+
+// Bumps a futex word so sleepers notice the change, and only makes the syscall if someone is asleep
+static void notify(atomic_uint* seq, atomic_uint* waiters) {
+    atomic_fetch_add(seq, 1);
+    if (atomic_load(waiters)) {
+        futex_wake(seq, INT_MAX);
+    }
+}
+
+// Sleeps until the slot at pos reaches (or passes, if another producer beat us to it) the wanted sequence number.
+// The futex word is read before checking the slot, so a notify() between the check and the sleep makes
+// futex_wait() return straight away.
+static void wait_for_slot(ipc_ring_t* ring, size_t pos, size_t wanted, atomic_uint* seq, atomic_uint* waiters) {
+    atomic_fetch_add(waiters, 1);
+    while (1) {
+        unsigned observed = atomic_load(seq);
+        if ((ptrdiff_t)(atomic_load(SLOT_SEQ(ring, pos)) - wanted) >= 0) {
+            break;
+        }
+        futex_wait(seq, observed);
+    }
+    atomic_fetch_sub(waiters, 1);
+}
+
+void ipc_ring_push(ipc_ring_t* ring, void const* msgs, size_t count) {
+    unsigned char const* msg = msgs;
+
+    for (size_t i = 0; i < count; ++i, msg += ring->msg_size) {
+        size_t pos = atomic_load(&ring->tail);
+        while (1) {
+            size_t slot_seq = atomic_load(SLOT_SEQ(ring, pos));
+
+            if (slot_seq == pos) {
+                // The slot is free; claim it
+                if (!ring->multi_producer) {
+                    atomic_store(&ring->tail, pos + 1);
+                    break;
+                } else if (atomic_compare_exchange_weak(&ring->tail, &pos, pos + 1)) {
+                    break;
+                }
+            } else if ((ptrdiff_t)(slot_seq - pos) < 0) {
+                // The slot still holds a message from the last lap, so the ring is full. Let the consumer know
+                // about what's been pushed so far before going to sleep, or we could both sleep forever.
+                if (i > 0) {
+                    notify(&ring->data_seq, &ring->data_waiters);
+                }
+                wait_for_slot(ring, pos, pos, &ring->space_seq, &ring->space_waiters);
+            } else {
+                // Another producer got the slot first
+                pos = atomic_load(&ring->tail);
+            }
+        }
+
+        memcpy(SLOT_DATA(ring, pos), msg, ring->msg_size);
+        atomic_store(SLOT_SEQ(ring, pos), pos + 1);
+    }
+
+    notify(&ring->data_seq, &ring->data_waiters);
+}
+
+static size_t pop(ipc_ring_t* ring, void* msgs, size_t max, int block) {
+    unsigned char* msg = msgs;
+    size_t popped = 0;
+
+    // There's only one consumer, so the head can be updated without compare-and-swap
+    size_t pos = atomic_load(&ring->head);
+    while (popped < max) {
+        if (atomic_load(SLOT_SEQ(ring, pos)) != pos + 1) {
+            if (popped > 0 || !block) {
+                break;
+            }
+            wait_for_slot(ring, pos, pos + 1, &ring->data_seq, &ring->data_waiters);
+        }
+
+        memcpy(msg, SLOT_DATA(ring, pos), ring->msg_size);
+        msg += ring->msg_size;
+        ++popped;
+
+        // Hand the slot back to the producers for the next lap
+        atomic_store(SLOT_SEQ(ring, pos), pos + ring->capacity);
+        atomic_store(&ring->head, ++pos);
+    }
+
+    if (popped > 0) {
+        notify(&ring->space_seq, &ring->space_waiters);
+    }
+    return popped;
+}
+
+size_t ipc_ring_pop(ipc_ring_t* ring, void* msgs, size_t max) {
+    return pop(ring, msgs, max, 1);
+}
+
+size_t ipc_ring_try_pop(ipc_ring_t* ring, void* msgs, size_t max) {
+    return pop(ring, msgs, max, 0);
+}
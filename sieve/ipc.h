@@ -0,0 +1,79 @@
+#pragma once
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+ * A bounded ring of fixed-size messages in shared memory, for passing messages between processes (or threads)
+ * without a syscall per message.
+ *
+ * Each slot carries a sequence number that says whether it's ready to be written or read, so producers and the
+ * consumer never need a lock. Readers that find the ring empty and writers that find it full sleep on a futex, and
+ * the other side only makes the wake-up syscall if someone is actually asleep.
+ *
+ * A ring has a single consumer. It can have a single producer (SPSC) or several (MPSC).
+ */
+typedef struct {
+    size_t capacity; // Always a power of two
+    size_t msg_size;
+    size_t slot_size;
+    int multi_producer;
+
+    // Each counter gets its own cache line so the producer and consumer don't fight over them
+    _Alignas(64) atomic_size_t head; // Next slot to read
+    _Alignas(64) atomic_size_t tail; // Next slot to write
+
+    // Futex words and sleeper counts for waiting on messages and on space respectively
+    _Alignas(64) atomic_uint data_seq;
+    atomic_uint data_waiters;
+    _Alignas(64) atomic_uint space_seq;
+    atomic_uint space_waiters;
+
+    _Alignas(64) unsigned char slots[];
+} ipc_ring_t;
+
+/**
+ * Creates a ring in an anonymous shared mapping, so that it's shared with any processes forked afterwards.
+ *
+ * @param capacity       The minimum number of messages the ring can hold. Rounded up to a power of two.
+ * @param msg_size       The size of each message in bytes.
+ * @param multi_producer Non-zero if more than one thread or process will push to the ring.
+ * @return The ring, or NULL if it couldn't be mapped.
+ */
+ipc_ring_t* ipc_ring_create(size_t capacity, size_t msg_size, int multi_producer);
+
+/**
+ * Unmaps a ring.
+ *
+ * @param ring The ring.
+ */
+void ipc_ring_destroy(ipc_ring_t* ring);
+
+/**
+ * Pushes a batch of messages, sleeping while the ring is full. The consumer is woken at most once for the whole
+ * batch, and only if it's asleep.
+ *
+ * @param ring  The ring.
+ * @param msgs  The messages, laid out one after another.
+ * @param count The number of messages.
+ */
+void ipc_ring_push(ipc_ring_t* ring, void const* msgs, size_t count);
+
+/**
+ * Pops every available message up to max, sleeping until at least one is available.
+ *
+ * @param ring The ring.
+ * @param msgs Buffer to copy the messages into, with room for max messages.
+ * @param max  The maximum number of messages to pop.
+ * @return The number of messages popped (at least 1).
+ */
+size_t ipc_ring_pop(ipc_ring_t* ring, void* msgs, size_t max);
+
+/**
+ * Pops every available message up to max without sleeping.
+ *
+ * @param ring The ring.
+ * @param msgs Buffer to copy the messages into, with room for max messages.
+ * @param max  The maximum number of messages to pop.
+ * @return The number of messages popped (possibly 0).
+ */
+size_t ipc_ring_try_pop(ipc_ring_t* ring, void* msgs, size_t max);
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "output.h"
+#include "common.h"
+
+// Bytes of packed composites formatted between checks that the buffer has room
+#define FORMAT_BLOCK_BYTES 4096
+
+// The longest line a prime can take: 20 digits and a newline
+#define MAX_LINE 21
+
+// POSIX guarantees at least this many buffers per writev(); glibc only defines IOV_MAX for _XOPEN_SOURCE
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int prime_buffer_init(prime_buffer_t* buf, size_t cap) {
+    buf->data = malloc(cap ? cap : 1);
+    buf->len = 0;
+    buf->cap = cap ? cap : 1;
+    return buf->data ? 0 : -1;
+}
+
+void prime_buffer_free(prime_buffer_t* buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = buf->cap = 0;
+}
+
+static int prime_buffer_reserve(prime_buffer_t* buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) {
+        return 0;
+    }
+
+    size_t cap = buf->cap * 2;
+    while (cap < buf->len + extra) {
+        cap *= 2;
+    }
+
+    char* data = realloc(buf->data, cap);
+    if (!data) {
+        return -1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+size_t format_u64(char* dst, size_t value) {
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+
+    while (value >= 100) {
+        size_t pair = value % 100;
+        value /= 100;
+        p -= 2;
+        memcpy(p, &digit_pairs[pair * 2], 2);
+    }
+
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, &digit_pairs[value * 2], 2);
+    } else {
+        *--p = (char)('0' + value);
+    }
+
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(dst, p, len);
+    return len;
+}
+
+static size_t num_digits(size_t value) {
+    size_t digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        ++digits;
+    }
+    return digits;
+}
+
+int format_primes_wheel(prime_buffer_t* buf, unsigned char const* composites, size_t len, size_t start_byte,
+                        size_t lo, size_t hi) {
+    if (start_byte == 0) {
+        if (prime_buffer_reserve(buf, 6) == -1) {
+            return -1;
+        }
+        for (size_t p = 2; p <= 5; p += p == 2 ? 1 : 2) {
+            if (p >= lo && p < hi) {
+                buf->data[buf->len++] = (char)('0' + p);
+                buf->data[buf->len++] = '\n';
+            }
+        }
+    }
+
+    for (size_t block = 0; block < len; block += FORMAT_BLOCK_BYTES) {
+        size_t block_end = len - block < FORMAT_BLOCK_BYTES ? len : block + FORMAT_BLOCK_BYTES;
+
+        // Every candidate in the block could be prime, so make sure there's room for all of them up front
+        size_t line = num_digits((start_byte + block_end) * WHEEL_MODULUS) + 1;
+        if (prime_buffer_reserve(buf, (block_end - block) * WHEEL_SPOKES * line) == -1) {
+            return -1;
+        }
+
+        char* out = buf->data + buf->len;
+        for (size_t i = block; i < block_end; ++i) {
+            unsigned char unmarked = ~composites[i];
+            size_t base = (start_byte + i) * WHEEL_MODULUS;
+
+            while (unmarked) {
+                size_t num = base + wheel_residues[__builtin_ctz(unmarked)];
+                if (num >= hi) {
+                    buf->len = out - buf->data;
+                    return 0;
+                }
+
+                if (num >= lo) {
+                    out += format_u64(out, num);
+                    *out++ = '\n';
+                }
+                unmarked &= unmarked - 1;
+            }
+        }
+        buf->len = out - buf->data;
+    }
+
+    return 0;
+}
+
+size_t primes_text_size_wheel(unsigned char const* composites, size_t len, size_t start_byte, size_t limit) {
+    size_t size = 0;
+
+    if (start_byte == 0) {
+        for (size_t p = 2; p <= 5 && p < limit; p += p == 2 ? 1 : 2) {
+            size += 2;
+        }
+    }
+
+    // Every prime in a byte has the same number of digits unless the byte straddles a power of 10 or the limit,
+    // so most bytes can just be counted
+    size_t digits = num_digits(start_byte * WHEEL_MODULUS);
+    size_t next_power = 1;
+    for (size_t i = 0; i < digits && next_power <= (size_t)-1 / 10; ++i) {
+        next_power *= 10;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char unmarked = ~composites[i];
+        size_t base = (start_byte + i) * WHEEL_MODULUS;
+
+        if (base + WHEEL_MODULUS <= next_power && base + WHEEL_MODULUS <= limit) {
+            size += __builtin_popcount(unmarked) * (digits + 1);
+            continue;
+        }
+
+        while (unmarked) {
+            size_t num = base + wheel_residues[__builtin_ctz(unmarked)];
+            if (num >= limit) {
+                return size;
+            }
+
+            size += num_digits(num) + 1;
+            unmarked &= unmarked - 1;
+        }
+
+        if (base + WHEEL_MODULUS > next_power) {
+            ++digits;
+            next_power = next_power <= (size_t)-1 / 10 ? next_power * 10 : (size_t)-1;
+        }
+    }
+
+    return size;
+}
+
+int write_all(int fd, off_t offset, char const* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = offset < 0 ? write(fd, data, len) : pwrite(fd, data, len, offset);
+        if (written < 0) {
+            return -1;
+        }
+
+        data += written;
+        len -= written;
+        if (offset >= 0) {
+            offset += written;
+        }
+    }
+
+    return 0;
+}
+
+int write_primes_wheel(int fd, off_t offset, unsigned char const* composites, size_t len, size_t start_byte, size_t limit) {
+    prime_buffer_t buf;
+    if (prime_buffer_init(&buf, (FORMAT_BLOCK_BYTES * WHEEL_SPOKES + 3) * MAX_LINE) == -1) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < len; i += FORMAT_BLOCK_BYTES) {
+        size_t block = len - i < FORMAT_BLOCK_BYTES ? len - i : FORMAT_BLOCK_BYTES;
+
+        buf.len = 0;
+        if (format_primes_wheel(&buf, composites + i, block, start_byte + i, 0, limit) == -1 ||
+            write_all(fd, offset, buf.data, buf.len) == -1) {
+            prime_buffer_free(&buf);
+            return -1;
+        }
+
+        if (offset >= 0) {
+            offset += buf.len;
+        }
+    }
+
+    prime_buffer_free(&buf);
+    return 0;
+}
+
+int write_buffers(int fd, prime_buffer_t const* bufs, size_t count) {
+    struct iovec iov[IOV_MAX];
+
+    size_t next = 0;
+    size_t skip = 0; // Bytes of bufs[next] already written
+    while (next < count) {
+        int iov_count = 0;
+        for (size_t i = next; i < count && iov_count < IOV_MAX; ++i) {
+            iov[iov_count].iov_base = bufs[i].data + (i == next ? skip : 0);
+            iov[iov_count].iov_len = bufs[i].len - (i == next ? skip : 0);
+            ++iov_count;
+        }
+
+        ssize_t written = writev(fd, iov, iov_count);
+        if (written < 0) {
+            return -1;
+        }
+
+        // Skip past whatever was written, which may end part way through a buffer
+        size_t remaining = written;
+        while (next < count && remaining >= bufs[next].len - skip) {
+            remaining -= bufs[next].len - skip;
+            skip = 0;
+            ++next;
+        }
+        skip += remaining;
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <stddef.h>
+#include <sys/types.h>
+
+// Every engine writes its primes, in order, to this one file
+#define PRIMES_FILENAME "primes"
+
+/**
+ * What the engines write out once they've sieved.
+ */
+typedef enum {
+    OUTPUT_TEXT, // Every prime in decimal, one per line, in PRIMES_FILENAME
+    OUTPUT_TABLE // A binary prime table (see prime_table.h) in PRIME_TABLE_FILENAME
+} output_format_t;
+
+/**
+ * A growable buffer of formatted primes.
+ */
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} prime_buffer_t;
+
+/**
+ * Initialises an empty buffer.
+ *
+ * @param buf The buffer.
+ * @param cap The initial capacity in bytes.
+ * @return 0 on success, or -1 if allocation failed.
+ */
+int prime_buffer_init(prime_buffer_t* buf, size_t cap);
+
+/**
+ * Frees a buffer's memory.
+ *
+ * @param buf The buffer.
+ */
+void prime_buffer_free(prime_buffer_t* buf);
+
+/**
+ * Writes value in decimal to dst, two digits at a time. No terminator is written.
+ *
+ * @param dst   Where to write the digits; must have room for 20 characters.
+ * @param value The value.
+ * @return The number of characters written.
+ */
+size_t format_u64(char* dst, size_t value);
+
+/**
+ * Appends every prime in [lo, hi) in a packed composites array to a buffer, one per line. The primes 2, 3 and 5
+ * come first if the array starts at 0.
+ *
+ * @param buf        The buffer.
+ * @param composites The packed composites array.
+ * @param len        The length of the composites array in bytes.
+ * @param start_byte The index of the array's first byte.
+ * @param lo         The smallest number that will be written.
+ * @param hi         The number below which all primes will be written.
+ * @return 0 on success, or -1 if the buffer couldn't grow.
+ */
+int format_primes_wheel(prime_buffer_t* buf, unsigned char const* composites, size_t len, size_t start_byte,
+                        size_t lo, size_t hi);
+
+/**
+ * Gets the number of bytes that format_primes_wheel() would produce, without formatting anything. Jobs use this
+ * to work out where their primes go in the output file before writing them.
+ *
+ * @param composites The packed composites array.
+ * @param len        The length of the composites array in bytes.
+ * @param start_byte The index of the array's first byte.
+ * @param limit      The number below which all primes will be written.
+ * @return The size of the formatted primes in bytes.
+ */
+size_t primes_text_size_wheel(unsigned char const* composites, size_t len, size_t start_byte, size_t limit);
+
+/**
+ * Writes all of a buffer to a file, carrying on after short writes.
+ *
+ * @param fd     The file to write to.
+ * @param offset The offset in the file to write at, or -1 to write at the file's current position.
+ * @param data   The data.
+ * @param len    The length of the data in bytes.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int write_all(int fd, off_t offset, char const* data, size_t len);
+
+/**
+ * Formats every prime in a packed composites array that's below limit and writes them to a file, a large chunk
+ * at a time.
+ *
+ * @param fd         The file to write to.
+ * @param offset     The offset in the file to write at, or -1 to write at the file's current position.
+ * @param composites The packed composites array.
+ * @param len        The length of the composites array in bytes.
+ * @param start_byte The index of the array's first byte.
+ * @param limit      The number below which all primes will be written.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int write_primes_wheel(int fd, off_t offset, unsigned char const* composites, size_t len, size_t start_byte, size_t limit);
+
+/**
+ * Writes buffers to a file one after another, as few writev() calls as possible.
+ *
+ * @param fd    The file to write to.
+ * @param bufs  The buffers.
+ * @param count The number of buffers.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int write_buffers(int fd, prime_buffer_t const* bufs, size_t count);
@@ -0,0 +1,623 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pi.h"
+#include "common.h"
+#include "segmented.h"
+#include "sieve.h"
+#include "../perf.h"
+#include "../timing.h"
+#include "../trace.h"
+
+// The ordinary leaves are phi(x / n, c) for the first c primes, which comes from one period of a table
+#define PHI_TINY_C 6
+
+// Blocks of segments per job, so that the jobs that get the cheap blocks at the top can take more of them
+#define BLOCKS_PER_JOB 8
+
+// Primes per batch when counting the primes for P2
+#define P2_BATCH 65536
+
+/*
+ * All of the arithmetic on leaves is done mod 2^64: the terms have both signs and the partial sums can be bigger
+ * than x, but pi(x) itself always fits.
+ */
+
+// phi(v, c) for every v, from its values over one period of the product of the first c primes
+typedef struct {
+    size_t period;
+    size_t per_period; // phi(period, c)
+    uint32_t* table; // table[i] = phi(i, c) for i < period
+} phi_tiny_t;
+
+// One block of the special leaves' sieve, counted as if the sieve started at the block
+typedef struct {
+    size_t low;
+    size_t high;
+    size_t num_b; // The last b that can have leaves in the block
+    size_t s2; // The leaves' sum, counting only what's unsieved since the start of the block
+    size_t* phi; // phi[b]: what's unsieved in the block once the first b - 1 primes are struck
+    size_t* leaves; // leaves[b]: the leaves' signs added up, to carry the earlier blocks' phi[b] into them with
+    size_t num_leaves;
+} leaf_block_t;
+
+// Shared by the jobs counting the special leaves
+typedef struct {
+    size_t x;
+    size_t y;
+    size_t z;
+    size_t a; // pi(y)
+    size_t c;
+    size_t pi_sqrty;
+
+    size_t const* primes; // primes[b] is the bth prime, from primes[1] = 2 up to at least max(y, sqrt(x))
+    uint32_t const* pi; // pi[n] for n <= y
+    int8_t const* mu; // The Moebius function for n <= y
+    uint32_t const* lpf; // The least prime factor for n <= y, or UINT32_MAX for 1
+
+    size_t segment_numbers; // Numbers per segment; even, so each segment starts on an even number
+    leaf_block_t* blocks;
+    size_t num_blocks;
+    atomic_size_t next_block;
+    atomic_int error;
+} leaves_t;
+
+typedef struct {
+    size_t job_id;
+    leaves_t* leaves;
+} leaves_job_t;
+
+// Counts the set bits in [start, stop) of a bit array
+static size_t count_bits(uint64_t const* bits, size_t start, size_t stop) {
+    if (start >= stop) {
+        return 0;
+    }
+
+    size_t first = start / 64;
+    size_t last = (stop - 1) / 64;
+    uint64_t head = ~(uint64_t)0 << (start % 64);
+    uint64_t tail = ~(uint64_t)0 >> (63 - (stop - 1) % 64);
+    if (first == last) {
+        return __builtin_popcountll(bits[first] & head & tail);
+    }
+
+    size_t count = __builtin_popcountll(bits[first] & head) + __builtin_popcountll(bits[last] & tail);
+    for (size_t i = first + 1; i < last; ++i) {
+        count += __builtin_popcountll(bits[i]);
+    }
+    return count;
+}
+
+/*
+ * A segment [low, high) of the special leaves' sieve. Only odd numbers are kept, since 2 is always one of the
+ * first c primes: bit i is low + 2i + 1. Counts are taken in increasing order between strikes, so each one only
+ * popcounts the bits since the last.
+ */
+typedef struct {
+    uint64_t* bits;
+    size_t low;
+    size_t num_bits;
+    size_t counted_to; // The bit the running count has got up to
+    size_t count;
+} leaf_segment_t;
+
+static void segment_start_count(leaf_segment_t* seg) {
+    seg->counted_to = 0;
+    seg->count = 0;
+}
+
+// What's unsieved in [low, n]; n must be at least as big as last time
+static size_t segment_count(leaf_segment_t* seg, size_t n) {
+    size_t stop = n > seg->low ? (n - seg->low + 1) / 2 : 0;
+    stop = stop < seg->num_bits ? stop : seg->num_bits;
+    seg->count += count_bits(seg->bits, seg->counted_to, stop);
+    seg->counted_to = stop > seg->counted_to ? stop : seg->counted_to;
+    return seg->count;
+}
+
+// Strikes an odd prime and its odd multiples
+static void segment_strike(leaf_segment_t* seg, size_t prime) {
+    size_t high = seg->low + 2 * seg->num_bits;
+    size_t first = (seg->low + prime - 1) / prime * prime;
+    if (first < prime) {
+        first = prime;
+    }
+    if (first % 2 == 0) {
+        first += prime;
+    }
+
+    for (size_t n = first; n < high; n += 2 * prime) {
+        size_t i = (n - seg->low - 1) / 2;
+        seg->bits[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+}
+
+static void sieve_block(leaves_t const* leaves, leaf_block_t* block, leaf_segment_t* seg) {
+    size_t x = leaves->x;
+    size_t y = leaves->y;
+    size_t const* primes = leaves->primes;
+    size_t max_b = block->num_b < leaves->a ? block->num_b : leaves->a - 1;
+
+    for (size_t low = block->low; low < block->high; low += leaves->segment_numbers) {
+        size_t high = block->high - low < leaves->segment_numbers ? block->high : low + leaves->segment_numbers;
+
+        // Every odd number starts out unsieved, then the first c primes are struck
+        seg->low = low;
+        seg->num_bits = (high - low) / 2;
+        memset(seg->bits, 0xff, (seg->num_bits + 63) / 64 * sizeof(uint64_t));
+        for (size_t b = 2; b <= leaves->c; ++b) {
+            segment_strike(seg, primes[b]);
+        }
+
+        size_t b = leaves->c + 1;
+
+        // Leaves n = prime * m with m squarefree, lpf(m) > prime and x / n in [low, high)
+        for (; b <= leaves->pi_sqrty && b <= max_b; ++b) {
+            size_t prime = primes[b];
+            size_t xp = x / prime;
+            size_t max_m = low > 0 && xp / low < y ? xp / low : y;
+            if (prime >= max_m) {
+                goto next_segment;
+            }
+            size_t min_m = xp / high > y / prime ? xp / high : y / prime;
+
+            segment_start_count(seg);
+            for (size_t m = max_m; m > min_m; --m) {
+                if (leaves->mu[m] != 0 && prime < leaves->lpf[m]) {
+                    size_t phi = block->phi[b] + segment_count(seg, xp / m);
+                    // -mu(m) * phi, mod 2^64
+                    block->s2 += leaves->mu[m] > 0 ? -phi : phi;
+                    block->leaves[b] += leaves->mu[m] > 0 ? (size_t)-1 : 1;
+                    ++block->num_leaves;
+                }
+            }
+
+            block->phi[b] += segment_count(seg, high);
+            segment_strike(seg, prime);
+        }
+
+        // Past sqrt(y), m can only be a prime q with prime < q <= y, and mu(m) = -1
+        for (; b <= max_b; ++b) {
+            size_t prime = primes[b];
+            size_t xp = x / prime;
+            size_t max_m = low > 0 && xp / low < y ? xp / low : y;
+            if (prime >= max_m) {
+                goto next_segment;
+            }
+            size_t min_m = xp / high > y / prime ? xp / high : y / prime;
+            min_m = min_m > prime ? min_m : prime;
+
+            segment_start_count(seg);
+            for (size_t l = leaves->pi[max_m]; primes[l] > min_m; --l) {
+                block->s2 += block->phi[b] + segment_count(seg, xp / primes[l]);
+                ++block->leaves[b];
+                ++block->num_leaves;
+            }
+
+            block->phi[b] += segment_count(seg, high);
+            segment_strike(seg, prime);
+        }
+
+    next_segment:;
+    }
+}
+
+static void* do_leaves(void* job_params) {
+    leaves_job_t* job = (leaves_job_t*)job_params;
+    leaves_t* leaves = job->leaves;
+
+    struct timespec start, end;
+    perf_job_t perf;
+    perf_job_open(&perf, job->job_id);
+
+    leaf_segment_t seg;
+    seg.bits = malloc((leaves->segment_numbers / 2 + 63) / 64 * sizeof(uint64_t));
+    if (!seg.bits) {
+        atomic_store(&leaves->error, ENOMEM);
+        perf_job_close(&perf);
+        return NULL;
+    }
+
+    size_t blocks = 0;
+    while (!atomic_load(&leaves->error)) {
+        size_t i = atomic_fetch_add(&leaves->next_block, 1);
+        if (i >= leaves->num_blocks) {
+            break;
+        }
+
+        leaf_block_t* block = &leaves->blocks[i];
+        TRACE_BEGIN(job->job_id, TRACE_STRIKE, blocks);
+        PTIME("working", sieve_block(leaves, block, &seg))
+        TRACE_END(job->job_id, TRACE_STRIKE, blocks);
+        ++blocks;
+    }
+
+    free(seg.bits);
+    perf_job_close(&perf);
+    return NULL;
+}
+
+// Counts the special leaves: the terms -mu(m) * phi(x / (p_b * m), b - 1) with m <= y < p_b * m and lpf(m) > p_b
+static int special_leaves(leaves_t* leaves, size_t num_jobs, size_t* s2, size_t* num_leaves) {
+    // Blocks are whole segments, apart from the last
+    size_t limit = leaves->z + 1;
+    size_t num_segments = (limit + leaves->segment_numbers - 1) / leaves->segment_numbers;
+    leaves->num_blocks = num_jobs * BLOCKS_PER_JOB < num_segments ? num_jobs * BLOCKS_PER_JOB : num_segments;
+    size_t block_segments = (num_segments + leaves->num_blocks - 1) / leaves->num_blocks;
+    leaves->num_blocks = (num_segments + block_segments - 1) / block_segments;
+
+    leaves->blocks = calloc(leaves->num_blocks, sizeof(leaf_block_t));
+    leaves_job_t* jobs = malloc(sizeof(leaves_job_t) * num_jobs);
+    pthread_t* threads = malloc(sizeof(pthread_t) * num_jobs);
+    size_t* phi = calloc(leaves->a + 1, sizeof(size_t));
+    int ret = leaves->blocks && jobs && threads && phi ? 0 : -1;
+
+    // A block only needs the primes that can still have leaves at its start: p_b^2 < x / low, and p_b < y
+    for (size_t i = 0; i < leaves->num_blocks && ret == 0; ++i) {
+        leaf_block_t* block = &leaves->blocks[i];
+        block->low = i * block_segments * leaves->segment_numbers;
+        block->high = limit - block->low < block_segments * leaves->segment_numbers ?
+                      limit : block->low + block_segments * leaves->segment_numbers;
+
+        size_t root = block->low > 0 ? isqrt(leaves->x / block->low) : leaves->y;
+        block->num_b = leaves->pi[root < leaves->y ? root : leaves->y];
+        block->phi = calloc(block->num_b + 1, sizeof(size_t));
+        block->leaves = calloc(block->num_b + 1, sizeof(size_t));
+        if (!block->phi || !block->leaves) {
+            ret = -1;
+        }
+    }
+
+    size_t started = 0;
+    if (ret == 0) {
+        atomic_init(&leaves->next_block, 0);
+        atomic_init(&leaves->error, 0);
+        for (size_t i = 0; i < num_jobs; ++i) {
+            jobs[i].job_id = i;
+            jobs[i].leaves = leaves;
+            int err = pthread_create(&threads[i], NULL, do_leaves, &jobs[i]);
+            if (err != 0) {
+                atomic_store(&leaves->error, err);
+                break;
+            }
+            ++started;
+        }
+    }
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int error = ret == -1 ? ENOMEM : atomic_load(&leaves->error);
+    if (error) {
+        ret = -1;
+    }
+
+    // Each block counted its leaves from its own start, so carry in what the blocks before it left unsieved
+    *s2 = 0;
+    *num_leaves = 0;
+    for (size_t i = 0; i < leaves->num_blocks && ret == 0; ++i) {
+        leaf_block_t const* block = &leaves->blocks[i];
+        *s2 += block->s2;
+        *num_leaves += block->num_leaves;
+        for (size_t b = leaves->c + 1; b <= block->num_b; ++b) {
+            *s2 += block->leaves[b] * phi[b];
+            phi[b] += block->phi[b];
+        }
+    }
+
+    for (size_t i = 0; leaves->blocks && i < leaves->num_blocks; ++i) {
+        free(leaves->blocks[i].phi);
+        free(leaves->blocks[i].leaves);
+    }
+    free(leaves->blocks);
+    free(phi);
+    free(threads);
+    free(jobs);
+
+    if (ret == -1) {
+        errno = error;
+    }
+    return ret;
+}
+
+static int phi_tiny_init(phi_tiny_t* tiny, size_t const* primes, size_t c) {
+    tiny->period = 1;
+    for (size_t b = 1; b <= c; ++b) {
+        tiny->period *= primes[b];
+    }
+
+    tiny->table = malloc(sizeof(uint32_t) * tiny->period);
+    if (!tiny->table) {
+        return -1;
+    }
+
+    uint32_t count = 0;
+    for (size_t i = 0; i < tiny->period; ++i) {
+        int coprime = i > 0;
+        for (size_t b = 1; b <= c && coprime; ++b) {
+            coprime = i % primes[b] != 0;
+        }
+        count += coprime;
+        tiny->table[i] = count;
+    }
+    tiny->per_period = count + (tiny->period == 1);
+    return 0;
+}
+
+static size_t phi_tiny(phi_tiny_t const* tiny, size_t v) {
+    return v / tiny->period * tiny->per_period + tiny->table[v % tiny->period];
+}
+
+// Where the P2 count has got to: pi(targets[i]) for each target, in increasing order
+typedef struct {
+    size_t const* targets;
+    size_t* pis;
+    size_t num_targets;
+    size_t next;
+    size_t base; // The primes below the ones being streamed
+    size_t streamed;
+} p2_state_t;
+
+static int p2_batch(size_t const* primes, size_t count, void* user) {
+    p2_state_t* state = (p2_state_t*)user;
+
+    while (state->next < state->num_targets && state->targets[state->next] < primes[count - 1]) {
+        // The number of primes in the batch that are <= the target
+        size_t target = state->targets[state->next];
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (primes[mid] <= target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        state->pis[state->next++] = state->base + state->streamed + lo;
+    }
+
+    state->streamed += count;
+    return 0;
+}
+
+// Counts P2(x, a): the numbers <= x that are the product of two primes > y, as the sum of pi(x / p) - pi(p) + 1
+// over the primes y < p <= sqrt(x), which are primes[a + 1..] (primes has every prime up to sqrt(x))
+static int count_p2(size_t x, size_t num_jobs, size_t const* primes, size_t num_primes, size_t a, size_t* p2) {
+    size_t root = isqrt(x);
+
+    // pi(x / p) for each p in (y, sqrt(x)], from the biggest p down, so the targets go up
+    size_t first = a + 1;
+    size_t last = first;
+    while (last <= num_primes && primes[last] <= root) {
+        ++last;
+    }
+
+    size_t num_targets = last - first;
+    size_t* targets = malloc(sizeof(size_t) * (num_targets ? num_targets : 1));
+    size_t* pis = malloc(sizeof(size_t) * (num_targets ? num_targets : 1));
+    if (!targets || !pis) {
+        free(targets);
+        free(pis);
+        return -1;
+    }
+    for (size_t i = 0; i < num_targets; ++i) {
+        targets[i] = x / primes[last - 1 - i];
+    }
+
+    // Targets inside the table are looked up; the rest come from streaming the primes above it
+    size_t table_max = primes[num_primes];
+    p2_state_t state = {targets, pis, num_targets, 0, num_primes, 0};
+    while (state.next < num_targets && targets[state.next] <= table_max) {
+        size_t lo = 1;
+        size_t hi = num_primes + 1;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (primes[mid] <= targets[state.next]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        pis[state.next++] = lo - 1;
+    }
+
+    int ret = 0;
+    if (state.next < num_targets) {
+        sieve_config_t config;
+        sieve_config_init(&config, targets[num_targets - 1] + 1);
+        config.lo = table_max + 1;
+        config.num_jobs = num_jobs;
+        ret = sieve_stream(&config, P2_BATCH, p2_batch, &state);
+        while (ret == 0 && state.next < num_targets) {
+            pis[state.next++] = state.base + state.streamed;
+        }
+    }
+
+    *p2 = 0;
+    for (size_t i = 0; i < num_targets; ++i) {
+        size_t b = last - 1 - i;
+        *p2 += pis[i] - b + 1;
+    }
+
+    free(pis);
+    free(targets);
+    return ret;
+}
+
+// Gets every prime up to limit with the segmented sieve, as primes[1..count]
+static size_t* prime_list(size_t limit, size_t num_jobs, size_t* count) {
+    sieve_config_t config;
+    sieve_config_init(&config, limit + 1);
+    config.num_jobs = num_jobs;
+
+    if (sieve_count(&config, count) == -1) {
+        return NULL;
+    }
+
+    size_t* primes = malloc(sizeof(size_t) * (*count + 1));
+    if (!primes) {
+        return NULL;
+    }
+
+    primes[0] = 0;
+    size_t filled;
+    if (sieve_fill(&config, primes + 1, *count, &filled) == -1) {
+        free(primes);
+        return NULL;
+    }
+    return primes;
+}
+
+// alpha * x^(1/3): a bigger alpha means a shorter sieve for the special leaves and fewer P2 targets, but many more
+// special leaves. alpha = ln(x) / 10 came out best from 1e10 to 1e14.
+static size_t choose_y(size_t x) {
+    double alpha = log((double)x) / 10.0;
+    alpha = alpha < 1.0 ? 1.0 : alpha;
+
+    size_t cbrt_x = (size_t)cbrtl((long double)x);
+    while ((cbrt_x + 1) * (cbrt_x + 1) * (cbrt_x + 1) <= x) {
+        ++cbrt_x;
+    }
+
+    size_t y = (size_t)(alpha * cbrt_x);
+    size_t root = isqrt(x);
+    return y > cbrt_x ? (y < root ? y : root) : cbrt_x;
+}
+
+int prime_pi(size_t x, size_t num_jobs, size_t* count, prime_pi_stats_t* stats) {
+    struct timespec start, end;
+    prime_pi_stats_t local;
+    stats = stats ? stats : &local;
+    memset(stats, 0, sizeof(*stats));
+
+    if (num_jobs == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (x < PRIME_PI_SIEVE_BELOW) {
+        sieve_config_t config;
+        sieve_config_init(&config, x + 1);
+        config.num_jobs = num_jobs;
+        return sieve_count(&config, count);
+    }
+
+    size_t y = choose_y(x);
+    size_t root = isqrt(x);
+    stats->y = y;
+    stats->z = x / y;
+
+    // The primes up to sqrt(x) (which covers y), and pi, mu and the least prime factor up to y
+    size_t num_primes;
+    size_t* primes = NULL;
+    uint32_t* pi = malloc(sizeof(uint32_t) * (y + 1));
+    int8_t* mu = malloc(y + 1);
+    uint32_t* lpf = calloc(y + 1, sizeof(uint32_t));
+    int ret = pi && mu && lpf ? 0 : -1;
+
+    CTIME
+    (
+        if (ret == 0) {
+            primes = prime_list(root > y ? root : y, num_jobs, &num_primes);
+            ret = primes ? 0 : -1;
+        }
+
+        if (ret == 0) {
+            size_t b = 0;
+            for (size_t n = 0; n <= y; ++n) {
+                while (b < num_primes && primes[b + 1] <= n) {
+                    ++b;
+                }
+                pi[n] = (uint32_t)b;
+            }
+
+            for (size_t i = 1; i <= pi[y]; ++i) {
+                for (size_t n = primes[i]; n <= y; n += primes[i]) {
+                    if (!lpf[n]) {
+                        lpf[n] = (uint32_t)primes[i];
+                    }
+                }
+            }
+
+            lpf[1] = UINT32_MAX;
+            mu[0] = 0;
+            mu[1] = 1;
+            for (size_t n = 2; n <= y; ++n) {
+                size_t m = n / lpf[n];
+                mu[n] = lpf[m] == lpf[n] ? 0 : -mu[m];
+            }
+        }
+    )
+    stats->ms_tables = get_delay(start, end);
+
+    size_t a = ret == 0 ? pi[y] : 0;
+    size_t c = a < PHI_TINY_C ? a : PHI_TINY_C;
+
+    // S1, the ordinary leaves: mu(n) * phi(x / n, c) for squarefree n <= y with lpf(n) > p_c
+    size_t s1 = 0;
+    phi_tiny_t tiny = {0, 0, NULL};
+    CTIME
+    (
+        if (ret == 0) {
+            ret = phi_tiny_init(&tiny, primes, c);
+        }
+
+        for (size_t n = 1; ret == 0 && n <= y; ++n) {
+            if (mu[n] != 0 && lpf[n] > primes[c]) {
+                size_t phi = phi_tiny(&tiny, x / n);
+                s1 += mu[n] > 0 ? phi : -phi;
+            }
+        }
+    )
+    stats->ms_s1 = get_delay(start, end);
+
+    // S2, the special leaves
+    size_t s2 = 0;
+    CTIME
+    (
+        if (ret == 0) {
+            leaves_t leaves;
+            leaves.x = x;
+            leaves.y = y;
+            leaves.z = x / y;
+            leaves.a = a;
+            leaves.c = c;
+            leaves.pi_sqrty = pi[isqrt(y)];
+            leaves.primes = primes;
+            leaves.pi = pi;
+            leaves.mu = mu;
+            leaves.lpf = lpf;
+            leaves.segment_numbers = default_segment_size() * 8 * 2;
+            ret = special_leaves(&leaves, num_jobs, &s2, &stats->special_leaves);
+        }
+    )
+    stats->ms_s2 = get_delay(start, end);
+
+    size_t p2 = 0;
+    CTIME
+    (
+        if (ret == 0) {
+            ret = count_p2(x, num_jobs, primes, num_primes, a, &p2);
+        }
+    )
+    stats->ms_p2 = get_delay(start, end);
+
+    if (ret == 0) {
+        *count = s1 + s2 + a - 1 - p2;
+    }
+
+    int error = errno;
+    free(tiny.table);
+    free(primes);
+    free(lpf);
+    free(mu);
+    free(pi);
+    errno = error;
+    return ret;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <stddef.h>
+
+// Below this, prime_pi() just sieves: the tables would cost more than they save
+#define PRIME_PI_SIEVE_BELOW 100000000
+
+/**
+ * How prime_pi() split up the work, and how long each part took.
+ */
+typedef struct {
+    size_t y; // Leaves n <= y are ordinary; y is about alpha * x^(1/3)
+    size_t z; // The special leaves' sieve covers [1, z], z = x / y
+    size_t special_leaves;
+    double ms_tables; // Primes up to sqrt(x), and the Moebius function and least prime factors up to y
+    double ms_s1; // Ordinary leaves
+    double ms_s2; // Special leaves
+    double ms_p2; // Numbers <= x with two prime factors > y
+} prime_pi_stats_t;
+
+/**
+ * Counts the primes <= x with the Lagarias-Miller-Odlyzko method, in about O(x^(2/3)) time rather than sieving all the
+ * way up to x. Memory is dominated by the list of primes up to sqrt(x) that P2 needs, about sqrt(x) / log(x) words;
+ * the pi, Moebius and least prime factor tables only go up to y, about x^(1/3).
+ *
+ * pi(x) = phi(x, a) + a - 1 - P2(x, a), where a = pi(y), phi(x, a) counts the numbers <= x with no prime factor
+ * <= the ath prime, and P2(x, a) counts the ones with exactly two prime factors > y. phi(x, a) is expanded into
+ * leaves mu(n) * phi(x / n, b): the ordinary ones (n <= y) are summed from a small table, and the special ones
+ * (n > y, so x / n < z) are counted by sieving [1, z] a segment at a time, striking the primes in order and counting
+ * what's left below each leaf as it's reached. The segments are split into blocks that the jobs take in turn, each
+ * counting its leaves from the start of its own block; the blocks' totals are then carried over in order. P2 and
+ * the tables use the segmented sieve (see sieve.h).
+ *
+ * @param x        The number up to which primes will be counted.
+ * @param num_jobs The number of jobs (threads) to use.
+ * @param count    Set to the number of primes <= x.
+ * @param stats    Filled in with how the work was split up, or NULL. Left zeroed if x was small enough to sieve.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int prime_pi(size_t x, size_t num_jobs, size_t* count, prime_pi_stats_t* stats);
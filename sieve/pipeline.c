@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "pipeline.h"
+
+// Initial capacity of each buffer; they grow to fit their chunks and keep their size when recycled
+#define INITIAL_BUFFER_SIZE (64 * 1024)
+
+/*
+ * A minimal io_uring, driven with raw syscalls since liburing isn't a dependency.
+ */
+typedef struct {
+    int fd;
+
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned to_submit;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring_t;
+
+static int uring_init(uring_t* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(SYS_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both rings at once
+    int single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                                                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        int error = errno;
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sq_ring != MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        close(ring->fd);
+        errno = error;
+        return -1;
+    }
+
+    unsigned char* sq = ring->sq_ring;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->to_submit = 0;
+
+    unsigned char* cq = ring->cq_ring;
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+static void uring_destroy(uring_t* ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Queues a write; it isn't started until uring_enter()
+static void uring_queue_write(uring_t* ring, int fd, void const* data, size_t len, off_t offset, size_t user_data) {
+    unsigned tail = *ring->sq_tail + ring->to_submit;
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)data;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+
+    ring->sq_array[index] = index;
+    ++ring->to_submit;
+}
+
+// Submits every queued write and optionally waits for at least one to complete
+static void uring_enter(uring_t* ring, unsigned min_complete) {
+    if (ring->to_submit == 0 && min_complete == 0) {
+        return;
+    }
+
+    // Publish the queued entries before the kernel looks at them
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->to_submit, __ATOMIC_RELEASE);
+
+    // The kernel may take fewer entries than it's offered; the rest stay queued behind its head until they're
+    // offered again
+    unsigned remaining = ring->to_submit;
+    ring->to_submit = 0;
+    do {
+        unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+        long submitted = syscall(SYS_io_uring_enter, ring->fd, remaining, min_complete, flags, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error submitting writes");
+            exit(EXIT_FAILURE);
+        }
+
+        remaining -= (unsigned)submitted;
+        min_complete = 0;
+    } while (remaining > 0 || min_complete > 0);
+}
+
+static void release_buffer(output_pipeline_t* pipe, size_t index) {
+    pthread_mutex_lock(&pipe->free_lock);
+    pipe->free_list[pipe->num_free++] = index;
+    pthread_cond_signal(&pipe->free_cond);
+    pthread_mutex_unlock(&pipe->free_lock);
+}
+
+// Returns every buffer whose write has completed to the pool. Anything the kernel didn't write in full (including
+// writes it refused, say on a kernel without IORING_OP_WRITE) is finished off with pwrite().
+static size_t reap_writes(output_pipeline_t* pipe, uring_t* ring) {
+    size_t reaped = 0;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head, ++reaped) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        pipeline_buffer_t* buf = &pipe->buffers[cqe->user_data];
+
+        size_t written = cqe->res > 0 ? (size_t)cqe->res : 0;
+        if (written < buf->text.len &&
+            write_all(pipe->fd, buf->offset + written, buf->text.data + written, buf->text.len - written) == -1) {
+            perror("Error writing primes");
+            exit(EXIT_FAILURE);
+        }
+
+        release_buffer(pipe, cqe->user_data);
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return reaped;
+}
+
+static void* write_chunks(void* arg) {
+    output_pipeline_t* pipe = arg;
+
+    uring_t ring;
+    pipe->uses_io_uring = uring_init(&ring, pipe->num_buffers) == 0;
+
+    // Buffers that have arrived ahead of their turn, by chunk. Every chunk that's been claimed but not written
+    // holds a buffer, so they're all within num_buffers of the next chunk to write and can't collide.
+    size_t* ready = malloc(sizeof(size_t) * pipe->num_buffers);
+    size_t* arrived = malloc(sizeof(size_t) * pipe->num_buffers);
+    if (!ready || !arrived) {
+        perror("Error while allocating writer:");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < pipe->num_buffers; ++i) {
+        ready[i] = (size_t)-1;
+    }
+
+    size_t next_chunk = 0;
+    off_t offset = 0;
+    size_t in_flight = 0;
+
+    while (next_chunk < pipe->num_chunks || in_flight > 0) {
+        if (in_flight > 0) {
+            in_flight -= reap_writes(pipe, &ring);
+        }
+
+        // Everything's been submitted; just wait for the last writes to complete
+        if (next_chunk == pipe->num_chunks) {
+            if (in_flight > 0) {
+                uring_enter(&ring, 1);
+            }
+            continue;
+        }
+
+        // Only sleep on the jobs when there's nothing in flight; otherwise wait for the disk, which frees buffers
+        size_t count = ipc_ring_try_pop(pipe->filled, arrived, pipe->num_buffers);
+        if (count == 0) {
+            if (in_flight > 0) {
+                uring_enter(&ring, 1);
+                continue;
+            }
+            count = ipc_ring_pop(pipe->filled, arrived, pipe->num_buffers);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            ready[pipe->buffers[arrived[i]].chunk % pipe->num_buffers] = arrived[i];
+        }
+
+        // Write out every chunk that's now next in line
+        while (next_chunk < pipe->num_chunks && ready[next_chunk % pipe->num_buffers] != (size_t)-1) {
+            size_t index = ready[next_chunk % pipe->num_buffers];
+            pipeline_buffer_t* buf = &pipe->buffers[index];
+            ready[next_chunk % pipe->num_buffers] = (size_t)-1;
+
+            buf->offset = offset;
+            offset += buf->text.len;
+            pipe->bytes_written += buf->text.len;
+            ++next_chunk;
+
+            if (buf->text.len == 0) {
+                release_buffer(pipe, index);
+            } else if (pipe->uses_io_uring) {
+                uring_queue_write(&ring, pipe->fd, buf->text.data, buf->text.len, buf->offset, index);
+                ++in_flight;
+                ++pipe->writes;
+            } else {
+                if (write_all(pipe->fd, buf->offset, buf->text.data, buf->text.len) == -1) {
+                    perror("Error writing primes");
+                    exit(EXIT_FAILURE);
+                }
+                release_buffer(pipe, index);
+                ++pipe->writes;
+            }
+        }
+
+        if (pipe->uses_io_uring) {
+            uring_enter(&ring, 0);
+        }
+    }
+
+    if (pipe->uses_io_uring) {
+        uring_destroy(&ring);
+    }
+    free(arrived);
+    free(ready);
+    return NULL;
+}
+
+int pipeline_init(output_pipeline_t* pipe, int fd, size_t num_chunks, size_t num_buffers) {
+    pipe->fd = fd;
+    pipe->num_chunks = num_chunks;
+    atomic_store(&pipe->next_chunk, 0);
+    pipe->num_buffers = num_buffers;
+    pipe->num_free = num_buffers;
+    pipe->uses_io_uring = 0;
+    pipe->writes = 0;
+    pipe->bytes_written = 0;
+
+    pipe->buffers = malloc(sizeof(pipeline_buffer_t) * num_buffers);
+    pipe->free_list = malloc(sizeof(size_t) * num_buffers);
+    pipe->filled = ipc_ring_create(num_buffers, sizeof(size_t), 1);
+    size_t num_init = 0;
+    int ret = pipe->buffers && pipe->free_list && pipe->filled ? 0 : -1;
+
+    for (; ret == 0 && num_init < num_buffers; ++num_init) {
+        if (prime_buffer_init(&pipe->buffers[num_init].text, INITIAL_BUFFER_SIZE) == -1) {
+            ret = -1;
+            break;
+        }
+        pipe->free_list[num_init] = num_init;
+    }
+
+    if (ret == 0) {
+        pthread_mutex_init(&pipe->free_lock, NULL);
+        pthread_cond_init(&pipe->free_cond, NULL);
+        if ((errno = pthread_create(&pipe->writer, NULL, write_chunks, pipe)) == 0) {
+            return 0;
+        }
+        pthread_cond_destroy(&pipe->free_cond);
+        pthread_mutex_destroy(&pipe->free_lock);
+    }
+
+    // Undo whatever was set up before the failure
+    int error = errno;
+    for (size_t i = 0; i < num_init; ++i) {
+        prime_buffer_free(&pipe->buffers[i].text);
+    }
+    if (pipe->filled) {
+        ipc_ring_destroy(pipe->filled);
+    }
+    free(pipe->free_list);
+    free(pipe->buffers);
+    errno = error;
+    return -1;
+}
+
+pipeline_buffer_t* pipeline_acquire(output_pipeline_t* pipe) {
+    pthread_mutex_lock(&pipe->free_lock);
+    while (pipe->num_free == 0) {
+        pthread_cond_wait(&pipe->free_cond, &pipe->free_lock);
+    }
+    size_t index = pipe->free_list[--pipe->num_free];
+    pthread_mutex_unlock(&pipe->free_lock);
+
+    size_t chunk = atomic_fetch_add(&pipe->next_chunk, 1);
+    if (chunk >= pipe->num_chunks) {
+        release_buffer(pipe, index);
+        return NULL;
+    }
+
+    pipeline_buffer_t* buf = &pipe->buffers[index];
+    buf->chunk = chunk;
+    buf->text.len = 0;
+    return buf;
+}
+
+void pipeline_submit(output_pipeline_t* pipe, pipeline_buffer_t* buf) {
+    size_t index = buf - pipe->buffers;
+    ipc_ring_push(pipe->filled, &index, 1);
+}
+
+void pipeline_finish(output_pipeline_t* pipe) {
+    pthread_join(pipe->writer, NULL);
+
+    for (size_t i = 0; i < pipe->num_buffers; ++i) {
+        prime_buffer_free(&pipe->buffers[i].text);
+    }
+
+    pthread_cond_destroy(&pipe->free_cond);
+    pthread_mutex_destroy(&pipe->free_lock);
+    ipc_ring_destroy(pipe->filled);
+    free(pipe->free_list);
+    free(pipe->buffers);
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "ipc.h"
+#include "output.h"
+
+/**
+ * A buffer of formatted primes for one chunk of the output.
+ */
+typedef struct {
+    size_t chunk; // The chunk whose primes are in the buffer
+    off_t offset; // Where the buffer goes in the file; set by the writer
+    prime_buffer_t text;
+} pipeline_buffer_t;
+
+/**
+ * Writes the output a chunk at a time while later chunks are still being sieved.
+ *
+ * Jobs take a buffer from a fixed pool, claim the next chunk, format its primes into the buffer and submit it. A
+ * writer thread puts submitted buffers back into chunk order and writes them out with io_uring, falling back to
+ * pwrite() if io_uring isn't available. Each buffer goes back to the pool once its write has completed.
+ *
+ * A job always takes a buffer before claiming a chunk, so the chunk the writer is waiting for always has a buffer
+ * and the pool can't run dry waiting on it.
+ */
+typedef struct {
+    int fd;
+    size_t num_chunks;
+    atomic_size_t next_chunk; // The next chunk to hand out
+
+    pipeline_buffer_t* buffers;
+    size_t num_buffers;
+
+    // Buffers that aren't being filled or written
+    pthread_mutex_t free_lock;
+    pthread_cond_t free_cond;
+    size_t* free_list;
+    size_t num_free;
+
+    ipc_ring_t* filled; // Indices of submitted buffers, in the order they were finished
+
+    pthread_t writer;
+
+    // Filled in by the writer thread; only read them after pipeline_finish()
+    int uses_io_uring;
+    size_t writes;
+    size_t bytes_written;
+} output_pipeline_t;
+
+/**
+ * Allocates a pipeline's buffers and starts its writer thread.
+ *
+ * @param pipe        The pipeline.
+ * @param fd          The file to write to, from offset 0.
+ * @param num_chunks  The number of chunks in the output.
+ * @param num_buffers The number of buffers in the pool.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int pipeline_init(output_pipeline_t* pipe, int fd, size_t num_chunks, size_t num_buffers);
+
+/**
+ * Takes an empty buffer from the pool, sleeping until one is free, and claims the next chunk for it.
+ *
+ * @param pipe The pipeline.
+ * @return The buffer, with its chunk set, or NULL if every chunk has been claimed.
+ */
+pipeline_buffer_t* pipeline_acquire(output_pipeline_t* pipe);
+
+/**
+ * Hands a filled buffer to the writer.
+ *
+ * @param pipe The pipeline.
+ * @param buf  The buffer, from pipeline_acquire().
+ */
+void pipeline_submit(output_pipeline_t* pipe, pipeline_buffer_t* buf);
+
+/**
+ * Waits for every chunk to be written, then stops the writer and frees the pipeline.
+ *
+ * @param pipe The pipeline.
+ */
+void pipeline_finish(output_pipeline_t* pipe);
@@ -0,0 +1,137 @@
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRESIEVE_X86
+#endif
+
+#include "presieve.h"
+#include "common.h"
+
+// 7 * 11 * 13 * 17 and 19 * 23 * 29 bytes
+#define TILE_A_LEN 17017
+#define TILE_B_LEN 12673
+
+static const size_t tile_a_primes[] = {7, 11, 13, 17};
+static const size_t tile_b_primes[] = {19, 23, 29};
+
+typedef void (*or_kernel_t)(unsigned char* dest, unsigned char const* a, unsigned char const* b, size_t len);
+
+static unsigned char tile_a[TILE_A_LEN];
+static unsigned char tile_b[TILE_B_LEN];
+static or_kernel_t or_kernel;
+static char const* kernel_isa;
+static pthread_once_t tiles_once = PTHREAD_ONCE_INIT;
+
+static void or_scalar(unsigned char* dest, unsigned char const* a, unsigned char const* b, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        dest[i] = a[i] | b[i];
+    }
+}
+
+#ifdef PRESIEVE_X86
+__attribute__((target("sse2")))
+static void or_sse2(unsigned char* dest, unsigned char const* a, unsigned char const* b, size_t len) {
+    size_t i = 0;
+    for (; i + sizeof(__m128i) <= len; i += sizeof(__m128i)) {
+        __m128i va = _mm_loadu_si128((__m128i const*)(a + i));
+        __m128i vb = _mm_loadu_si128((__m128i const*)(b + i));
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_or_si128(va, vb));
+    }
+    or_scalar(dest + i, a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static void or_avx2(unsigned char* dest, unsigned char const* a, unsigned char const* b, size_t len) {
+    size_t i = 0;
+    for (; i + sizeof(__m256i) <= len; i += sizeof(__m256i)) {
+        __m256i va = _mm256_loadu_si256((__m256i const*)(a + i));
+        __m256i vb = _mm256_loadu_si256((__m256i const*)(b + i));
+        _mm256_storeu_si256((__m256i*)(dest + i), _mm256_or_si256(va, vb));
+    }
+    or_scalar(dest + i, a + i, b + i, len - i);
+}
+
+__attribute__((target("avx512f")))
+static void or_avx512(unsigned char* dest, unsigned char const* a, unsigned char const* b, size_t len) {
+    size_t i = 0;
+    for (; i + sizeof(__m512i) <= len; i += sizeof(__m512i)) {
+        __m512i va = _mm512_loadu_si512((void const*)(a + i));
+        __m512i vb = _mm512_loadu_si512((void const*)(b + i));
+        _mm512_storeu_si512((void*)(dest + i), _mm512_or_si512(va, vb));
+    }
+    or_scalar(dest + i, a + i, b + i, len - i);
+}
+#endif
+
+static void build_tile(unsigned char* tile, size_t len, size_t const* primes, size_t num_primes) {
+    for (size_t i = 0; i < len; ++i) {
+        tile[i] = 0;
+    }
+
+    // Strike every multiple, not just the ones from prime * prime, so the tile repeats from the start
+    for (size_t i = 0; i < num_primes; ++i) {
+        for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+            // The first multiple of the prime with residue wheel_residues[j] is prime * m for some m < 30
+            size_t m = 1;
+            while ((primes[i] * m) % WHEEL_MODULUS != wheel_residues[j]) {
+                m += 2;
+            }
+
+            for (size_t byte = primes[i] * m / WHEEL_MODULUS; byte < len; byte += primes[i]) {
+                tile[byte] |= 1 << j;
+            }
+        }
+    }
+}
+
+static void init_tiles(void) {
+    build_tile(tile_a, TILE_A_LEN, tile_a_primes, sizeof(tile_a_primes) / sizeof(tile_a_primes[0]));
+    build_tile(tile_b, TILE_B_LEN, tile_b_primes, sizeof(tile_b_primes) / sizeof(tile_b_primes[0]));
+
+    or_kernel = or_scalar;
+    kernel_isa = "scalar";
+#ifdef PRESIEVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        or_kernel = or_avx512;
+        kernel_isa = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        or_kernel = or_avx2;
+        kernel_isa = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        or_kernel = or_sse2;
+        kernel_isa = "sse2";
+    }
+#endif
+}
+
+void presieve_fill(unsigned char* segment, size_t len, size_t start_byte) {
+    pthread_once(&tiles_once, init_tiles);
+
+    size_t a = start_byte % TILE_A_LEN;
+    size_t b = start_byte % TILE_B_LEN;
+
+    // OR the tiles in, a run at a time up to whichever of them wraps around first
+    for (size_t pos = 0; pos < len;) {
+        size_t run = len - pos;
+        run = TILE_A_LEN - a < run ? TILE_A_LEN - a : run;
+        run = TILE_B_LEN - b < run ? TILE_B_LEN - b : run;
+
+        or_kernel(segment + pos, tile_a + a, tile_b + b, run);
+
+        pos += run;
+        a = a + run == TILE_A_LEN ? 0 : a + run;
+        b = b + run == TILE_B_LEN ? 0 : b + run;
+    }
+
+    // The tiles strike the pre-sieved primes as well, and they're all in the first byte along with 1
+    if (start_byte == 0 && len > 0) {
+        segment[0] = 1;
+    }
+}
+
+char const* presieve_isa(void) {
+    pthread_once(&tiles_once, init_tiles);
+    return kernel_isa;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+
+// The first prime that isn't pre-sieved; regular sieving starts here
+#define PRESIEVE_NEXT_PRIME 31
+
+/*
+ * Pre-sieving.
+ *
+ * The multiples of a prime p form a pattern in a packed composites array that repeats every p bytes, since 30 * p
+ * numbers later every residue lines up again. So the multiples of 7, 11, 13 and 17 repeat every 17017 bytes and
+ * those of 19, 23 and 29 every 12673 bytes. Both tiles are built once, and a segment is initialised by OR-ing them
+ * together at the right offsets instead of being cleared and struck by the 7 smallest sieving primes. That's the
+ * densest crossing off there is: those 7 primes account for about a third of all the bits struck below 10^9.
+ *
+ * The OR kernel uses AVX-512, AVX2 or SSE2, whichever is the widest that the CPU supports, or plain C on other
+ * architectures.
+ */
+
+/**
+ * Initialises a segment of a packed composites array with the multiples of every prime below PRESIEVE_NEXT_PRIME
+ * struck, other than the primes themselves. 1 is marked too if the segment holds it.
+ *
+ * @param segment    The segment of the packed composites array.
+ * @param len        The length of the segment in bytes.
+ * @param start_byte The index of the segment's first byte.
+ */
+void presieve_fill(unsigned char* segment, size_t len, size_t start_byte);
+
+/**
+ * Gets the name of the instruction set used by the pre-sieve's OR kernel.
+ *
+ * @return "avx512", "avx2", "sse2" or "scalar".
+ */
+char const* presieve_isa(void);
@@ -0,0 +1,221 @@
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prime_table.h"
+#include "common.h"
+
+static const size_t small_primes[] = {2, 3, 5};
+
+static size_t layout(prime_table_header_t* header, size_t limit) {
+    memset(header, 0, sizeof(*header));
+    header->version = PRIME_TABLE_VERSION;
+    header->block_bytes = PRIME_TABLE_BLOCK_BYTES;
+    header->limit = limit;
+    header->bitmap_bytes = wheel_bytes(limit);
+    header->num_blocks = (header->bitmap_bytes + PRIME_TABLE_BLOCK_BYTES - 1) / PRIME_TABLE_BLOCK_BYTES;
+    header->bitmap_offset = sizeof(prime_table_header_t);
+
+    // Keep the index 8-byte aligned
+    header->index_offset = (header->bitmap_offset + header->bitmap_bytes + 7) / 8 * 8;
+    return header->index_offset + (header->num_blocks + 1) * sizeof(uint64_t);
+}
+
+static void map_sections(prime_table_t* table) {
+    table->header = table->map;
+    table->bitmap = (unsigned char*)table->map + table->header->bitmap_offset;
+    table->index = (uint64_t*)((unsigned char*)table->map + table->header->index_offset);
+}
+
+int prime_table_create(prime_table_t* table, char const* path, size_t limit) {
+    prime_table_header_t header;
+    table->map_size = layout(&header, limit);
+
+    table->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (table->fd == -1) {
+        return -1;
+    }
+
+    if (ftruncate(table->fd, table->map_size) == -1) {
+        close(table->fd);
+        return -1;
+    }
+
+    table->map = mmap(NULL, table->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, table->fd, 0);
+    if (table->map == MAP_FAILED) {
+        close(table->fd);
+        return -1;
+    }
+
+    // Everything but the magic, which marks the table as finished
+    memcpy(table->map, &header, sizeof(header));
+    map_sections(table);
+    return 0;
+}
+
+int prime_table_finish(prime_table_t* table) {
+    prime_table_header_t* header = table->header;
+
+    // Anything at or above the limit isn't in the table
+    size_t last = header->bitmap_bytes - 1;
+    for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+        if (last * WHEEL_MODULUS + wheel_residues[j] >= header->limit) {
+            table->bitmap[last] |= 1 << j;
+        }
+    }
+
+    table->index[0] = 0;
+    for (size_t i = 0; i < header->num_blocks; ++i) {
+        size_t block_start = i * header->block_bytes;
+        size_t block_len = header->bitmap_bytes - block_start < header->block_bytes ?
+                           header->bitmap_bytes - block_start : header->block_bytes;
+        table->index[i + 1] = table->index[i] + count_unmarked(table->bitmap + block_start, block_len);
+    }
+
+    header->num_primes = table->index[header->num_blocks];
+    for (size_t i = 0; i < sizeof(small_primes) / sizeof(small_primes[0]); ++i) {
+        header->num_primes += small_primes[i] < header->limit;
+    }
+
+    // Make sure everything else is on disk before the magic says the table is complete, then sync the magic too
+    int ret = msync(table->map, table->map_size, MS_SYNC);
+    if (ret == 0) {
+        memcpy(header->magic, PRIME_TABLE_MAGIC, sizeof(header->magic));
+        ret = msync(table->map, sizeof(*header), MS_SYNC);
+    }
+
+    int error = errno;
+    munmap(table->map, table->map_size);
+    close(table->fd);
+    errno = error;
+    return ret;
+}
+
+int prime_table_open(prime_table_t* table, char const* path) {
+    table->fd = open(path, O_RDONLY);
+    if (table->fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(table->fd, &st) == -1) {
+        close(table->fd);
+        return -1;
+    }
+
+    // Check the header before trusting any of its offsets
+    prime_table_header_t header;
+    prime_table_header_t expected;
+    if (pread(table->fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, PRIME_TABLE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != PRIME_TABLE_VERSION || header.block_bytes != PRIME_TABLE_BLOCK_BYTES ||
+        layout(&expected, header.limit) != (size_t)st.st_size || header.bitmap_bytes != expected.bitmap_bytes ||
+        header.index_offset != expected.index_offset) {
+        close(table->fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    table->map_size = st.st_size;
+    table->map = mmap(NULL, table->map_size, PROT_READ, MAP_SHARED, table->fd, 0);
+    if (table->map == MAP_FAILED) {
+        close(table->fd);
+        return -1;
+    }
+
+    map_sections(table);
+    return 0;
+}
+
+void prime_table_close(prime_table_t* table) {
+    munmap(table->map, table->map_size);
+    close(table->fd);
+}
+
+int prime_table_is_prime(prime_table_t const* table, size_t x) {
+    if (x >= table->header->limit) {
+        return -1;
+    }
+
+    if (x == 2 || x == 3 || x == 5) {
+        return 1;
+    }
+
+    // Multiples of 2, 3 and 5 don't have a bit
+    size_t residue = x % WHEEL_MODULUS;
+    size_t bit = wheel_residue_ceil[residue];
+    if (wheel_residues[bit] != residue) {
+        return 0;
+    }
+
+    return !(table->bitmap[x / WHEEL_MODULUS] & (1 << bit));
+}
+
+size_t prime_table_pi(prime_table_t const* table, size_t x) {
+    prime_table_header_t const* header = table->header;
+    if (x >= header->limit) {
+        return header->num_primes;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < sizeof(small_primes) / sizeof(small_primes[0]); ++i) {
+        count += small_primes[i] <= x;
+    }
+
+    size_t byte = x / WHEEL_MODULUS;
+    size_t block_start = byte / header->block_bytes * header->block_bytes;
+    count += table->index[byte / header->block_bytes];
+    count += count_unmarked(table->bitmap + block_start, byte - block_start);
+
+    // The bits in x's own byte with residues <= x % 30
+    size_t residue = x % WHEEL_MODULUS;
+    size_t num_bits = residue + 1 < WHEEL_MODULUS ? wheel_residue_ceil[residue + 1] : WHEEL_SPOKES;
+    count += __builtin_popcount((unsigned char)~table->bitmap[byte] & ((1u << num_bits) - 1));
+
+    return count;
+}
+
+size_t prime_table_nth_prime(prime_table_t const* table, size_t k) {
+    prime_table_header_t const* header = table->header;
+    if (k == 0 || k > header->num_primes) {
+        return 0;
+    }
+
+    size_t num_small = header->num_primes - table->index[header->num_blocks];
+    if (k <= num_small) {
+        return small_primes[k - 1];
+    }
+    size_t rank = k - num_small;
+
+    // Find the last block that starts with fewer than rank primes before it
+    size_t lo = 0;
+    size_t hi = header->num_blocks;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (table->index[mid] < rank) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    rank -= table->index[lo];
+    for (size_t byte = lo * header->block_bytes; byte < header->bitmap_bytes; ++byte) {
+        unsigned char unmarked = ~table->bitmap[byte];
+        size_t in_byte = __builtin_popcount(unmarked);
+
+        if (rank <= in_byte) {
+            while (--rank) {
+                unmarked &= unmarked - 1;
+            }
+            return wheel_value(byte * WHEEL_SPOKES + __builtin_ctz(unmarked));
+        }
+        rank -= in_byte;
+    }
+
+    return 0;
+}
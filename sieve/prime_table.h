@@ -0,0 +1,113 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the engines write a binary prime table
+#define PRIME_TABLE_FILENAME "primes.tbl"
+
+#define PRIME_TABLE_MAGIC "PRIMETBL"
+#define PRIME_TABLE_VERSION 1
+
+// Bytes of packed composites (30 numbers each) covered by each entry in the block index
+#define PRIME_TABLE_BLOCK_BYTES 256
+
+/*
+ * Binary prime table.
+ *
+ * A prime table is a header, then the packed composites array for every number below the limit (see common.h),
+ * then a block index: entry i is the number of primes > 5 in the first i * block_bytes bytes of the array. Bits for
+ * numbers at or above the limit are set, so the index and the array always agree. All fields are native-endian.
+ *
+ * Opening a table maps it rather than reading it, so queries only touch the pages they need:
+ * - is_prime(x) is one bit test.
+ * - pi(x) is one index lookup and a popcount over at most one block.
+ * - nth_prime(k) is a binary search of the index and a scan of one block.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_bytes;
+    uint64_t limit;
+    uint64_t bitmap_bytes;
+    uint64_t num_blocks;
+    uint64_t num_primes; // Every prime below the limit, including 2, 3 and 5
+    uint64_t bitmap_offset;
+    uint64_t index_offset;
+} prime_table_header_t;
+
+/**
+ * A prime table mapped into memory.
+ */
+typedef struct {
+    int fd;
+    void* map;
+    size_t map_size;
+
+    prime_table_header_t* header;
+    unsigned char* bitmap; // The packed composites array
+    uint64_t* index;
+} prime_table_t;
+
+/**
+ * Creates a table file for a limit and maps it writable. The engines copy their packed composites straight into
+ * table->bitmap (which is shared with any processes forked afterwards) and then call prime_table_finish().
+ *
+ * @param table The table.
+ * @param path  The file to create. Any existing file is replaced.
+ * @param limit The number below which all primes will be stored.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int prime_table_create(prime_table_t* table, char const* path, size_t limit);
+
+/**
+ * Marks the bits past the limit, builds the block index and the header, and unmaps a table made with
+ * prime_table_create(). Everything else is synced to disk before the header's magic is stored, and the magic is then
+ * synced too, so a table that was never finished can't be opened and a finished one is durable.
+ *
+ * @param table The table, with every byte of its bitmap filled in.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int prime_table_finish(prime_table_t* table);
+
+/**
+ * Maps an existing table read-only and checks its header.
+ *
+ * @param table The table.
+ * @param path  The file to open.
+ * @return 0 on success, or -1 on error (with errno set; EINVAL if the file isn't a valid table).
+ */
+int prime_table_open(prime_table_t* table, char const* path);
+
+/**
+ * Unmaps a table opened with prime_table_open().
+ *
+ * @param table The table.
+ */
+void prime_table_close(prime_table_t* table);
+
+/**
+ * Checks whether a number is prime.
+ *
+ * @param table The table.
+ * @param x     The number.
+ * @return 1 if x is prime, 0 if it isn't, or -1 if x is at or above the table's limit.
+ */
+int prime_table_is_prime(prime_table_t const* table, size_t x);
+
+/**
+ * Counts the primes <= x.
+ *
+ * @param table The table.
+ * @param x     The number. Anything at or above the limit counts every prime in the table.
+ * @return The number of primes <= x.
+ */
+size_t prime_table_pi(prime_table_t const* table, size_t x);
+
+/**
+ * Gets the kth prime, counting 2 as the first.
+ *
+ * @param table The table.
+ * @param k     The index of the prime, starting from 1.
+ * @return The kth prime, or 0 if k is 0 or there are fewer than k primes in the table.
+ */
+size_t prime_table_nth_prime(prime_table_t const* table, size_t k);
@@ -1,221 +1,284 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <stdatomic.h>
 
 #include <unistd.h>
-#include <time.h>
 #include <fcntl.h>
-#include <sys/mman.h>
-#include <mqueue.h>
-#include <semaphore.h>
-
-#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
 
+#include "arena.h"
 #include "common.h"
+#include "ipc.h"
+#include "output.h"
+#include "presieve.h"
+#include "prime_table.h"
+#include "../perf.h"
 #include "../timing.h"
-
-// Names for the semaphore, shared memory, and message queue, respectively
-#define COMP_8005_ASSN1_SEM "/comp_8005_assn1_sem"
-#define COMP_8005_ASSN1_SHM "/comp_8005_assn1_shared_mem"
-#define COMP_8005_ASSN1_MQ "/comp_8005_assn1_shared_mq"
-
-#define SEM_NAME_BUFSIZE 256
+#include "../trace.h"
 
 typedef struct {
     size_t job_id;
-    size_t prime;
+    size_t prime; // The job's smallest unmarked number, or the size of its primes as text once sieving is over
 } job_result_msg;
 
-static atomic_int children_exited = 0;
-void sigchld_handler(int signum) {
-    if(signum == SIGCHLD) {
-        atomic_fetch_add(&children_exited, 1);
+// Writes to primes_fd as text, or into table (if it isn't NULL) as a binary table
+static void do_sieve(size_t job_id, size_t slice_start, size_t slice_size, size_t limit, int primes_fd,
+                     prime_table_t* table, ipc_ring_t* commands, ipc_ring_t* results) {
+    sieve_arena_t arena;
+    if (arena_init(&arena, slice_size, 0) == -1) {
+        perror("Error while allocating memory");
+        exit(EXIT_FAILURE);
     }
-}
+    unsigned char* composites = arena_alloc(&arena, slice_size);
 
-static void do_sieve(size_t job_id, size_t slice_start, size_t slice_size, int shared_mem, mqd_t msg_queue) {
-    char* composites = calloc(slice_size, sizeof(char));
+    // Start from the multiples of the smallest primes rather than from nothing. That's also what faults the slice
+    // in, so each job does its own in parallel.
+    presieve_fill(composites, slice_size, slice_start);
 
     // Timing info
     struct timespec start, end;
     double ms_ipc = 0.0;
     double ms_working = 0.0;
 
-    // Set up IPC
-    char sem_name[SEM_NAME_BUFSIZE];
-    snprintf(sem_name, SEM_NAME_BUFSIZE, "%s%lu", COMP_8005_ASSN1_SEM, job_id);
-    sem_t* sem = sem_open(sem_name, O_RDWR);
-
-    // Map the shared memory for reading the next prime
-    size_t* unmarked = mmap(NULL, sizeof(size_t), PROT_READ, MAP_SHARED, shared_mem, 0);
+    perf_job_t perf;
+    perf_job_open(&perf, job_id);
 
-    size_t new_min = 0;
-    do {
-        CTIME(sem_wait(sem))
+    size_t round = 0;
+    for (;; ++round) {
+        size_t prime;
+        TRACE_BEGIN(job_id, TRACE_WAIT, round);
+        PTIME("ipc", ipc_ring_pop(commands, &prime, 1))
         ms_ipc += get_delay(start, end);
+        TRACE_END(job_id, TRACE_WAIT, round);
 
-        CTIME(new_min = strike_multiples(composites, slice_size, slice_start, *unmarked))
+        // The parent sends (size_t)-1 once there are no sieving primes left
+        if (prime == (size_t)-1) {
+            break;
+        }
+
+        size_t new_min;
+        TRACE_BEGIN(job_id, TRACE_STRIKE, round);
+        PTIME
+        (
+            "working",
+            strike_multiples_wheel(composites, slice_size, slice_start, prime);
+            new_min = next_unmarked_wheel(composites, slice_size, slice_start, prime);
+        )
         ms_working += get_delay(start, end);
+        TRACE_END(job_id, TRACE_STRIKE, round);
 
         job_result_msg msg;
         msg.job_id = job_id;
         msg.prime = new_min;
 
-        CTIME(int result = mq_send(msg_queue, (char*)&msg, sizeof(msg), 0))
+        TRACE_BEGIN(job_id, TRACE_PUBLISH, round);
+        PTIME("ipc", ipc_ring_push(results, &msg, 1))
         ms_ipc += get_delay(start, end);
+        TRACE_END(job_id, TRACE_PUBLISH, round);
+    }
 
-        if (result == -1) {
-            perror("Error sending message");
-            exit(EXIT_FAILURE);
-        }
-    } while(new_min != (size_t)-1);
-
-    // Create a file and print all of the primes to it
-    CTIME
-    (
-        char primes_filename[32];
-        snprintf(primes_filename, 32, "proc%lu", job_id);
-        FILE* out = fopen(primes_filename, "w");
-        for (size_t i = 0; i < slice_size; ++i) {
-            if (!composites[i]) {
-                fprintf(out, "%lu\n", i + slice_start);
+    size_t offset = 0;
+    TRACE_BEGIN(job_id, TRACE_OUTPUT, round);
+    if (table) {
+        // The table's mapping is shared with the parent, so the slice can go straight into it
+        PTIME("working", memcpy(table->bitmap + slice_start, composites, slice_size))
+        ms_working += get_delay(start, end);
+    } else {
+        // Tell the parent how much text our primes make, and get back where in the file they go
+        job_result_msg msg;
+        msg.job_id = job_id;
+        PTIME("working", msg.prime = primes_text_size_wheel(composites, slice_size, slice_start, limit))
+        ms_working += get_delay(start, end);
+
+        PTIME
+        (
+            "ipc",
+            ipc_ring_push(results, &msg, 1);
+            ipc_ring_pop(commands, &offset, 1);
+        )
+        ms_ipc += get_delay(start, end);
+
+        PTIME
+        (
+            "working",
+            if (write_primes_wheel(primes_fd, offset, composites, slice_size, slice_start, limit) == -1) {
+                perror("Error writing primes");
+                exit(EXIT_FAILURE);
             }
-        }
-        fclose(out);
-    )
-    ms_working += get_delay(start, end);
-
-    char timing_filename[32];
-    snprintf(timing_filename, 32, "proc%lu.time", job_id);
-    FILE* timing = fopen(timing_filename, "a");
-    fprintf(timing, "time doing IPC (ms): %.4lf\n", ms_ipc);
-    fprintf(timing, "time working (ms): %.4lf\n", ms_working);
-    fclose(timing);
-
-    printf("Job %lu finished. Primes written to %s. Timing info written to %s.\n", job_id, primes_filename, timing_filename);
-
-    sem_close(sem);
-    munmap(unmarked, sizeof(size_t));
-    free(composites);
-    exit(EXIT_SUCCESS);
-}
+        )
+        ms_working += get_delay(start, end);
+    }
+    TRACE_END(job_id, TRACE_OUTPUT, round);
+
+    perf_job_close(&perf);
+
+    // With counters on, everything goes in the one report instead
+    char timing_filename[32] = PERF_REPORT_FILENAME;
+    if (!perf_session_active()) {
+        snprintf(timing_filename, 32, "proc%lu.time", job_id);
+        FILE* timing = fopen(timing_filename, "a");
+        fprintf(timing, "time doing IPC (ms): %.4lf\n", ms_ipc);
+        fprintf(timing, "time working (ms): %.4lf\n", ms_working);
+        fclose(timing);
+    }
 
-void concurrent_sieve_process(size_t limit, size_t num_jobs) {
+    if (table) {
+        printf("Job %lu finished. Slice copied to %s. Timing info written to %s.\n", job_id, PRIME_TABLE_FILENAME,
+               timing_filename);
+    } else {
+        printf("Job %lu finished. Primes written to %s at offset %lu. Timing info written to %s.\n", job_id,
+               PRIMES_FILENAME, offset, timing_filename);
+    }
 
-    // Keep track of how many children have actually exited
-    signal(SIGCHLD, sigchld_handler);
+    arena_destroy(&arena);
+    exit(EXIT_SUCCESS);
+}
 
-    // Create a message queue to send back the minimum prime from each process
-    struct mq_attr attr = {0};
-    attr.mq_flags = 0;
-    attr.mq_maxmsg = 10;
-    attr.mq_msgsize = sizeof(job_result_msg);
-    attr.mq_curmsgs = 0;
+void concurrent_sieve_process(size_t limit, size_t num_jobs, output_format_t format) {
+    struct timespec start, end;
 
-    mqd_t msg_queue = mq_open(COMP_8005_ASSN1_MQ, O_CREAT | O_RDWR, 0666, &attr);
-    if (msg_queue == -1) {
-        perror("Error opening message queue");
+    // Every job sends its minimum back through one shared ring, and gets each new prime through a ring of its own.
+    // The rings are mapped before forking, so the children share them.
+    ipc_ring_t* results = ipc_ring_create(num_jobs, sizeof(job_result_msg), 1);
+    ipc_ring_t** commands = malloc(sizeof(ipc_ring_t*) * num_jobs);
+    if (!results || !commands) {
+        perror("Error creating IPC rings");
         exit(EXIT_FAILURE);
     }
 
-    // Initialise shared memory to hold the new minimum prime
-    int shared_mem = shm_open(COMP_8005_ASSN1_SHM, O_CREAT | O_RDWR, 0666);
-    ftruncate(shared_mem, sizeof(size_t));
-    size_t* next_prime;
+    for (size_t i = 0; i < num_jobs; ++i) {
+        commands[i] = ipc_ring_create(1, sizeof(size_t), 0);
+        if (!commands[i]) {
+            perror("Error creating IPC rings");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Create a semaphore so that the other processes can wait for the new unmarked prime
-    sem_t** semaphores = malloc(sizeof(sem_t*) * num_jobs);
+    // The children inherit the file (or the table's mapping) and each write their primes into their own part of it
+    int primes_fd = -1;
+    prime_table_t table;
+    if (format == OUTPUT_TABLE) {
+        if (prime_table_create(&table, PRIME_TABLE_FILENAME, limit) == -1) {
+            perror("Error while creating " PRIME_TABLE_FILENAME);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        primes_fd = open(PRIMES_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (primes_fd == -1) {
+            perror("Error while opening " PRIMES_FILENAME);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    size_t start = 3;
     size_t extra;
     size_t slice_size;
 
     get_slices(num_jobs, limit, &slice_size, &extra);
 
-    for (size_t i = 0; i < num_jobs; ++i) {
-        char sem_name[SEM_NAME_BUFSIZE];
-        snprintf(sem_name, SEM_NAME_BUFSIZE, "%s%lu", COMP_8005_ASSN1_SEM, i);
+    // Output from before the fork would otherwise be flushed by every child as well
+    fflush(stdout);
 
-        semaphores[i] = sem_open(sem_name, O_CREAT | O_RDWR, 0666, 0);
+    for (size_t i = 0; i < num_jobs; ++i) {
         if (!fork()) {
-            size_t slice_start = start + (i * slice_size);
+            size_t slice_start = i * slice_size;
             size_t cur_slice_size = slice_size + (i == num_jobs - 1 ? extra : 0); // assign any extra to the last job
-            do_sieve(i, slice_start, cur_slice_size, shared_mem, msg_queue);
+            do_sieve(i, slice_start, cur_slice_size, limit, primes_fd, format == OUTPUT_TABLE ? &table : NULL,
+                     commands[i], results);
         }
     }
 
-    next_prime = mmap(NULL, sizeof(size_t), PROT_READ | PROT_WRITE, MAP_SHARED, shared_mem, 0);
-    if (next_prime == MAP_FAILED) {
-        perror("Failed to map memory:");
+    job_result_msg* job_results = malloc(sizeof(job_result_msg) * num_jobs);
+    if (!job_results) {
+        perror("Error while allocating messages");
         exit(EXIT_FAILURE);
     }
 
-    size_t remaining_jobs = num_jobs;
-    size_t new_min = 2;
-    while (remaining_jobs) {
-        *next_prime = new_min;
-
+    size_t new_min = PRESIEVE_NEXT_PRIME; // Anything smaller is taken care of by the packed layout and the pre-sieve
+    for (size_t round = 0;; ++round) {
         // Wake up the job processes
+        TRACE_BEGIN(num_jobs, TRACE_PUBLISH, round);
         for(size_t i = 0; i < num_jobs; ++i) {
-            if (semaphores[i]) {
-                int result = sem_post(semaphores[i]);
-                if (result == -1) {
-                    perror("Error while posting to semaphore");
-                    exit(1);
-                }
-            }
+            ipc_ring_push(commands[i], &new_min, 1);
+        }
+        TRACE_END(num_jobs, TRACE_PUBLISH, round);
+
+        if (new_min == (size_t)-1) {
+            break;
         }
 
         new_min = (size_t)-1;
         size_t msg_count = 0;
-        size_t finished_jobs = 0;
 
-        // Read the result messages from each job process
-        while(msg_count < remaining_jobs) {
+        // Read the result messages from each job process, as many at a time as have arrived
+        TRACE_BEGIN(num_jobs, TRACE_WAIT, round);
+        while(msg_count < num_jobs) {
+            size_t received = ipc_ring_pop(results, job_results, num_jobs - msg_count);
 
-            // Apparently the message buffer needs to be bigger than max message size, so copy it into a buffer
-            // that's one byte bigger
-            char buf[sizeof(job_result_msg) + 1];
-            job_result_msg job_result;
-
-            ssize_t result = mq_receive(msg_queue, buf, sizeof(job_result), NULL);
-            if (result == -1) {
-                perror("Error while receiving message");
-                exit(1);
+            for (size_t i = 0; i < received; ++i) {
+                if (job_results[i].prime < new_min) {
+                    new_min = job_results[i].prime;
+                }
             }
-            memcpy(&job_result, buf, sizeof(job_result_msg));
-
-            ++msg_count;
-            if (job_result.prime == (size_t)-1) {
-
-                // This job has finished - close its semaphore
-                char sem_name[SEM_NAME_BUFSIZE];
-                snprintf(sem_name, SEM_NAME_BUFSIZE, "%s%lu", COMP_8005_ASSN1_SEM, job_result.job_id);
+            msg_count += received;
+        }
+        TRACE_END(num_jobs, TRACE_WAIT, round);
 
-                sem_close(semaphores[job_result.job_id]);
-                sem_unlink(sem_name);
-                semaphores[job_result.job_id] = NULL;
+        // Once the smallest unmarked number is past the square root of the limit, everything left is prime
+        if (new_min != (size_t)-1 && new_min * new_min >= limit) {
+            new_min = (size_t)-1;
+        }
+    }
 
-                ++finished_jobs;
+    // Collect the size of every job's primes, then send each job the total size of the jobs before it
+    size_t* text_sizes = malloc(sizeof(size_t) * num_jobs);
+    if (!text_sizes) {
+        perror("Error while allocating messages");
+        exit(EXIT_FAILURE);
+    }
 
-            } else if (job_result.prime < new_min) {
-                new_min = job_result.prime;
+    if (format == OUTPUT_TEXT) {
+        for (size_t msg_count = 0; msg_count < num_jobs;) {
+            size_t received = ipc_ring_pop(results, job_results, num_jobs - msg_count);
+            for (size_t i = 0; i < received; ++i) {
+                text_sizes[job_results[i].job_id] = job_results[i].prime;
             }
+            msg_count += received;
         }
 
-        remaining_jobs -= finished_jobs;
+        size_t offset = 0;
+        for (size_t i = 0; i < num_jobs; ++i) {
+            ipc_ring_push(commands[i], &offset, 1);
+            offset += text_sizes[i];
+        }
     }
 
     // Wait for all children to finish what they're doing before ending the process
-    while(atomic_load(&children_exited) != num_jobs);
+    // SIGCHLD isn't queued, so counting signals can miss children that exit at the same time; reap them instead
+    for (size_t i = 0; i < num_jobs; ++i) {
+        wait(NULL);
+    }
 
     // Clean up
-    munmap(next_prime, 0);
-    shm_unlink(COMP_8005_ASSN1_SHM);
-
-    mq_close(msg_queue);
-    mq_unlink(COMP_8005_ASSN1_MQ);
+    for (size_t i = 0; i < num_jobs; ++i) {
+        ipc_ring_destroy(commands[i]);
+    }
+    ipc_ring_destroy(results);
+
+    if (format == OUTPUT_TABLE) {
+        CTIME
+        (
+            if (prime_table_finish(&table) == -1) {
+                perror("Error writing " PRIME_TABLE_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+        )
+        printf("Prime table written to %s in %.4fms.\n", PRIME_TABLE_FILENAME, get_delay(start, end));
+    } else {
+        close(primes_fd);
+    }
 
-    free(semaphores);
+    free(text_sizes);
+    free(job_results);
+    free(commands);
 }
\ No newline at end of file
@@ -1,3 +1,6 @@
 #pragma once
+#include <stddef.h>
 
-void concurrent_sieve_process(size_t limit, size_t num_jobs);
+#include "output.h"
+
+void concurrent_sieve_process(size_t limit, size_t num_jobs, output_format_t format);
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#include "scheduler.h"
+
+#define RANGE_BEGIN(range) ((size_t)((range) & 0xffffffffu))
+#define RANGE_END(range) ((size_t)((range) >> 32))
+#define MAKE_RANGE(begin, end) (((uint64_t)(end) << 32) | (uint64_t)(begin))
+
+int scheduler_init(segment_scheduler_t* sched, size_t num_segments, size_t num_workers) {
+    // Each worker's range is packed into one word as two 32-bit segment numbers
+    if (num_segments > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sched->queues = aligned_alloc(64, sizeof(worker_queue_t) * num_workers);
+    if (!sched->queues) {
+        return -1;
+    }
+
+    sched->num_workers = num_workers;
+    sched->num_segments = num_segments;
+
+    for (size_t i = 0; i < num_workers; ++i) {
+        sched->queues[i].sieved = 0;
+        sched->queues[i].stolen = 0;
+    }
+    scheduler_reset(sched);
+
+    return 0;
+}
+
+void scheduler_reset(segment_scheduler_t* sched) {
+    // Spread the leftover segments over the first few workers rather than giving them all to the last one
+    size_t share = sched->num_segments / sched->num_workers;
+    size_t extra = sched->num_segments % sched->num_workers;
+
+    size_t begin = 0;
+    for (size_t i = 0; i < sched->num_workers; ++i) {
+        size_t end = begin + share + (i < extra ? 1 : 0);
+        atomic_store(&sched->queues[i].range, MAKE_RANGE(begin, end));
+        begin = end;
+    }
+}
+
+int scheduler_next(segment_scheduler_t* sched, size_t worker, size_t* segment) {
+    worker_queue_t* own = &sched->queues[worker];
+
+    // Take from the front of our own range
+    uint64_t range = atomic_load(&own->range);
+    while (RANGE_BEGIN(range) < RANGE_END(range)) {
+        if (atomic_compare_exchange_weak(&own->range, &range, MAKE_RANGE(RANGE_BEGIN(range) + 1, RANGE_END(range)))) {
+            *segment = RANGE_BEGIN(range);
+            ++own->sieved;
+            return 1;
+        }
+    }
+
+    // Our range is empty, so steal the back half of someone else's
+    for (size_t i = 1; i < sched->num_workers; ++i) {
+        worker_queue_t* victim = &sched->queues[(worker + i) % sched->num_workers];
+
+        range = atomic_load(&victim->range);
+        while (RANGE_BEGIN(range) < RANGE_END(range)) {
+            size_t begin = RANGE_BEGIN(range);
+            size_t end = RANGE_END(range);
+            size_t split = end - (end - begin + 1) / 2;
+
+            if (atomic_compare_exchange_weak(&victim->range, &range, MAKE_RANGE(begin, split))) {
+                // Keep the first stolen segment and put the rest in our own (empty) range
+                atomic_store(&own->range, MAKE_RANGE(split + 1, end));
+                *segment = split;
+                ++own->sieved;
+                own->stolen += end - split;
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void scheduler_destroy(segment_scheduler_t* sched) {
+    free(sched->queues);
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * One worker's share of the segments: a contiguous range of segment indices that the worker takes from the front
+ * of, and that other workers steal from the back of once their own ranges run dry.
+ */
+typedef struct {
+    // The range [begin, end) packed into one word (begin in the low 32 bits, end in the high 32 bits), so that the
+    // owner and thieves can both claim segments with a single compare-and-swap
+    _Atomic uint64_t range;
+
+    // Stats, only written by the owner
+    size_t sieved; // Segments this worker sieved
+    size_t stolen; // Segments this worker stole from other workers' ranges
+
+    // Keep each worker's range on its own cache line
+    char padding[64 - sizeof(uint64_t) - 2 * sizeof(size_t)];
+} worker_queue_t;
+
+/**
+ * A work-stealing scheduler that hands out segment indices in [0, num_segments) to a fixed set of workers.
+ */
+typedef struct {
+    worker_queue_t* queues;
+    size_t num_workers;
+    size_t num_segments;
+} segment_scheduler_t;
+
+/**
+ * Initialises a scheduler and deals the segments out evenly between the workers.
+ *
+ * @param sched        The scheduler.
+ * @param num_segments The number of segments. Must be < 2^32.
+ * @param num_workers  The number of workers.
+ * @return 0 on success, or -1 on error (with errno set; EINVAL if there are 2^32 or more segments).
+ */
+int scheduler_init(segment_scheduler_t* sched, size_t num_segments, size_t num_workers);
+
+/**
+ * Deals the segments out evenly again so they can all be handed out for another round. Must only be called while
+ * no worker is calling scheduler_next().
+ *
+ * @param sched The scheduler.
+ */
+void scheduler_reset(segment_scheduler_t* sched);
+
+/**
+ * Gets the next segment for a worker, from its own range if possible and otherwise by stealing half of the
+ * remaining range of another worker.
+ *
+ * @param sched   The scheduler.
+ * @param worker  The index of the worker asking for a segment.
+ * @param segment Set to the index of the segment to process.
+ * @return 1 if a segment was handed out, or 0 if every segment in this round has been handed out.
+ */
+int scheduler_next(segment_scheduler_t* sched, size_t worker, size_t* segment);
+
+/**
+ * Frees the scheduler's queues.
+ *
+ * @param sched The scheduler.
+ */
+void scheduler_destroy(segment_scheduler_t* sched);
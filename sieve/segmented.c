@@ -0,0 +1,328 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "segmented.h"
+#include "bucket.h"
+#include "checkpoint.h"
+#include "common.h"
+#include "output.h"
+#include "pipeline.h"
+#include "prime_table.h"
+#include "../perf.h"
+#include "../timing.h"
+#include "../trace.h"
+
+#define FALLBACK_SEGMENT_SIZE (32 * 1024)
+#define L1D_CACHE_SIZE_FILE "/sys/devices/system/cpu/cpu0/cache/index0/size"
+
+// Segments per chunk handed out to a job; the sieving primes are re-initialised at the start of each chunk
+#define CHUNK_SEGMENTS 8
+
+// The most segments per chunk when there are large primes, which bounds the size of each output buffer
+#define MAX_CHUNK_SEGMENTS 64
+
+// Output buffers per job, so a job can sieve its next chunk while its last one is being written
+#define BUFFERS_PER_JOB 2
+
+typedef struct {
+    size_t job_id;
+    size_t segment_size;
+    size_t chunk_segments;
+
+    sieve_range_t const* range; // The range and its sieving primes, shared between all jobs
+
+    output_pipeline_t* pipe; // Hands out chunks and writes their primes in order
+    unsigned char* table; // The binary table's packed composites array to sieve in place, or NULL for text output
+    checkpoint_t* checkpoint; // Copy chunks from and sieve them into this, or NULL if there's no cache
+} job_params_t;
+
+size_t default_segment_size(void) {
+    long size = -1;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+#endif
+
+    // Not every libc knows the cache sizes, so fall back to sysfs (index0 is the L1 data cache)
+    if (size <= 0) {
+        FILE* f = fopen(L1D_CACHE_SIZE_FILE, "r");
+        if (f) {
+            char unit = 0;
+            if (fscanf(f, "%ld%c", &size, &unit) < 1) {
+                size = -1;
+            } else if (unit == 'K') {
+                size *= 1024;
+            } else if (unit == 'M') {
+                size *= 1024 * 1024;
+            }
+            fclose(f);
+        }
+    }
+
+    return size > 0 ? (size_t)size : FALLBACK_SEGMENT_SIZE;
+}
+
+static void* do_sieve(void* job_params) {
+    job_params_t* params = (job_params_t*)job_params;
+
+    struct timespec start, end;
+    double ms_waiting = 0.0;
+    double ms_working = 0.0;
+    size_t chunks = 0;
+
+    perf_job_t perf;
+    perf_job_open(&perf, params->job_id);
+
+    unsigned char* segment = malloc(params->segment_size);
+    sieve_range_t const* range = params->range;
+    sieving_prime_t* sieving = malloc(sizeof(sieving_prime_t) * (range->num_small ? range->num_small : 1));
+    if (!segment || !sieving) {
+        perror("Error while allocating segment:");
+        exit(EXIT_FAILURE);
+    }
+
+    // The large primes only take 8 bytes each, and only while their next multiple is in the current chunk
+    size_t num_large = range->num_primes - range->num_small;
+    bucket_sieve_t buckets;
+    if (num_large > 0 && bucket_sieve_init(&buckets, params->segment_size, params->chunk_segments) == -1) {
+        perror("Error while allocating buckets:");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t chunk_size = params->segment_size * params->chunk_segments;
+    while (1) {
+        // Waits for a free output buffer if the writer has fallen behind
+        TRACE_BEGIN(params->job_id, TRACE_WAIT, chunks);
+        PTIME("waiting for buffers", pipeline_buffer_t* buf = pipeline_acquire(params->pipe))
+        ms_waiting += get_delay(start, end);
+        TRACE_END(params->job_id, TRACE_WAIT, chunks);
+
+        if (!buf) {
+            break;
+        }
+
+        PTIME
+        (
+            "working",
+            TRACE_BEGIN(params->job_id, TRACE_STRIKE, chunks);
+            size_t chunk_start = range->start_byte + buf->chunk * chunk_size;
+            size_t chunk_end = range->end_byte - chunk_start < chunk_size ? range->end_byte : chunk_start + chunk_size;
+
+            size_t num_segments = (chunk_end - chunk_start + params->segment_size - 1) / params->segment_size;
+
+            // Chunks the checkpoint already has are copied out of it instead of being sieved
+            checkpoint_t* checkpoint = params->checkpoint;
+            int cached = checkpoint && checkpoint_has(checkpoint, chunk_end);
+            if (!cached) {
+                sieve_range_seek(range, sieving, chunk_start);
+                if (num_large > 0 && bucket_sieve_seed(&buckets, range->primes + range->num_small, num_large,
+                                                       chunk_start, num_segments) == -1) {
+                    perror("Error while filling buckets:");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            for (size_t i = 0; i < num_segments; ++i) {
+                size_t seg_start = chunk_start + i * params->segment_size;
+                size_t seg_len = chunk_end - seg_start < params->segment_size ? chunk_end - seg_start : params->segment_size;
+                unsigned char* dest = params->table ? params->table + seg_start : segment;
+
+                if (cached) {
+                    if (params->table) {
+                        memcpy(dest, checkpoint->bitmap + seg_start, seg_len);
+                    } else {
+                        dest = checkpoint->bitmap + seg_start;
+                    }
+                } else {
+                    sieve_range_segment(range, sieving, dest, seg_start, seg_len);
+                    if (num_large > 0 && bucket_sieve_segment(&buckets, dest, seg_len, i) == -1) {
+                        perror("Error while sieving buckets:");
+                        exit(EXIT_FAILURE);
+                    }
+
+                    if (checkpoint) {
+                        memcpy(checkpoint->bitmap + seg_start, dest, seg_len);
+                    }
+                }
+
+                if (params->table) {
+                    continue;
+                }
+
+                if (format_primes_wheel(&buf->text, dest, seg_len, seg_start, range->lo, range->hi) == -1) {
+                    perror("Error while formatting primes:");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            TRACE_END(params->job_id, TRACE_STRIKE, chunks);
+
+            TRACE_BEGIN(params->job_id, TRACE_PUBLISH, chunks);
+            size_t chunk = buf->chunk;
+            pipeline_submit(params->pipe, buf);
+            if (checkpoint && checkpoint_chunk_done(checkpoint, chunk) == -1) {
+                perror("Error while committing checkpoint:");
+                exit(EXIT_FAILURE);
+            }
+            TRACE_END(params->job_id, TRACE_PUBLISH, chunks);
+        )
+        ms_working += get_delay(start, end);
+        ++chunks;
+    }
+
+    perf_job_close(&perf);
+
+    // With counters on, everything goes in the one report instead
+    char timing_filename[32] = PERF_REPORT_FILENAME;
+    if (!perf_session_active()) {
+        snprintf(timing_filename, 32, "seg%lu.time", params->job_id);
+        FILE* timing = fopen(timing_filename, "a");
+        fprintf(timing, "time waiting for buffers (ms): %.4lf\n", ms_waiting);
+        fprintf(timing, "time working (ms): %.4lf\n", ms_working);
+        fprintf(timing, "chunks sieved: %lu\n", chunks);
+        fclose(timing);
+    }
+
+    printf("Job %lu finished after %lu chunks. Timing info written to %s.\n", params->job_id, chunks, timing_filename);
+
+    if (num_large > 0) {
+        bucket_sieve_free(&buckets);
+    }
+    free(sieving);
+    free(segment);
+    return NULL;
+}
+
+int segmented_range_init(sieve_range_t* range, size_t lo, size_t hi, size_t segment_size) {
+    // Primes bigger than a segment go through the bucket sieve
+    size_t max_small = segment_size <= BUCKET_MAX_SEGMENT_SIZE ? segment_size : (size_t)-1;
+    return sieve_range_init(range, lo, hi, max_small);
+}
+
+size_t segmented_chunk_segments(sieve_range_t const* range, size_t segment_size) {
+    // Every chunk refills the buckets, so with large primes a chunk should reach past the biggest one's stride of
+    // prime bytes for the refill to pay for itself
+    size_t chunk_segments = CHUNK_SEGMENTS;
+    if (range->num_small < range->num_primes) {
+        chunk_segments = range->primes[range->num_primes - 1] / segment_size + 1;
+        chunk_segments = chunk_segments < CHUNK_SEGMENTS ? CHUNK_SEGMENTS : chunk_segments;
+        chunk_segments = chunk_segments > MAX_CHUNK_SEGMENTS ? MAX_CHUNK_SEGMENTS : chunk_segments;
+    }
+    return chunk_segments;
+}
+
+void concurrent_sieve_segmented(size_t lo, size_t hi, size_t num_jobs, size_t segment_size, output_format_t format,
+                                char const* checkpoint) {
+    struct timespec start, end;
+
+    // Find the sieving primes serially; they're shared by every job
+    sieve_range_t range;
+    CTIME(int ret = segmented_range_init(&range, lo, hi, segment_size))
+    if (ret == -1) {
+        perror("Error while finding sieving primes:");
+        exit(EXIT_FAILURE);
+    }
+    printf("Found %lu sieving primes (%lu large) in %.4fms.\n", range.num_primes, range.num_primes - range.num_small,
+           get_delay(start, end));
+
+    size_t chunk_segments = segmented_chunk_segments(&range, segment_size);
+
+    job_params_t* params = malloc(sizeof(job_params_t) * num_jobs);
+    pthread_t* threads = malloc(sizeof(pthread_t) * num_jobs);
+    if (!params || !threads) {
+        perror("Error while allocating job parameters:");
+        sieve_range_free(&range);
+        exit(EXIT_FAILURE);
+    }
+
+    // The jobs claim chunks in order and the pipeline writes each one out while later ones are still being sieved.
+    // A binary table is sieved straight into its mapping, so its buffers are just recycled.
+    size_t len = range.end_byte - range.start_byte;
+    size_t chunk_size = segment_size * chunk_segments;
+
+    int primes_fd = -1;
+    prime_table_t table;
+    if (format == OUTPUT_TABLE) {
+        if (prime_table_create(&table, PRIME_TABLE_FILENAME, hi) == -1) {
+            perror("Error while creating " PRIME_TABLE_FILENAME);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        primes_fd = open(PRIMES_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (primes_fd == -1) {
+            perror("Error while opening " PRIMES_FILENAME);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t num_chunks = (len + chunk_size - 1) / chunk_size;
+    output_pipeline_t pipe;
+    if (pipeline_init(&pipe, primes_fd, num_chunks, num_jobs * BUFFERS_PER_JOB) == -1) {
+        perror("Error while setting up output pipeline:");
+        exit(EXIT_FAILURE);
+    }
+
+    checkpoint_t cp;
+    if (checkpoint) {
+        if (checkpoint_open(&cp, checkpoint, hi) == -1 || checkpoint_track(&cp, chunk_size, num_chunks) == -1) {
+            perror("Error while opening checkpoint:");
+            exit(EXIT_FAILURE);
+        }
+
+        if (cp.discarded) {
+            printf("%s wasn't a valid checkpoint, so it's been started again.\n", checkpoint);
+        }
+        printf("Checkpoint %s has every number below %lu.\n", checkpoint, cp.cached_bytes * WHEEL_MODULUS);
+    }
+
+    for (size_t i = 0; i < num_jobs; ++i) {
+        params[i].job_id = i;
+        params[i].segment_size = segment_size;
+        params[i].chunk_segments = chunk_segments;
+        params[i].range = &range;
+        params[i].pipe = &pipe;
+        params[i].table = format == OUTPUT_TABLE ? table.bitmap : NULL;
+        params[i].checkpoint = checkpoint ? &cp : NULL;
+
+        pthread_create(&threads[i], NULL, do_sieve, &params[i]);
+    }
+
+    for (size_t i = 0; i < num_jobs; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (checkpoint) {
+        CTIME
+        (
+            if (checkpoint_close(&cp) == -1) {
+                perror("Error while committing checkpoint:");
+                exit(EXIT_FAILURE);
+            }
+        )
+        printf("Checkpoint committed in %.4fms.\n", get_delay(start, end));
+    }
+
+    // Wait for the last chunks to hit the file
+    CTIME(pipeline_finish(&pipe))
+    if (format == OUTPUT_TABLE) {
+        CTIME
+        (
+            if (prime_table_finish(&table) == -1) {
+                perror("Error writing " PRIME_TABLE_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+        )
+        printf("Prime table written to %s in %.4fms.\n", PRIME_TABLE_FILENAME, get_delay(start, end));
+    } else {
+        printf("Primes written to %s in %lu writes (%s); waited %.4fms for the last ones.\n", PRIMES_FILENAME,
+               pipe.writes, pipe.uses_io_uring ? "io_uring" : "writer thread", get_delay(start, end));
+        close(primes_fd);
+    }
+
+    free(threads);
+    free(params);
+    sieve_range_free(&range);
+}
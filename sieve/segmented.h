@@ -0,0 +1,58 @@
+#pragma once
+#include <stddef.h>
+
+#include "common.h"
+#include "output.h"
+
+/**
+ * Gets the default segment size for the segmented sieve: the size of the L1 data cache, or 32KiB if it can't be
+ * detected.
+ *
+ * @return The default segment size in bytes.
+ */
+size_t default_segment_size(void);
+
+/**
+ * Sets up a range the way the segmented sieve splits it: primes bigger than a segment are left to the bucket sieve.
+ *
+ * @param range        The range.
+ * @param lo           The first number in the range.
+ * @param hi           The number below which all primes will be calculated.
+ * @param segment_size The size of each segment in bytes.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int segmented_range_init(sieve_range_t* range, size_t lo, size_t hi, size_t segment_size);
+
+/**
+ * Gets the number of segments in each chunk that the segmented sieve hands out. It's more than the default when
+ * there are large primes, so that refilling the buckets for each chunk pays for itself.
+ *
+ * @param range        The range, set up with segmented_range_init().
+ * @param segment_size The size of each segment in bytes.
+ * @return The number of segments per chunk.
+ */
+size_t segmented_chunk_segments(sieve_range_t const* range, size_t segment_size);
+
+/**
+ * Runs a cache-blocked segmented sieve over [lo, hi) using threads.
+ *
+ * The sieving primes are found serially first. Jobs then claim chunks of segments in order and sieve them one
+ * segment at a time, applying every sieving prime to a segment before moving on to the next one, so the working
+ * set stays in cache. Primes bigger than a segment go through a per-job bucket sieve, so a segment only costs
+ * something for the large primes that actually hit it. Each chunk's primes are handed to an output pipeline that
+ * writes them in order while later chunks are still being sieved.
+ *
+ * Nothing is allocated in proportion to the range: memory use is the sieving primes (O(sqrt(hi))) plus each job's
+ * segment and output buffers.
+ *
+ * @param lo           The smallest number to sieve. Must be 0 for a binary prime table.
+ * @param hi           The number below which all primes will be calculated. Must be <= SIEVE_RANGE_MAX.
+ * @param num_jobs     The number of jobs (threads) to use.
+ * @param segment_size The size of each segment in bytes of the packed composites array.
+ * @param format       Whether to write the primes as text or as a binary prime table. A table is sieved in place,
+ *                     so nothing goes through the output pipeline.
+ * @param checkpoint   A checkpoint cache file (see checkpoint.h) to copy the chunks it already has from and to add
+ *                     the rest to, or NULL for none. Only supported when lo is 0.
+ */
+void concurrent_sieve_segmented(size_t lo, size_t hi, size_t num_jobs, size_t segment_size, output_format_t format,
+                                char const* checkpoint);
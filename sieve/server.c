@@ -0,0 +1,824 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "common.h"
+#include "pi.h"
+
+#define NO_SLOT ((size_t)-1)
+#define NO_SEGMENT ((size_t)-1)
+
+#define LISTEN_BACKLOG 128
+
+// One cached segment
+typedef struct {
+    size_t segment; // The segment's number, or NO_SEGMENT if the slot is empty
+    size_t next; // The next slot in the same hash chain, or NO_SLOT
+    size_t pins; // Workers reading the segment; it can't be evicted until they're done
+    int referenced; // Set on every hit, and cleared as the clock hand passes
+    unsigned char* data;
+} cache_slot_t;
+
+// The segment cache: a hash table of slots, with CLOCK eviction. Everything is guarded by the lock, but only the
+// bookkeeping happens under it; sieving and reading segments don't.
+typedef struct {
+    pthread_mutex_t lock;
+    cache_slot_t* slots;
+    size_t num_slots;
+    size_t* buckets; // The first slot in each hash chain
+    size_t num_buckets; // A power of two
+    size_t hand;
+    unsigned char* memory;
+
+    size_t hits;
+    size_t misses;
+} segment_cache_t;
+
+// A worker's own buffers
+typedef struct {
+    server_t* server;
+    pthread_t thread;
+
+    // The segment a miss is sieved into, and the sieving primes, which are left where the last segment ended so
+    // the next one along doesn't need them found again
+    unsigned char* segment;
+    sieving_prime_t* sieving;
+    size_t num_sieving; // How many of the sieving primes are set up
+    size_t next_segment; // The segment they're set up for
+
+    server_query_t* queries;
+    unsigned char* response;
+    size_t response_len;
+    size_t response_cap;
+} worker_t;
+
+struct server {
+    char* socket_path;
+    size_t limit;
+
+    size_t* primes; // The sieving primes for the limit
+    size_t num_primes;
+
+    segment_cache_t cache;
+
+    int listen_fd;
+    int stop_fd; // An eventfd that's written to stop the workers; it stays readable, so it wakes all of them
+    int epoll_fd;
+
+    worker_t* workers;
+    size_t num_workers;
+
+    // The open connections, so the ones still open can be closed when the server stops
+    pthread_mutex_t connections_lock;
+    int* connection_fds;
+    size_t num_connections;
+    size_t connections_cap;
+
+    atomic_size_t connections;
+    atomic_size_t requests;
+    atomic_size_t queries;
+};
+
+static size_t hash_segment(size_t segment, size_t num_buckets) {
+    return (segment * 0x9e3779b97f4a7c15ull >> 32) & (num_buckets - 1);
+}
+
+static int cache_init(segment_cache_t* cache, size_t cache_bytes) {
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+
+    cache->num_slots = cache_bytes / SERVER_SEGMENT_BYTES;
+    if (cache->num_slots == 0) {
+        return 0;
+    }
+
+    cache->num_buckets = 1;
+    while (cache->num_buckets < 2 * cache->num_slots) {
+        cache->num_buckets *= 2;
+    }
+
+    // Anything allocated is left for cache_free() if the rest isn't
+    cache->slots = malloc(sizeof(cache_slot_t) * cache->num_slots);
+    cache->buckets = malloc(sizeof(size_t) * cache->num_buckets);
+    cache->memory = malloc(cache->num_slots * SERVER_SEGMENT_BYTES);
+    if (!cache->slots || !cache->buckets || !cache->memory) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < cache->num_slots; ++i) {
+        cache->slots[i] = (cache_slot_t){NO_SEGMENT, NO_SLOT, 0, 0, cache->memory + i * SERVER_SEGMENT_BYTES};
+    }
+    for (size_t i = 0; i < cache->num_buckets; ++i) {
+        cache->buckets[i] = NO_SLOT;
+    }
+    return 0;
+}
+
+static void cache_free(segment_cache_t* cache) {
+    free(cache->slots);
+    free(cache->buckets);
+    free(cache->memory);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+// Finds a segment's slot, with the lock held
+static size_t cache_lookup(segment_cache_t const* cache, size_t segment) {
+    size_t slot = cache->buckets[hash_segment(segment, cache->num_buckets)];
+    while (slot != NO_SLOT && cache->slots[slot].segment != segment) {
+        slot = cache->slots[slot].next;
+    }
+    return slot;
+}
+
+// Picks an unpinned slot that hasn't been used since the hand last passed it and empties it, with the lock held.
+// Returns NO_SLOT if every slot is pinned.
+static size_t cache_evict(segment_cache_t* cache) {
+    for (size_t step = 0; step < 2 * cache->num_slots; ++step) {
+        size_t slot = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->num_slots;
+
+        cache_slot_t* s = &cache->slots[slot];
+        if (s->pins > 0) {
+            continue;
+        } else if (s->referenced) {
+            s->referenced = 0;
+            continue;
+        }
+
+        if (s->segment != NO_SEGMENT) {
+            size_t* link = &cache->buckets[hash_segment(s->segment, cache->num_buckets)];
+            while (*link != slot) {
+                link = &cache->slots[*link].next;
+            }
+            *link = s->next;
+            s->segment = NO_SEGMENT;
+        }
+        return slot;
+    }
+    return NO_SLOT;
+}
+
+// Sieves a segment into the worker's buffer
+static void sieve_into_worker(worker_t* worker, size_t segment) {
+    server_t const* server = worker->server;
+    size_t start_byte = segment * SERVER_SEGMENT_BYTES;
+    size_t end_num = (start_byte + SERVER_SEGMENT_BYTES) * WHEEL_MODULUS;
+
+    // Carry on from the last segment if this is the next one, so only the primes that start in this one are new;
+    // otherwise every prime starts again
+    if (segment != worker->next_segment) {
+        worker->num_sieving = 0;
+    }
+    while (worker->num_sieving < server->num_primes &&
+           server->primes[worker->num_sieving] * server->primes[worker->num_sieving] < end_num) {
+        sieving_prime_init(&worker->sieving[worker->num_sieving], server->primes[worker->num_sieving], start_byte);
+        ++worker->num_sieving;
+    }
+
+    sieve_segment_wheel(worker->segment, SERVER_SEGMENT_BYTES, start_byte, worker->sieving, worker->num_sieving);
+    worker->next_segment = segment + 1;
+}
+
+/**
+ * Gets a sieved segment, from the cache or by sieving it. It stays valid until release_segment(), and the worker
+ * must release it before getting another.
+ */
+static unsigned char const* get_segment(worker_t* worker, size_t segment, size_t* slot) {
+    segment_cache_t* cache = &worker->server->cache;
+    *slot = NO_SLOT;
+
+    pthread_mutex_lock(&cache->lock);
+    size_t found = cache->num_slots > 0 ? cache_lookup(cache, segment) : NO_SLOT;
+    if (found != NO_SLOT) {
+        ++cache->slots[found].pins;
+        cache->slots[found].referenced = 1;
+        ++cache->hits;
+        pthread_mutex_unlock(&cache->lock);
+        *slot = found;
+        return cache->slots[found].data;
+    }
+    ++cache->misses;
+    pthread_mutex_unlock(&cache->lock);
+
+    sieve_into_worker(worker, segment);
+    if (cache->num_slots == 0) {
+        return worker->segment;
+    }
+
+    // Keep a copy unless another worker has sieved it in the meantime. The caller reads the worker's own copy, so
+    // the slot doesn't need pinning.
+    pthread_mutex_lock(&cache->lock);
+    if (cache_lookup(cache, segment) == NO_SLOT && (found = cache_evict(cache)) != NO_SLOT) {
+        cache_slot_t* s = &cache->slots[found];
+        memcpy(s->data, worker->segment, SERVER_SEGMENT_BYTES);
+        s->segment = segment;
+        s->referenced = 1;
+        size_t* bucket = &cache->buckets[hash_segment(segment, cache->num_buckets)];
+        s->next = *bucket;
+        *bucket = found;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return worker->segment;
+}
+
+static void release_segment(worker_t* worker, size_t slot) {
+    segment_cache_t* cache = &worker->server->cache;
+    if (slot != NO_SLOT) {
+        pthread_mutex_lock(&cache->lock);
+        --cache->slots[slot].pins;
+        pthread_mutex_unlock(&cache->lock);
+    }
+}
+
+static size_t segment_of(size_t n) {
+    return n / WHEEL_MODULUS / SERVER_SEGMENT_BYTES;
+}
+
+// Gets the bytes [first, last) of a segment that hold numbers in [lo, hi), so the rest needn't be looked at
+static void segment_bytes(size_t segment, size_t lo, size_t hi, size_t* first, size_t* last) {
+    size_t start_byte = segment * SERVER_SEGMENT_BYTES;
+    *first = lo / WHEEL_MODULUS > start_byte ? lo / WHEEL_MODULUS - start_byte : 0;
+    *last = (hi - 1) / WHEEL_MODULUS - start_byte + 1;
+    if (*last > SERVER_SEGMENT_BYTES) {
+        *last = SERVER_SEGMENT_BYTES;
+    }
+}
+
+static int is_prime(worker_t* worker, size_t x) {
+    if (x < WHEEL_MODULUS) {
+        return x == 2 || x == 3 || x == 5 || (x > 5 && wheel_value(wheel_index(x)) == x);
+    } else if (wheel_value(wheel_index(x)) != x) {
+        return 0;
+    }
+
+    size_t slot;
+    size_t segment = segment_of(x);
+    unsigned char const* data = get_segment(worker, segment, &slot);
+    size_t bit = wheel_index(x) - segment * SERVER_SEGMENT_BYTES * WHEEL_SPOKES;
+    int prime = !(data[bit / WHEEL_SPOKES] & (1 << (bit % WHEEL_SPOKES)));
+    release_segment(worker, slot);
+    return prime;
+}
+
+// The smallest prime > x, or 0 if there isn't one below the limit
+static size_t next_prime(worker_t* worker, size_t x) {
+    size_t limit = worker->server->limit;
+    if (x < 5) {
+        size_t p = x < 2 ? 2 : x < 3 ? 3 : 5;
+        return p < limit ? p : 0;
+    }
+
+    for (size_t segment = segment_of(x + 1); segment * SERVER_SEGMENT_BYTES * WHEEL_MODULUS < limit; ++segment) {
+        size_t slot;
+        unsigned char const* data = get_segment(worker, segment, &slot);
+        size_t p = next_unmarked_wheel(data, SERVER_SEGMENT_BYTES, segment * SERVER_SEGMENT_BYTES, x);
+        release_segment(worker, slot);
+        if (p != (size_t)-1) {
+            return p < limit ? p : 0;
+        }
+    }
+    return 0;
+}
+
+// The number of primes in [lo, hi)
+static int count_primes(worker_t* worker, size_t lo, size_t hi, size_t* count) {
+    if (segment_of(hi - 1) - segment_of(lo) >= SERVER_PI_SEGMENTS) {
+        size_t below_hi, below_lo = 0;
+        if (prime_pi(hi - 1, 1, &below_hi, NULL) == -1 || (lo > 0 && prime_pi(lo - 1, 1, &below_lo, NULL) == -1)) {
+            return -1;
+        }
+        *count = below_hi - below_lo;
+        return 0;
+    }
+
+    *count = 0;
+    for (size_t segment = segment_of(lo); segment <= segment_of(hi - 1); ++segment) {
+        size_t slot, first, last;
+        unsigned char const* data = get_segment(worker, segment, &slot);
+        segment_bytes(segment, lo, hi, &first, &last);
+        *count += count_primes_wheel(data + first, last - first, segment * SERVER_SEGMENT_BYTES + first, lo, hi);
+        release_segment(worker, slot);
+    }
+    return 0;
+}
+
+// Makes room for len more bytes at the end of the response
+static void* response_extend(worker_t* worker, size_t len) {
+    if (worker->response_len + len > worker->response_cap) {
+        size_t cap = worker->response_cap * 2;
+        while (cap < worker->response_len + len) {
+            cap *= 2;
+        }
+        unsigned char* response = realloc(worker->response, cap);
+        if (!response) {
+            return NULL;
+        }
+        worker->response = response;
+        worker->response_cap = cap;
+    }
+
+    void* end = worker->response + worker->response_len;
+    worker->response_len += len;
+    return end;
+}
+
+// Appends the primes in [lo, hi) to the response, after its result
+static int list_primes(worker_t* worker, size_t lo, size_t hi, size_t* count) {
+    *count = 0;
+    for (uint64_t p = 2; p <= 5; p += p == 2 ? 1 : 2) {
+        if (p >= lo && p < hi) {
+            uint64_t* out = response_extend(worker, sizeof(uint64_t));
+            if (!out) {
+                return -1;
+            }
+            *out = p;
+            ++*count;
+        }
+    }
+
+    for (size_t segment = segment_of(lo); segment <= segment_of(hi - 1); ++segment) {
+        size_t slot, first, last;
+        unsigned char const* data = get_segment(worker, segment, &slot);
+        size_t start_byte = segment * SERVER_SEGMENT_BYTES;
+        segment_bytes(segment, lo, hi, &first, &last);
+
+        for (size_t i = first; i < last; ++i) {
+            unsigned char unmarked = ~data[i];
+            size_t base = (start_byte + i) * WHEEL_MODULUS;
+            while (unmarked) {
+                size_t num = base + wheel_residues[__builtin_ctz(unmarked)];
+                unmarked &= unmarked - 1;
+                if (num < lo || num >= hi) {
+                    continue;
+                }
+
+                uint64_t* out = response_extend(worker, sizeof(uint64_t));
+                if (!out) {
+                    release_segment(worker, slot);
+                    return -1;
+                }
+                *out = num;
+                ++*count;
+            }
+        }
+        release_segment(worker, slot);
+    }
+    return 0;
+}
+
+// Answers one query, appending its result (and any primes) to the response
+static int answer(worker_t* worker, server_query_t const* query) {
+    size_t offset = worker->response_len;
+    if (!response_extend(worker, sizeof(server_result_t))) {
+        return -1;
+    }
+
+    server_result_t result = {0, 0, 0, 0};
+    size_t limit = worker->server->limit;
+    size_t a = query->a;
+    size_t b = query->b;
+
+    switch (query->op) {
+        case SERVER_OP_IS_PRIME:
+            if (a >= limit) {
+                result.status = ERANGE;
+            } else {
+                result.value = is_prime(worker, a);
+            }
+            break;
+        case SERVER_OP_NEXT_PRIME:
+            if (a >= limit || (result.value = next_prime(worker, a)) == 0) {
+                result.status = ERANGE;
+            }
+            break;
+        case SERVER_OP_COUNT:
+        case SERVER_OP_RANGE:
+            if (a > b) {
+                result.status = EINVAL;
+            } else if (b > limit) {
+                result.status = ERANGE;
+            } else if (a == b) {
+                break;
+            } else if (query->op == SERVER_OP_COUNT) {
+                size_t count;
+                if (count_primes(worker, a, b, &count) == -1) {
+                    result.status = errno;
+                } else {
+                    result.value = count;
+                }
+            } else if (b - a > SERVER_MAX_RANGE_SPAN) {
+                result.status = E2BIG;
+            } else {
+                size_t count;
+                if (list_primes(worker, a, b, &count) == -1) {
+                    // Drop whatever was listed; the result says why
+                    worker->response_len = offset + sizeof(server_result_t);
+                    result.status = ENOMEM;
+                } else {
+                    result.value = result.num_primes = count;
+                }
+            }
+            break;
+        default:
+            result.status = EINVAL;
+            break;
+    }
+
+    memcpy(worker->response + offset, &result, sizeof(result));
+    return 0;
+}
+
+static int read_full(int fd, void* buf, size_t len) {
+    char* p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        } else if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, void const* buf, size_t len) {
+    char const* p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads one request from a connection and answers it. Returns -1 if the connection should be closed.
+static int serve_request(worker_t* worker, int fd) {
+    server_t* server = worker->server;
+
+    server_frame_t frame;
+    if (read_full(fd, &frame, sizeof(frame)) == -1 || frame.magic != SERVER_MAGIC ||
+        frame.num_queries > SERVER_MAX_BATCH ||
+        read_full(fd, worker->queries, sizeof(server_query_t) * frame.num_queries) == -1) {
+        return -1;
+    }
+
+    worker->response_len = 0;
+    server_frame_t* header = response_extend(worker, sizeof(server_frame_t));
+    header->magic = SERVER_MAGIC;
+    header->num_queries = frame.num_queries;
+    for (size_t i = 0; i < frame.num_queries; ++i) {
+        if (answer(worker, &worker->queries[i]) == -1) {
+            return -1;
+        }
+    }
+
+    atomic_fetch_add(&server->requests, 1);
+    atomic_fetch_add(&server->queries, frame.num_queries);
+    return write_full(fd, worker->response, worker->response_len);
+}
+
+// Closes a connection, which takes it out of the epoll set too
+static void close_connection(server_t* server, int fd) {
+    pthread_mutex_lock(&server->connections_lock);
+    for (size_t i = 0; i < server->num_connections; ++i) {
+        if (server->connection_fds[i] == fd) {
+            server->connection_fds[i] = server->connection_fds[--server->num_connections];
+            break;
+        }
+    }
+    close(fd);
+    pthread_mutex_unlock(&server->connections_lock);
+}
+
+static void add_connection(server_t* server, int fd) {
+    pthread_mutex_lock(&server->connections_lock);
+    if (server->num_connections == server->connections_cap) {
+        size_t cap = server->connections_cap ? 2 * server->connections_cap : 16;
+        int* fds = realloc(server->connection_fds, sizeof(int) * cap);
+        if (!fds) {
+            pthread_mutex_unlock(&server->connections_lock);
+            close(fd);
+            return;
+        }
+        server->connection_fds = fds;
+        server->connections_cap = cap;
+    }
+    server->connection_fds[server->num_connections++] = fd;
+    pthread_mutex_unlock(&server->connections_lock);
+
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.fd = fd};
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        close_connection(server, fd);
+    } else {
+        atomic_fetch_add(&server->connections, 1);
+    }
+}
+
+static int rearm(server_t* server, int fd) {
+    struct epoll_event event = {.events = EPOLLIN | EPOLLONESHOT, .data.fd = fd};
+    return epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+static void accept_connection(server_t* server) {
+    int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd != -1) {
+        struct timeval timeout = {SERVER_IO_TIMEOUT_MS / 1000, SERVER_IO_TIMEOUT_MS % 1000 * 1000};
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
+            close(fd);
+        } else {
+            add_connection(server, fd);
+        }
+    } else if (errno != EAGAIN && errno != EINTR && errno != ECONNABORTED) {
+        perror("Error accepting connection");
+    }
+    rearm(server, server->listen_fd);
+}
+
+static void* do_serve(void* worker_params) {
+    worker_t* worker = (worker_t*)worker_params;
+    server_t* server = worker->server;
+
+    for (;;) {
+        struct epoll_event event;
+        int n = epoll_wait(server->epoll_fd, &event, 1, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for connections");
+            break;
+        }
+
+        int fd = event.data.fd;
+        if (fd == server->stop_fd) {
+            break;
+        } else if (fd == server->listen_fd) {
+            accept_connection(server);
+        } else if (((event.events & (EPOLLHUP | EPOLLERR)) && !(event.events & EPOLLIN)) ||
+                   serve_request(worker, fd) == -1 || rearm(server, fd) == -1) {
+            close_connection(server, fd);
+        }
+    }
+    return NULL;
+}
+
+static int worker_init(worker_t* worker, server_t* server) {
+    memset(worker, 0, sizeof(*worker));
+    worker->server = server;
+    worker->next_segment = NO_SEGMENT;
+    worker->segment = malloc(SERVER_SEGMENT_BYTES);
+    worker->sieving = malloc(sizeof(sieving_prime_t) * (server->num_primes ? server->num_primes : 1));
+    worker->queries = malloc(sizeof(server_query_t) * SERVER_MAX_BATCH);
+    worker->response_cap = sizeof(server_frame_t) + sizeof(server_result_t) * SERVER_MAX_BATCH;
+    worker->response = malloc(worker->response_cap);
+    if (!worker->segment || !worker->sieving || !worker->queries || !worker->response) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+static void worker_free(worker_t* worker) {
+    free(worker->segment);
+    free(worker->sieving);
+    free(worker->queries);
+    free(worker->response);
+}
+
+// Binds the socket, replacing the file at its path if it's a socket that nothing is listening on any more
+static int listen_on(char const* path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe != -1 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        if (probe != -1) {
+            close(probe);
+        }
+        if (live) {
+            errno = EADDRINUSE;
+            return -1;
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, LISTEN_BACKLOG) == -1) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+// Frees whatever of a server has been set up; every field must be set or zeroed (with -1 for fds)
+static void server_free(server_t* server) {
+    for (size_t i = 0; i < server->num_workers; ++i) {
+        worker_free(&server->workers[i]);
+    }
+    free(server->workers);
+    if (server->epoll_fd != -1) {
+        close(server->epoll_fd);
+    }
+    if (server->stop_fd != -1) {
+        close(server->stop_fd);
+    }
+    if (server->listen_fd != -1) {
+        close(server->listen_fd);
+        unlink(server->socket_path);
+    }
+    for (size_t i = 0; i < server->num_connections; ++i) {
+        close(server->connection_fds[i]);
+    }
+    free(server->connection_fds);
+    pthread_mutex_destroy(&server->connections_lock);
+    cache_free(&server->cache);
+    free(server->primes);
+    free(server->socket_path);
+    free(server);
+}
+
+server_t* server_start(server_config_t const* config) {
+    if (config->limit < 10 || config->limit > SIEVE_RANGE_MAX || config->num_workers == 0 || !config->socket_path) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    server_t* server = calloc(1, sizeof(server_t));
+    if (!server) {
+        return NULL;
+    }
+    server->listen_fd = server->stop_fd = server->epoll_fd = -1;
+    server->limit = config->limit;
+    pthread_mutex_init(&server->connections_lock, NULL);
+
+    int error = ENOMEM;
+    if (cache_init(&server->cache, config->cache_bytes) == -1 || !(server->socket_path = strdup(config->socket_path)) ||
+        !(server->primes = sieving_primes(config->limit, &server->num_primes))) {
+        goto fail;
+    }
+
+    server->workers = calloc(config->num_workers, sizeof(worker_t));
+    if (!server->workers) {
+        goto fail;
+    }
+    for (; server->num_workers < config->num_workers; ++server->num_workers) {
+        if (worker_init(&server->workers[server->num_workers], server) == -1) {
+            ++server->num_workers;
+            goto fail;
+        }
+    }
+
+    struct epoll_event listen_event = {.events = EPOLLIN | EPOLLONESHOT};
+    struct epoll_event stop_event = {.events = EPOLLIN};
+    if ((server->listen_fd = listen_on(config->socket_path)) == -1 ||
+        (server->stop_fd = eventfd(0, EFD_CLOEXEC)) == -1 || (server->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        error = errno;
+        goto fail;
+    }
+    listen_event.data.fd = server->listen_fd;
+    stop_event.data.fd = server->stop_fd;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &listen_event) == -1 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->stop_fd, &stop_event) == -1) {
+        error = errno;
+        goto fail;
+    }
+
+    for (size_t i = 0; i < server->num_workers; ++i) {
+        if ((errno = pthread_create(&server->workers[i].thread, NULL, do_serve, &server->workers[i])) != 0) {
+            error = errno;
+            // Stop the ones that did start
+            uint64_t one = 1;
+            if (write(server->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+                perror("Error stopping workers");
+            }
+            for (size_t j = 0; j < i; ++j) {
+                pthread_join(server->workers[j].thread, NULL);
+            }
+            goto fail;
+        }
+    }
+    return server;
+
+fail:
+    server_free(server);
+    errno = error;
+    return NULL;
+}
+
+void server_stop(server_t* server, server_stats_t* stats) {
+    uint64_t one = 1;
+    if (write(server->stop_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("Error stopping workers");
+    }
+    for (size_t i = 0; i < server->num_workers; ++i) {
+        pthread_join(server->workers[i].thread, NULL);
+    }
+
+    if (stats) {
+        stats->connections = atomic_load(&server->connections);
+        stats->requests = atomic_load(&server->requests);
+        stats->queries = atomic_load(&server->queries);
+        stats->cache_hits = server->cache.hits;
+        stats->cache_misses = server->cache.misses;
+        stats->cache_slots = server->cache.num_slots;
+    }
+    server_free(server);
+}
+
+int server_connect(char const* socket_path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+int server_call(int fd, server_query_t const* queries, size_t num_queries, server_result_t* results, uint64_t* primes,
+                size_t cap) {
+    if (num_queries > SERVER_MAX_BATCH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    server_frame_t frame = {SERVER_MAGIC, (uint32_t)num_queries};
+    if (write_full(fd, &frame, sizeof(frame)) == -1 ||
+        write_full(fd, queries, sizeof(server_query_t) * num_queries) == -1 ||
+        read_full(fd, &frame, sizeof(frame)) == -1) {
+        return -1;
+    } else if (frame.magic != SERVER_MAGIC || frame.num_queries != num_queries) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    size_t stored = 0;
+    for (size_t i = 0; i < num_queries; ++i) {
+        if (read_full(fd, &results[i], sizeof(server_result_t)) == -1) {
+            return -1;
+        }
+
+        for (uint64_t left = results[i].num_primes; left > 0;) {
+            uint64_t discard[512];
+            uint64_t* dst = primes && stored < cap ? primes + stored : discard;
+            size_t room = primes && stored < cap ? cap - stored : sizeof(discard) / sizeof(discard[0]);
+            size_t n = left < room ? left : room;
+            if (read_full(fd, dst, sizeof(uint64_t) * n) == -1) {
+                return -1;
+            }
+            if (dst != discard) {
+                stored += n;
+            }
+            left -= n;
+        }
+    }
+    return 0;
+}
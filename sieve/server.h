@@ -0,0 +1,135 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Sieve server.
+ *
+ * A server keeps a pool of worker threads and a cache of sieved segments, and answers batches of queries over a
+ * UNIX domain socket, so callers with lots of small queries don't pay for a process, its jobs and a fresh sieve
+ * each time.
+ *
+ * Every number the server knows about is below its limit. The sieving primes for the limit are found once when it
+ * starts; after that, a segment of SERVER_SEGMENT_BYTES of the packed composites array (see common.h) is sieved the
+ * first time a query touches it and kept in the cache until the space is needed. Eviction is CLOCK (second chance),
+ * which only approximates LRU: a hand sweeps the slots, clearing each one's referenced bit, and evicts the first
+ * unpinned segment that hasn't been touched since the hand last passed it. Counts that span more than
+ * SERVER_PI_SEGMENTS segments go to prime_pi() instead (see pi.h).
+ *
+ * The workers all wait on one epoll instance. Whichever one wakes up for a connection reads one request from it,
+ * answers it and goes back to waiting, so a connection's requests are answered in order but not always by the same
+ * worker.
+ *
+ * Protocol: a request is a server_frame_t followed by num_queries server_query_t. The response is a server_frame_t
+ * with the same number of queries, followed by a server_result_t for each query, in order, each followed by its
+ * num_primes primes as uint64_t. Everything is native-endian, since both ends are on the same machine. A request
+ * that doesn't parse gets the connection closed.
+ */
+
+// Where the server listens by default
+#define SERVER_SOCKET_PATH "sieve.sock"
+
+#define SERVER_MAGIC 0x53565251
+
+// The most queries in one request
+#define SERVER_MAX_BATCH 4096
+
+// Bytes of packed composites per cached segment (30 numbers each)
+#define SERVER_SEGMENT_BYTES 32768
+
+// Counts that span more segments than this use prime_pi() rather than the cache
+#define SERVER_PI_SEGMENTS 64
+
+// The widest range a SERVER_OP_RANGE query can list
+#define SERVER_MAX_RANGE_SPAN ((uint64_t)1 << 24)
+
+// How long a worker waits on a client that's in the middle of sending a request or reading a response
+#define SERVER_IO_TIMEOUT_MS 5000
+
+typedef enum {
+    SERVER_OP_IS_PRIME = 1, // value = 1 if a is prime, or 0 if not
+    SERVER_OP_NEXT_PRIME, // value = the smallest prime > a
+    SERVER_OP_COUNT, // value = the number of primes in [a, b)
+    SERVER_OP_RANGE // value = num_primes = the number of primes in [a, b), which follow the result
+} server_op_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t num_queries;
+} server_frame_t;
+
+typedef struct {
+    uint32_t op;
+    uint32_t reserved;
+    uint64_t a;
+    uint64_t b;
+} server_query_t;
+
+typedef struct {
+    uint32_t status; // 0, or an errno value: EINVAL for a bad query, ERANGE if it needs a number at or above the
+                     // server's limit, E2BIG for a range wider than SERVER_MAX_RANGE_SPAN, or ENOMEM
+    uint32_t reserved;
+    uint64_t value;
+    uint64_t num_primes;
+} server_result_t;
+
+typedef struct {
+    char const* socket_path;
+    size_t num_workers;
+    size_t cache_bytes; // Rounded down to whole segments; 0 turns the cache off
+    size_t limit; // Every number the server answers queries about is below this. Must be in [10, SIEVE_RANGE_MAX].
+} server_config_t;
+
+/**
+ * What a server did while it was running.
+ */
+typedef struct {
+    size_t connections;
+    size_t requests;
+    size_t queries;
+    size_t cache_hits;
+    size_t cache_misses; // Segments that had to be sieved
+    size_t cache_slots;
+} server_stats_t;
+
+typedef struct server server_t;
+
+/**
+ * Finds the sieving primes, binds the socket (replacing a stale socket file at the same path) and starts the
+ * workers.
+ *
+ * @param config The config.
+ * @return The server, or NULL on error (with errno set).
+ */
+server_t* server_start(server_config_t const* config);
+
+/**
+ * Stops the workers once they've answered the requests they're in the middle of, closes every connection and the
+ * socket, removes the socket file and frees the server.
+ *
+ * @param server The server.
+ * @param stats  Filled in with what the server did, or NULL.
+ */
+void server_stop(server_t* server, server_stats_t* stats);
+
+/**
+ * Connects to a server.
+ *
+ * @param socket_path The server's socket.
+ * @return The connected socket, or -1 on error (with errno set).
+ */
+int server_connect(char const* socket_path);
+
+/**
+ * Sends a batch of queries and waits for the answers.
+ *
+ * @param fd          The socket from server_connect().
+ * @param queries     The queries.
+ * @param num_queries The number of queries, at most SERVER_MAX_BATCH.
+ * @param results     Filled in with a result for each query.
+ * @param primes      Filled in with the primes listed by the SERVER_OP_RANGE queries, one after the other, or NULL.
+ * @param cap         The number of primes there's room for; any more are read and thrown away.
+ * @return 0 on success, or -1 on error (with errno set; EPROTO if the response didn't parse).
+ */
+int server_call(int fd, server_query_t const* queries, size_t num_queries, server_result_t* results, uint64_t* primes,
+                size_t cap);
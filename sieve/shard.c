@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "shard.h"
+#include "common.h"
+
+#define LINE_SIZE 512
+
+// Where a shard's data has got to as its chunks come in
+typedef struct {
+    shard_manifest_t* manifest;
+    int fd;
+    prime_buffer_t text; // For text shards: the chunk's primes, formatted
+    int error;
+} shard_writer_t;
+
+void shard_range(size_t lo, size_t hi, size_t index, size_t count, size_t* shard_lo, size_t* shard_hi) {
+    size_t first_byte = lo / WHEEL_MODULUS;
+    size_t num_bytes = wheel_bytes(hi) - first_byte;
+
+    // Split in 128-bit arithmetic, so num_bytes * index can't overflow
+    size_t start = first_byte + (size_t)((unsigned __int128)num_bytes * index / count);
+    size_t end = first_byte + (size_t)((unsigned __int128)num_bytes * (index + 1) / count);
+
+    *shard_lo = index == 0 ? lo : start * WHEEL_MODULUS;
+    *shard_hi = index == count - 1 ? hi : end * WHEEL_MODULUS;
+}
+
+static int write_chunk(unsigned char const* bitmap, size_t len, size_t start_byte, void* user) {
+    shard_writer_t* writer = (shard_writer_t*)user;
+    shard_manifest_t* m = writer->manifest;
+
+    char const* data = (char const*)bitmap;
+    size_t data_len = len;
+    if (m->format == OUTPUT_TEXT) {
+        writer->text.len = 0;
+        if (format_primes_wheel(&writer->text, bitmap, len, start_byte, m->lo, m->hi) == -1) {
+            writer->error = ENOMEM;
+            return 1;
+        }
+        data = writer->text.data;
+        data_len = writer->text.len;
+    }
+
+    if (write_all(writer->fd, m->data_bytes, data, data_len) == -1) {
+        writer->error = errno;
+        return 1;
+    }
+    m->num_primes += count_primes_wheel(bitmap, len, start_byte, m->lo, m->hi);
+    m->checksum = fnv1a(m->checksum, (unsigned char const*)data, data_len);
+    m->data_bytes += data_len;
+    return 0;
+}
+
+static int write_manifest(char const* path, shard_manifest_t const* m) {
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE* f = fopen(tmp_path, "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "version %d\n", SHARD_MANIFEST_VERSION);
+    fprintf(f, "shard %lu/%lu\n", m->index, m->count);
+    fprintf(f, "range %lu %lu\n", m->range_lo, m->range_hi);
+    fprintf(f, "lo %lu\n", m->lo);
+    fprintf(f, "hi %lu\n", m->hi);
+    fprintf(f, "format %s\n", m->format == OUTPUT_TEXT ? "text" : "bitmap");
+    fprintf(f, "start_byte %lu\n", m->start_byte);
+    fprintf(f, "primes %lu\n", m->num_primes);
+    fprintf(f, "bytes %lu\n", m->data_bytes);
+    fprintf(f, "checksum %016" PRIx64 "\n", m->checksum);
+    fprintf(f, "data %s\n", m->data_file);
+
+    // The manifest only appears once it's whole, and only after the data it describes
+    if (fclose(f) != 0 || rename(tmp_path, path) == -1) {
+        int error = errno;
+        unlink(tmp_path);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int shard_run(sieve_config_t const* config, size_t index, size_t count, shard_manifest_t* manifest) {
+    if (config->lo >= config->hi || count == 0 || index >= count ||
+        count > wheel_bytes(config->hi) - config->lo / WHEEL_MODULUS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(manifest, 0, sizeof(*manifest));
+    manifest->index = index;
+    manifest->count = count;
+    manifest->range_lo = config->lo;
+    manifest->range_hi = config->hi;
+    manifest->format = config->format;
+    manifest->checksum = FNV_OFFSET_BASIS;
+    shard_range(config->lo, config->hi, index, count, &manifest->lo, &manifest->hi);
+    manifest->start_byte = manifest->lo / WHEEL_MODULUS;
+    snprintf(manifest->data_file, sizeof(manifest->data_file), "%s.%lu-of-%lu",
+             config->format == OUTPUT_TEXT ? PRIMES_FILENAME : SHARD_BITMAP_FILENAME, index, count);
+
+    shard_writer_t writer = {manifest, -1, {NULL, 0, 0}, 0};
+    writer.fd = open(manifest->data_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (writer.fd == -1) {
+        return -1;
+    }
+
+    sieve_config_t shard_config = *config;
+    shard_config.lo = manifest->lo;
+    shard_config.hi = manifest->hi;
+    int ret = 0;
+    if (config->format == OUTPUT_TEXT && prime_buffer_init(&writer.text, 1 << 16) == -1) {
+        writer.error = ENOMEM;
+        ret = -1;
+    } else if ((ret = sieve_stream_bitmap(&shard_config, write_chunk, &writer)) == -1) {
+        writer.error = errno;
+    }
+
+    prime_buffer_free(&writer.text);
+    if (close(writer.fd) == -1 && ret == 0) {
+        writer.error = errno;
+        ret = -1;
+    }
+
+    char manifest_path[PATH_MAX];
+    snprintf(manifest_path, sizeof(manifest_path), "%s%s", manifest->data_file, SHARD_MANIFEST_SUFFIX);
+    if (ret != 0) {
+        errno = writer.error;
+        return -1;
+    }
+    return write_manifest(manifest_path, manifest);
+}
+
+int shard_manifest_read(char const* path, shard_manifest_t* manifest) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    memset(manifest, 0, sizeof(*manifest));
+    int version = 0;
+    char format[16] = "";
+    unsigned seen = 0;
+
+    char line[LINE_SIZE];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "version %d", &version) == 1) {
+            seen |= 1 << 0;
+        } else if (sscanf(line, "shard %lu/%lu", &manifest->index, &manifest->count) == 2) {
+            seen |= 1 << 1;
+        } else if (sscanf(line, "range %lu %lu", &manifest->range_lo, &manifest->range_hi) == 2) {
+            seen |= 1 << 2;
+        } else if (sscanf(line, "lo %lu", &manifest->lo) == 1) {
+            seen |= 1 << 3;
+        } else if (sscanf(line, "hi %lu", &manifest->hi) == 1) {
+            seen |= 1 << 4;
+        } else if (sscanf(line, "format %15s", format) == 1) {
+            seen |= 1 << 5;
+        } else if (sscanf(line, "start_byte %lu", &manifest->start_byte) == 1) {
+            seen |= 1 << 6;
+        } else if (sscanf(line, "primes %lu", &manifest->num_primes) == 1) {
+            seen |= 1 << 7;
+        } else if (sscanf(line, "bytes %lu", &manifest->data_bytes) == 1) {
+            seen |= 1 << 8;
+        } else if (sscanf(line, "checksum %" SCNx64, &manifest->checksum) == 1) {
+            seen |= 1 << 9;
+        } else if (sscanf(line, "data %255s", manifest->data_file) == 1) {
+            seen |= 1 << 10;
+        }
+    }
+    fclose(f);
+
+    if (strcmp(format, "text") == 0) {
+        manifest->format = OUTPUT_TEXT;
+    } else if (strcmp(format, "bitmap") == 0) {
+        manifest->format = OUTPUT_TABLE;
+    } else {
+        seen = 0;
+    }
+
+    // The data file has to be a plain name, so a manifest can't point outside its own directory
+    if (seen != (1u << 11) - 1 || version != SHARD_MANIFEST_VERSION || manifest->count == 0 ||
+        manifest->index >= manifest->count || manifest->lo >= manifest->hi || strchr(manifest->data_file, '/')) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
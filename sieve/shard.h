@@ -0,0 +1,80 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "output.h"
+#include "sieve.h"
+
+/*
+ * Sharded runs.
+ *
+ * A range [lo, hi) is split into count shards of whole bytes of the packed composites array (see common.h), so the
+ * split only depends on lo, hi and count, and no two shards share a byte. Each shard is sieved on its own, with its
+ * own sieving primes, so the shards can run on different machines.
+ *
+ * A shard writes two files: its data and a manifest. The data is either the shard's primes as text, one per line
+ * (so the text shards of a range concatenate into its primes file), or the shard's bytes of the packed composites
+ * array, with the bits for numbers outside the shard set. The manifest is a few "key value" lines saying which shard
+ * of which range it is, which file holds the data, how many primes are in it, and the data's size and 64-bit FNV-1a
+ * checksum, so the shards can be checked before they're merged (see tools/shard_merge.c).
+ */
+
+#define SHARD_MANIFEST_SUFFIX ".manifest"
+
+// Where the bitmap shards' data goes; text shards use PRIMES_FILENAME
+#define SHARD_BITMAP_FILENAME "primes.bits"
+
+#define SHARD_MANIFEST_VERSION 1
+
+/**
+ * What a shard's manifest says.
+ */
+typedef struct {
+    size_t index; // From 0
+    size_t count;
+    size_t range_lo; // The whole range that was split up
+    size_t range_hi;
+    size_t lo; // This shard's part of it
+    size_t hi;
+    output_format_t format; // OUTPUT_TEXT, or OUTPUT_TABLE for a bitmap
+    size_t start_byte; // For a bitmap: the index of its first byte
+    size_t num_primes; // The number of primes in [lo, hi)
+    size_t data_bytes;
+    uint64_t checksum;
+    char data_file[NAME_MAX + 1]; // In the same directory as the manifest
+} shard_manifest_t;
+
+/**
+ * Gets a shard's part of a range.
+ *
+ * @param lo    The first number in the range.
+ * @param hi    The number below which all primes will be found. Must be > lo.
+ * @param index The shard. Must be < count.
+ * @param count The number of shards. Must be <= wheel_bytes(hi) - lo / 30, so every shard gets at least a byte.
+ * @param shard_lo Set to the first number in the shard.
+ * @param shard_hi Set to the number below which the shard's primes are found.
+ */
+void shard_range(size_t lo, size_t hi, size_t index, size_t count, size_t* shard_lo, size_t* shard_hi);
+
+/**
+ * Sieves a shard with the segmented engine's jobs and writes its data and manifest to the current directory. The
+ * data file is PRIMES_FILENAME (for text) or SHARD_BITMAP_FILENAME (for OUTPUT_TABLE), followed by
+ * ".<index>-of-<count>", and the manifest is that with SHARD_MANIFEST_SUFFIX added.
+ *
+ * @param config   The whole range, the jobs and the segment size. format picks text or a bitmap.
+ * @param index    The shard. Must be < count.
+ * @param count    The number of shards. Must be <= wheel_bytes(hi) - lo / 30.
+ * @param manifest Filled in with what was written to the manifest.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int shard_run(sieve_config_t const* config, size_t index, size_t count, shard_manifest_t* manifest);
+
+/**
+ * Reads a shard's manifest.
+ *
+ * @param path     The manifest.
+ * @param manifest The manifest to fill in.
+ * @return 0 on success, or -1 on error (with errno set; EINVAL if it isn't a valid manifest).
+ */
+int shard_manifest_read(char const* path, shard_manifest_t* manifest);
@@ -0,0 +1,181 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "shared.h"
+#include "arena.h"
+#include "common.h"
+#include "output.h"
+#include "prime_table.h"
+#include "../perf.h"
+#include "../timing.h"
+#include "../trace.h"
+
+// The layout of the shared mapping: this header, then the sieving primes, then the packed composites array
+typedef struct {
+    size_t num_primes;
+    size_t len; // Length of the packed composites array in bytes
+} shared_header_t;
+
+// Sent once by each child when it's finished sieving its slice
+typedef struct {
+    size_t job_id;
+    double ms_working;
+} job_done_msg;
+
+static void do_sieve(size_t job_id, size_t slice_start, size_t slice_size, size_t segment_size,
+                     shared_header_t const* header, int done_pipe) {
+    size_t const* primes = (size_t const*)(header + 1);
+    unsigned char* composites = (unsigned char*)(primes + header->num_primes);
+
+    struct timespec start, end;
+
+    perf_job_t perf;
+    perf_job_open(&perf, job_id);
+
+    sieving_prime_t* sieving = malloc(sizeof(sieving_prime_t) * (header->num_primes ? header->num_primes : 1));
+    if (!sieving) {
+        perror("Error while allocating sieving primes");
+        exit(EXIT_FAILURE);
+    }
+
+    // Sieve the slice in place, one segment at a time. There's only the one round.
+    TRACE_BEGIN(job_id, TRACE_STRIKE, 0);
+    PTIME
+    (
+        "working",
+        for (size_t i = 0; i < header->num_primes; ++i) {
+            sieving_prime_init(&sieving[i], primes[i], slice_start);
+        }
+
+        size_t slice_end = slice_start + slice_size;
+        for (size_t seg_start = slice_start; seg_start < slice_end; seg_start += segment_size) {
+            size_t seg_len = slice_end - seg_start < segment_size ? slice_end - seg_start : segment_size;
+            sieve_segment_wheel(composites + seg_start, seg_len, seg_start, sieving, header->num_primes);
+        }
+    )
+    TRACE_END(job_id, TRACE_STRIKE, 0);
+
+    job_done_msg msg;
+    msg.job_id = job_id;
+    msg.ms_working = get_delay(start, end);
+    perf_job_close(&perf);
+
+    // Messages this small are written atomically, so the children can share the pipe
+    TRACE_BEGIN(job_id, TRACE_PUBLISH, 0);
+    if (write(done_pipe, &msg, sizeof(msg)) != sizeof(msg)) {
+        perror("Error sending completion message");
+        exit(EXIT_FAILURE);
+    }
+    TRACE_END(job_id, TRACE_PUBLISH, 0);
+
+    free(sieving);
+    exit(EXIT_SUCCESS);
+}
+
+void concurrent_sieve_shared(size_t limit, size_t num_jobs, size_t segment_size, output_format_t format) {
+    struct timespec start, end;
+
+    size_t num_primes;
+    size_t* primes = sieving_primes(limit, &num_primes);
+    if (!primes) {
+        perror("Error while allocating sieving primes");
+        exit(EXIT_FAILURE);
+    }
+
+    // Map the sieving primes and the composites together before forking so that every child shares them. The
+    // children clear their own slices, so the mapping's pages are first touched by the process that sieves them.
+    size_t len = wheel_bytes(limit);
+    size_t mapping_size = sizeof(shared_header_t) + sizeof(size_t) * num_primes + len;
+    sieve_arena_t arena;
+    if (arena_acquire(&arena, mapping_size, ARENA_SHARED) == -1) {
+        perror("Failed to map memory");
+        exit(EXIT_FAILURE);
+    }
+    shared_header_t* header = arena_alloc(&arena, mapping_size);
+
+    header->num_primes = num_primes;
+    header->len = len;
+    memcpy(header + 1, primes, sizeof(size_t) * num_primes);
+    free(primes);
+
+    int done_pipe[2];
+    if (pipe(done_pipe) == -1) {
+        perror("Error creating pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t extra;
+    size_t slice_size;
+
+    get_slices(num_jobs, limit, &slice_size, &extra);
+
+    for (size_t i = 0; i < num_jobs; ++i) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("Error while forking");
+            exit(EXIT_FAILURE);
+        } else if (pid == 0) {
+            close(done_pipe[0]);
+            size_t cur_slice_size = slice_size + (i == num_jobs - 1 ? extra : 0); // assign any extra to the last job
+            do_sieve(i, i * slice_size, cur_slice_size, segment_size, header, done_pipe[1]);
+        }
+    }
+    close(done_pipe[1]);
+
+    // Each child reports in exactly once. The master's track is the one after the jobs'.
+    TRACE_BEGIN(num_jobs, TRACE_WAIT, 0);
+    for (size_t i = 0; i < num_jobs; ++i) {
+        job_done_msg msg;
+        if (read(done_pipe[0], &msg, sizeof(msg)) != sizeof(msg)) {
+            perror("Error while receiving completion message");
+            exit(EXIT_FAILURE);
+        }
+        printf("Job %lu finished sieving in %.4fms.\n", msg.job_id, msg.ms_working);
+    }
+    close(done_pipe[0]);
+
+    for (size_t i = 0; i < num_jobs; ++i) {
+        wait(NULL);
+    }
+    TRACE_END(num_jobs, TRACE_WAIT, 0);
+
+    // Everything's in shared memory, so write the primes straight out of it in order
+    unsigned char const* composites = (unsigned char const*)((size_t const*)(header + 1) + num_primes);
+    TRACE_BEGIN(num_jobs, TRACE_OUTPUT, 0);
+    if (format == OUTPUT_TABLE) {
+        CTIME
+        (
+            prime_table_t table;
+            if (prime_table_create(&table, PRIME_TABLE_FILENAME, limit) == -1) {
+                perror("Error while creating " PRIME_TABLE_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+
+            memcpy(table.bitmap, composites, len);
+            if (prime_table_finish(&table) == -1) {
+                perror("Error writing " PRIME_TABLE_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+        )
+        printf("Prime table written to %s in %.4fms.\n", PRIME_TABLE_FILENAME, get_delay(start, end));
+    } else {
+        CTIME
+        (
+            int primes_fd = open(PRIMES_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            if (primes_fd == -1 || write_primes_wheel(primes_fd, 0, composites, len, 0, limit) == -1) {
+                perror("Error writing " PRIMES_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+            close(primes_fd);
+        )
+        printf("Primes written to %s in %.4fms.\n", PRIMES_FILENAME, get_delay(start, end));
+    }
+    TRACE_END(num_jobs, TRACE_OUTPUT, 0);
+
+    arena_release(&arena);
+}
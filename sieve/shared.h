@@ -0,0 +1,19 @@
+#pragma once
+#include <stddef.h>
+
+#include "output.h"
+
+/**
+ * Runs the sieve using processes that share one packed composites array.
+ *
+ * The parent finds the sieving primes and puts them, along with the packed composites array, in a single shared
+ * mapping before forking. Each child then sieves its slice of the shared array in segments without any per-prime
+ * IPC, and tells the parent once when it's done. The parent writes every prime straight from the shared array to
+ * one file, or copies the array into a binary prime table.
+ *
+ * @param limit        The number below which all primes will be calculated.
+ * @param num_jobs     The number of jobs (processes) to use.
+ * @param segment_size The size of each segment in bytes of the packed composites array.
+ * @param format       Whether to write the primes as text or as a binary prime table.
+ */
+void concurrent_sieve_shared(size_t limit, size_t num_jobs, size_t segment_size, output_format_t format);
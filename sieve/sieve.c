@@ -0,0 +1,454 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sieve.h"
+#include "bucket.h"
+#include "common.h"
+#include "hybrid.h"
+#include "process.h"
+#include "segmented.h"
+#include "shared.h"
+#include "thread.h"
+#include "../perf.h"
+#include "../timing.h"
+#include "../trace.h"
+
+// The lowest limit the engines support
+#define MIN_RUN_LIMIT 10
+
+// What the jobs do with each chunk they sieve
+typedef enum {
+    COLLECT_COUNT,
+    COLLECT_STREAM,
+    COLLECT_BITMAP
+} collect_mode_t;
+
+// Shared by the jobs of one in-process run
+typedef struct {
+    collect_mode_t mode;
+    sieve_range_t range;
+    size_t segment_size;
+    size_t chunk_segments;
+    size_t num_chunks;
+
+    atomic_size_t next_chunk; // Chunks are claimed in order, so a job waiting its turn never waits on an unclaimed one
+    atomic_size_t count; // For COLLECT_COUNT
+    atomic_int stopped; // Set once the callback stops the run or a job fails
+
+    // For COLLECT_STREAM and COLLECT_BITMAP: chunks are delivered in order, by whichever job sieved them. The batch
+    // carries over from one chunk to the next, so every batch but the last is full.
+    pthread_mutex_t lock;
+    pthread_cond_t turn_changed;
+    size_t turn; // The next chunk to deliver
+    int result; // The callback's return value, or -1 if a job failed
+    int error; // errno from the job that failed
+    sieve_callback_t callback;
+    sieve_bitmap_callback_t bitmap_callback;
+    void* user;
+    size_t* batch;
+    size_t batch_len;
+    size_t batch_size;
+} collect_t;
+
+typedef struct {
+    size_t job_id;
+    collect_t* collect;
+    unsigned char* chunk; // The chunk being sieved, one segment after another
+    sieving_prime_t* sieving;
+    bucket_sieve_t buckets;
+} collect_job_t;
+
+void sieve_config_init(sieve_config_t* config, size_t hi) {
+    config->engine = SIEVE_ENGINE_SEGMENTED;
+    config->lo = 0;
+    config->hi = hi;
+    config->num_jobs = 1;
+    config->segment_size = 0;
+    config->format = OUTPUT_TEXT;
+    config->num_processes = 0;
+    config->checkpoint = NULL;
+}
+
+int sieve_run(sieve_config_t const* config) {
+    size_t lo = config->lo;
+    size_t hi = config->hi;
+    int segmented = config->engine == SIEVE_ENGINE_SEGMENTED;
+
+    if (hi < MIN_RUN_LIMIT || hi > SIEVE_RANGE_MAX || lo >= hi ||
+        (lo > 0 && (!segmented || config->format == OUTPUT_TABLE)) || (config->checkpoint && (!segmented || lo > 0)) ||
+        (config->num_processes > 0 && config->engine != SIEVE_ENGINE_HYBRID) || config->num_jobs == 0 ||
+        config->num_jobs > wheel_bytes(hi) - lo / WHEEL_MODULUS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t segment_size = config->segment_size ? config->segment_size : default_segment_size();
+    switch (config->engine) {
+        case SIEVE_ENGINE_THREAD:
+            concurrent_sieve_thread(hi, config->num_jobs, segment_size, config->format);
+            return 0;
+        case SIEVE_ENGINE_PROCESS:
+            concurrent_sieve_process(hi, config->num_jobs, config->format);
+            return 0;
+        case SIEVE_ENGINE_SEGMENTED:
+            concurrent_sieve_segmented(lo, hi, config->num_jobs, segment_size, config->format, config->checkpoint);
+            return 0;
+        case SIEVE_ENGINE_SHARED:
+            concurrent_sieve_shared(hi, config->num_jobs, segment_size, config->format);
+            return 0;
+        case SIEVE_ENGINE_HYBRID:
+            concurrent_sieve_hybrid(hi, config->num_jobs, config->num_processes, segment_size, config->format);
+            return 0;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+// Stops the run after a job fails, waking anyone waiting for a turn that won't come
+static void collect_fail(collect_t* collect, int error) {
+    pthread_mutex_lock(&collect->lock);
+    if (!atomic_load(&collect->stopped)) {
+        collect->result = -1;
+        collect->error = error;
+        atomic_store(&collect->stopped, 1);
+    }
+    pthread_cond_broadcast(&collect->turn_changed);
+    pthread_mutex_unlock(&collect->lock);
+}
+
+// Adds a prime to the batch and hands the batch over once it's full. Called with the lock held.
+static void collect_prime(collect_t* collect, size_t prime) {
+    collect->batch[collect->batch_len++] = prime;
+    if (collect->batch_len == collect->batch_size) {
+        int ret = collect->callback(collect->batch, collect->batch_len, collect->user);
+        collect->batch_len = 0;
+        if (ret != 0) {
+            collect->result = ret;
+            atomic_store(&collect->stopped, 1);
+        }
+    }
+}
+
+// Sets the bits for numbers outside the range in a chunk's first and last bytes
+static void mask_range_ends(sieve_range_t const* range, unsigned char* bitmap, size_t len, size_t start_byte) {
+    size_t last_byte = start_byte + len - 1;
+    for (size_t j = 0; j < WHEEL_SPOKES; ++j) {
+        if (start_byte == range->start_byte && start_byte * WHEEL_MODULUS + wheel_residues[j] < range->lo) {
+            bitmap[0] |= 1 << j;
+        }
+        if (last_byte + 1 == range->end_byte && last_byte * WHEEL_MODULUS + wheel_residues[j] >= range->hi) {
+            bitmap[len - 1] |= 1 << j;
+        }
+    }
+}
+
+// Waits for a chunk's turn, then passes its primes (or the chunk itself) on and hands the turn to the next chunk
+static void collect_deliver(collect_t* collect, unsigned char* bitmap, size_t len, size_t start_byte, size_t chunk) {
+    sieve_range_t const* range = &collect->range;
+
+    pthread_mutex_lock(&collect->lock);
+    while (collect->turn != chunk && !atomic_load(&collect->stopped)) {
+        pthread_cond_wait(&collect->turn_changed, &collect->lock);
+    }
+
+    if (collect->mode == COLLECT_BITMAP) {
+        if (!atomic_load(&collect->stopped)) {
+            mask_range_ends(range, bitmap, len, start_byte);
+            int ret = collect->bitmap_callback(bitmap, len, start_byte, collect->user);
+            if (ret != 0) {
+                collect->result = ret;
+                atomic_store(&collect->stopped, 1);
+            }
+        }
+    } else {
+        if (start_byte == 0) {
+            for (size_t p = 2; p <= 5 && !atomic_load(&collect->stopped); p += p == 2 ? 1 : 2) {
+                if (p >= range->lo && p < range->hi) {
+                    collect_prime(collect, p);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < len && !atomic_load(&collect->stopped); ++i) {
+            unsigned char unmarked = ~bitmap[i];
+            size_t base = (start_byte + i) * WHEEL_MODULUS;
+
+            while (unmarked && !atomic_load(&collect->stopped)) {
+                size_t num = base + wheel_residues[__builtin_ctz(unmarked)];
+                if (num >= range->hi) {
+                    break;
+                }
+
+                if (num >= range->lo) {
+                    collect_prime(collect, num);
+                }
+                unmarked &= unmarked - 1;
+            }
+        }
+    }
+
+    ++collect->turn;
+    pthread_cond_broadcast(&collect->turn_changed);
+    pthread_mutex_unlock(&collect->lock);
+}
+
+static void* do_collect(void* job_params) {
+    collect_job_t* job = (collect_job_t*)job_params;
+    collect_t* collect = job->collect;
+    sieve_range_t const* range = &collect->range;
+
+    struct timespec start, end;
+    perf_job_t perf;
+    perf_job_open(&perf, job->job_id);
+
+    size_t num_large = range->num_primes - range->num_small;
+    size_t chunk_size = collect->segment_size * collect->chunk_segments;
+    size_t chunks = 0;
+
+    while (!atomic_load(&collect->stopped)) {
+        size_t chunk = atomic_fetch_add(&collect->next_chunk, 1);
+        if (chunk >= collect->num_chunks) {
+            break;
+        }
+
+        PTIME
+        (
+            "working",
+            TRACE_BEGIN(job->job_id, TRACE_STRIKE, chunks);
+            size_t chunk_start = range->start_byte + chunk * chunk_size;
+            size_t chunk_end = range->end_byte - chunk_start < chunk_size ? range->end_byte : chunk_start + chunk_size;
+            size_t num_segments = (chunk_end - chunk_start + collect->segment_size - 1) / collect->segment_size;
+
+            sieve_range_seek(range, job->sieving, chunk_start);
+            int ret = num_large > 0 ? bucket_sieve_seed(&job->buckets, range->primes + range->num_small, num_large,
+                                                        chunk_start, num_segments) : 0;
+
+            // Counting is done a segment at a time, while the segment's still in cache
+            size_t count = 0;
+            for (size_t i = 0; i < num_segments && ret == 0; ++i) {
+                size_t seg_start = chunk_start + i * collect->segment_size;
+                size_t seg_len = chunk_end - seg_start < collect->segment_size ? chunk_end - seg_start
+                                                                                : collect->segment_size;
+                unsigned char* segment = job->chunk + (seg_start - chunk_start);
+
+                sieve_range_segment(range, job->sieving, segment, seg_start, seg_len);
+                if (num_large > 0) {
+                    ret = bucket_sieve_segment(&job->buckets, segment, seg_len, i);
+                }
+
+                if (collect->mode == COLLECT_COUNT) {
+                    count += count_primes_wheel(segment, seg_len, seg_start, range->lo, range->hi);
+                }
+            }
+            TRACE_END(job->job_id, TRACE_STRIKE, chunks);
+
+            TRACE_BEGIN(job->job_id, TRACE_PUBLISH, chunks);
+            if (ret == -1) {
+                collect_fail(collect, errno);
+            } else if (collect->mode == COLLECT_COUNT) {
+                atomic_fetch_add(&collect->count, count);
+            } else {
+                collect_deliver(collect, job->chunk, chunk_end - chunk_start, chunk_start, chunk);
+            }
+            TRACE_END(job->job_id, TRACE_PUBLISH, chunks);
+        )
+        ++chunks;
+    }
+
+    perf_job_close(&perf);
+    return NULL;
+}
+
+// Sieves a range in process with the segmented engine's jobs and chunks, doing whatever collect->mode says with
+// each chunk
+static int collect_run(collect_t* collect, sieve_config_t const* config) {
+    if (config->num_jobs == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t segment_size = config->segment_size ? config->segment_size : default_segment_size();
+    if (segmented_range_init(&collect->range, config->lo, config->hi, segment_size) == -1) {
+        return -1;
+    }
+
+    sieve_range_t const* range = &collect->range;
+    collect->segment_size = segment_size;
+    collect->chunk_segments = segmented_chunk_segments(range, segment_size);
+
+    size_t chunk_size = segment_size * collect->chunk_segments;
+    collect->num_chunks = (range->end_byte - range->start_byte + chunk_size - 1) / chunk_size;
+    atomic_init(&collect->next_chunk, 0);
+    atomic_init(&collect->count, 0);
+    atomic_init(&collect->stopped, 0);
+    pthread_mutex_init(&collect->lock, NULL);
+    pthread_cond_init(&collect->turn_changed, NULL);
+    collect->turn = 0;
+    collect->result = 0;
+    collect->error = 0;
+    collect->batch_len = 0;
+
+    // Everything a job needs is allocated up front, so a job can only fail while filling its buckets
+    size_t num_jobs = config->num_jobs;
+    size_t num_large = range->num_primes - range->num_small;
+    collect_job_t* jobs = calloc(num_jobs, sizeof(collect_job_t));
+    pthread_t* threads = malloc(sizeof(pthread_t) * num_jobs);
+    size_t started = 0;
+    int ret = jobs && threads ? 0 : -1;
+
+    for (size_t i = 0; i < num_jobs && ret == 0; ++i) {
+        collect_job_t* job = &jobs[i];
+        job->job_id = i;
+        job->collect = collect;
+        job->chunk = malloc(chunk_size);
+        job->sieving = malloc(sizeof(sieving_prime_t) * (range->num_small ? range->num_small : 1));
+        if (!job->chunk || !job->sieving ||
+            (num_large > 0 && bucket_sieve_init(&job->buckets, segment_size, collect->chunk_segments) == -1)) {
+            ret = -1;
+        } else if ((errno = pthread_create(&threads[i], NULL, do_collect, job)) != 0) {
+            if (num_large > 0) {
+                bucket_sieve_free(&job->buckets);
+            }
+            ret = -1;
+        } else {
+            ++started;
+        }
+    }
+    int error = errno;
+
+    // If a job couldn't be started, the ones that were still need stopping
+    if (ret == -1) {
+        collect_fail(collect, ENOMEM);
+    }
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The last batch is whatever's left over, unless the run was stopped
+    if (ret == 0 && collect->result == 0 && collect->mode == COLLECT_STREAM && collect->batch_len > 0) {
+        collect->result = collect->callback(collect->batch, collect->batch_len, collect->user);
+    }
+
+    if (ret == 0 && collect->result == -1) {
+        error = collect->error;
+    }
+    if (ret == 0) {
+        ret = collect->result;
+    }
+
+    for (size_t i = 0; jobs && i < num_jobs; ++i) {
+        if (i < started && num_large > 0) {
+            bucket_sieve_free(&jobs[i].buckets);
+        }
+        free(jobs[i].sieving);
+        free(jobs[i].chunk);
+    }
+    free(threads);
+    free(jobs);
+    pthread_cond_destroy(&collect->turn_changed);
+    pthread_mutex_destroy(&collect->lock);
+    sieve_range_free(&collect->range);
+
+    if (ret == -1) {
+        errno = error;
+    }
+    return ret;
+}
+
+int sieve_stream(sieve_config_t const* config, size_t batch_size, sieve_callback_t callback, void* user) {
+    if (batch_size == 0 || !callback) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    collect_t collect;
+    collect.mode = COLLECT_STREAM;
+    collect.callback = callback;
+    collect.bitmap_callback = NULL;
+    collect.user = user;
+    collect.batch_size = batch_size;
+    collect.batch = malloc(sizeof(size_t) * batch_size);
+    if (!collect.batch) {
+        return -1;
+    }
+
+    int ret = collect_run(&collect, config);
+    int error = errno;
+    free(collect.batch);
+    errno = error;
+    return ret;
+}
+
+int sieve_stream_bitmap(sieve_config_t const* config, sieve_bitmap_callback_t callback, void* user) {
+    if (!callback) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    collect_t collect;
+    collect.mode = COLLECT_BITMAP;
+    collect.callback = NULL;
+    collect.bitmap_callback = callback;
+    collect.user = user;
+    collect.batch = NULL;
+    collect.batch_size = 0;
+    return collect_run(&collect, config);
+}
+
+int sieve_count(sieve_config_t const* config, size_t* count) {
+    collect_t collect;
+    collect.mode = COLLECT_COUNT;
+    collect.callback = NULL;
+    collect.bitmap_callback = NULL;
+    collect.batch = NULL;
+    collect.batch_size = 0;
+
+    if (collect_run(&collect, config) == -1) {
+        return -1;
+    }
+
+    *count = atomic_load(&collect.count);
+    return 0;
+}
+
+// Where sieve_fill() has got to
+typedef struct {
+    size_t* primes;
+    size_t cap;
+    size_t count;
+    int full;
+} fill_state_t;
+
+static int fill_batch(size_t const* primes, size_t count, void* user) {
+    fill_state_t* state = (fill_state_t*)user;
+
+    size_t room = state->cap - state->count;
+    size_t take = count < room ? count : room;
+    memcpy(state->primes + state->count, primes, sizeof(size_t) * take);
+    state->count += take;
+
+    // Stop once there's a prime that didn't fit
+    state->full = take < count;
+    return state->full;
+}
+
+int sieve_fill(sieve_config_t const* config, size_t* primes, size_t cap, size_t* count) {
+    fill_state_t state = {primes, cap, 0, 0};
+
+    // One prime more than fits is enough to tell that the buffer's too small
+    size_t batch_size = cap < 65536 ? cap + 1 : 65536;
+    int ret = sieve_stream(config, batch_size, fill_batch, &state);
+    *count = state.count;
+
+    if (ret == -1) {
+        return -1;
+    } else if (state.full) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <stddef.h>
+
+#include "output.h"
+
+/*
+ * libsieve: the sieve as a library.
+ *
+ * A run is described by a sieve_config_t. sieve_run() hands it to one of the engines, which write their primes to
+ * PRIMES_FILENAME or PRIME_TABLE_FILENAME and report on stdout as assn1 always has. The other entry points keep the
+ * primes in the process instead: sieve_stream() passes them to a callback in batches, in increasing order,
+ * sieve_count() only counts them, sieve_fill() copies them into a buffer, and sieve_stream_bitmap() passes on the
+ * packed composites arrays they're read from. Those run the segmented engine's jobs and segments (so memory use doesn't
+ * grow with the width of the range), print nothing, and report errors through their return values rather than exiting.
+ */
+
+typedef enum {
+    SIEVE_ENGINE_THREAD, // concurrent_sieve_thread()
+    SIEVE_ENGINE_PROCESS, // concurrent_sieve_process()
+    SIEVE_ENGINE_SEGMENTED, // concurrent_sieve_segmented()
+    SIEVE_ENGINE_SHARED, // concurrent_sieve_shared()
+    SIEVE_ENGINE_HYBRID // concurrent_sieve_hybrid()
+} sieve_engine_t;
+
+/**
+ * What to sieve and how. Set it up with sieve_config_init() and then change what's needed.
+ */
+typedef struct {
+    sieve_engine_t engine; // Only used by sieve_run()
+    size_t lo;
+    size_t hi; // Every prime in [lo, hi) is found
+    size_t num_jobs;
+    size_t segment_size; // In bytes of the packed composites array, or 0 for default_segment_size()
+
+    // Only used by sieve_run()
+    output_format_t format;
+    size_t num_processes; // For SIEVE_ENGINE_HYBRID, or 0 for one per NUMA node
+    char const* checkpoint; // For SIEVE_ENGINE_SEGMENTED (see checkpoint.h), or NULL for none
+} sieve_config_t;
+
+/**
+ * Gets a batch of primes from sieve_stream(). Batches are delivered one at a time, in order, from whichever job
+ * sieved them.
+ *
+ * @param primes The primes, in increasing order. Only valid until the callback returns.
+ * @param count  The number of primes. Every batch but the last has the batch size given to sieve_stream().
+ * @param user   The pointer given to sieve_stream().
+ * @return 0 to carry on, or a positive value to stop sieving.
+ */
+typedef int (*sieve_callback_t)(size_t const* primes, size_t count, void* user);
+
+/**
+ * Gets a chunk of the packed composites array (see common.h) from sieve_stream_bitmap(). Chunks are delivered one
+ * at a time, in order, from whichever job sieved them.
+ *
+ * @param bitmap     The chunk. Bits for numbers outside [lo, hi) are set, as if they were composite. Only valid until
+ *                   the callback returns.
+ * @param len        The length of the chunk in bytes.
+ * @param start_byte The index of the chunk's first byte.
+ * @param user       The pointer given to sieve_stream_bitmap().
+ * @return 0 to carry on, or a positive value to stop sieving.
+ */
+typedef int (*sieve_bitmap_callback_t)(unsigned char const* bitmap, size_t len, size_t start_byte, void* user);
+
+/**
+ * Sets up a config for the segmented engine over [0, hi) with one job, the default segment size and text output.
+ *
+ * @param config The config.
+ * @param hi     The number below which all primes will be found.
+ */
+void sieve_config_init(sieve_config_t* config, size_t hi);
+
+/**
+ * Runs an engine and writes the primes out to a file, as assn1 does. Like the engines themselves, this prints its
+ * progress and exits the process if anything goes wrong once it's started.
+ *
+ * Only the segmented engine supports lo > 0 (with text output) and a checkpoint (with lo = 0), only the hybrid one
+ * takes a number of processes, hi must be in [10, SIEVE_RANGE_MAX], and there can be at most one job for each byte
+ * of the packed composites array in the range.
+ *
+ * @param config The config.
+ * @return 0 on success, or -1 if the config isn't supported (with errno set to EINVAL).
+ */
+int sieve_run(sieve_config_t const* config);
+
+/**
+ * Sieves [lo, hi) and passes the primes to a callback in batches, in increasing order.
+ *
+ * @param config     The config. hi must be > lo and <= SIEVE_RANGE_MAX.
+ * @param batch_size The most primes in each batch. Must be > 0.
+ * @param callback   The callback.
+ * @param user       Passed on to the callback.
+ * @return 0 once every prime has been delivered, the callback's return value if it stopped early, or -1 on error
+ *         (with errno set).
+ */
+int sieve_stream(sieve_config_t const* config, size_t batch_size, sieve_callback_t callback, void* user);
+
+/**
+ * Sieves [lo, hi) and passes the packed composites array to a callback a chunk at a time, in order, from the byte
+ * holding lo to the one holding hi - 1. 2, 3 and 5 aren't in it.
+ *
+ * @param config   The config. hi must be > lo and <= SIEVE_RANGE_MAX.
+ * @param callback The callback.
+ * @param user     Passed on to the callback.
+ * @return 0 once every chunk has been delivered, the callback's return value if it stopped early, or -1 on error
+ *         (with errno set).
+ */
+int sieve_stream_bitmap(sieve_config_t const* config, sieve_bitmap_callback_t callback, void* user);
+
+/**
+ * Counts the primes in [lo, hi) without ever listing them. Each segment is popcounted while it's still in cache, and
+ * the jobs don't wait for each other.
+ *
+ * @param config The config. hi must be > lo and <= SIEVE_RANGE_MAX.
+ * @param count  Set to the number of primes.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int sieve_count(sieve_config_t const* config, size_t* count);
+
+/**
+ * Sieves [lo, hi) into a buffer, in increasing order, stopping once it's full.
+ *
+ * @param config The config. hi must be > lo and <= SIEVE_RANGE_MAX.
+ * @param primes The buffer.
+ * @param cap    The number of primes the buffer has room for.
+ * @param count  Set to the number of primes written to the buffer.
+ * @return 0 if every prime fitted, or -1 on error (with errno set to ENOBUFS if the buffer was too small, in which
+ *         case it holds the first cap primes).
+ */
+int sieve_fill(sieve_config_t const* config, size_t* primes, size_t cap, size_t* count);
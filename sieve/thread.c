@@ -1,209 +1,312 @@
-#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "thread.h"
+#include "arena.h"
 #include "common.h"
+#include "futex.h"
+#include "output.h"
+#include "presieve.h"
+#include "prime_table.h"
+#include "scheduler.h"
+#include "../perf.h"
 #include "../timing.h"
+#include "../trace.h"
 
 typedef struct {
-    // Synchronisation and "IPC" variables
-    pthread_mutex_t cond_mutex;
-    pthread_cond_t cond_var;
-    atomic_size_t slave_minimum; // The variable that slaves will write the new minimum to
-    atomic_size_t master_minimum; // Contains the new minimum written by the master; slaves wait for this to change
-
-    // Info about remaining jobs
-    atomic_size_t waiting_jobs; // Jobs that have finished work for this iteration
-    atomic_size_t completed_jobs; // Jobs that finished all work in this iteration
-    atomic_size_t filed_jobs; // Number of jobs that have written all info to file
+    // Synchronisation and "IPC" variables. Each round, the master publishes a batch of sieving primes and opens
+    // round_start; the jobs strike the whole batch and meet the master again at round_end.
+    futex_barrier_t round_start;
+    futex_barrier_t round_end;
+
+    // The sieving primes for the current round. Only written by the master while the jobs are at a barrier.
+    size_t* batch;
+    size_t batch_size; // Zero once there are no sieving primes left
+
+    // Hands out the segments of the packed composites array to the jobs each round
+    segment_scheduler_t sched;
+    size_t segment_size;
+    size_t len; // Length of the whole packed composites array in bytes
+    unsigned char* composites;
+
+    // Every job writes its slice of the primes straight into the one output file, at an offset worked out from the
+    // text sizes of the slices before it. A binary table is just the packed composites array, so the jobs copy their
+    // slices straight into it instead.
+    output_format_t format;
+    int primes_fd;
+    size_t* text_sizes;
+    prime_table_t table;
 } thread_sync_t;
 
 typedef struct {
     size_t job_id;
-    size_t slice_start;
-    size_t slice_size;
-    char* composites;
+    size_t slice_start; // Index of the first byte in the packed composites array that this job writes out
+    size_t slice_size; // Length of the slice in bytes
+    size_t limit;
+    unsigned char* composites;
 
     thread_sync_t* sync;
 } job_params_t;
 
 static void* do_sieve(void* job_params) {
     job_params_t* params = (job_params_t*)job_params;
-
-    size_t prev_min = 0;
-    size_t job_min = 0;
+    thread_sync_t* sync = params->sync;
 
     struct timespec start, end;
-    double ms_ipc = 0.0;
+    double ms_idle = 0.0;
     double ms_working = 0.0;
 
-    while (1) {
-        size_t new_min;
+    perf_job_t perf;
+    perf_job_open(&perf, params->job_id);
 
-        CTIME
-        (
-            atomic_fetch_add(&params->sync->waiting_jobs, 1);
+    // Fault in and pre-sieve our own slice, in parallel with the other jobs, before the master looks for primes
+    PTIME("working", presieve_fill(params->composites, params->slice_size, params->slice_start))
+    ms_working += get_delay(start, end);
+    futex_barrier_wait(&sync->round_end);
 
-            if (job_min == (size_t)-1) {
-                atomic_fetch_add(&params->sync->completed_jobs, 1);
-                break;
-            }
+    size_t round = 0;
+    for (;; ++round) {
+        TRACE_BEGIN(params->job_id, TRACE_WAIT, round);
+        PTIME("idle", futex_barrier_wait(&sync->round_start))
+        ms_idle += get_delay(start, end);
+        TRACE_END(params->job_id, TRACE_WAIT, round);
+
+        // The master sends an empty batch once there are no sieving primes left
+        if (sync->batch_size == 0) {
+            break;
+        }
 
-            pthread_mutex_lock(&params->sync->cond_mutex);
-            while((new_min = atomic_load(&params->sync->master_minimum)) == prev_min) {
-                pthread_cond_wait(&params->sync->cond_var, &params->sync->cond_mutex);
+        // Sieve whatever segments the scheduler hands out, applying the whole batch to each one while it's in cache
+        TRACE_BEGIN(params->job_id, TRACE_STRIKE, round);
+        PTIME
+        (
+            "working",
+            size_t segment;
+            while (scheduler_next(&sync->sched, params->job_id, &segment)) {
+                size_t seg_start = segment * sync->segment_size;
+                size_t seg_len = sync->len - seg_start < sync->segment_size ? sync->len - seg_start : sync->segment_size;
+
+                for (size_t i = 0; i < sync->batch_size; ++i) {
+                    strike_multiples_wheel(sync->composites + seg_start, seg_len, seg_start, sync->batch[i]);
+                }
             }
-            pthread_mutex_unlock(&params->sync->cond_mutex);
         )
-        ms_ipc += get_delay(start, end);
-        prev_min = new_min;
+        ms_working += get_delay(start, end);
+        TRACE_END(params->job_id, TRACE_STRIKE, round);
 
+        TRACE_BEGIN(params->job_id, TRACE_WAIT, round);
+        PTIME("idle", futex_barrier_wait(&sync->round_end))
+        ms_idle += get_delay(start, end);
+        TRACE_END(params->job_id, TRACE_WAIT, round);
+    }
 
-        CTIME(job_min = strike_multiples(params->composites, params->slice_size, params->slice_start, new_min))
+    off_t offset = 0;
+    TRACE_BEGIN(params->job_id, TRACE_OUTPUT, round);
+    if (sync->format == OUTPUT_TABLE) {
+        PTIME("working", memcpy(sync->table.bitmap + params->slice_start, params->composites, params->slice_size))
         ms_working += get_delay(start, end);
-
-        CTIME
+    } else {
+        PTIME
         (
-            if (job_min != (size_t)-1) {
-                // Keep trying to write the job's minimum value to the slave minimum variable until either
-                // * The write succeeds, or
-                // * The new value is <= our minimum value
-                size_t cur_slave_min = atomic_load(&params->sync->slave_minimum);
-                while(1) {
-                    if (cur_slave_min <= job_min) {
-                        break;
-                    } else {
-                        if (atomic_compare_exchange_strong(&params->sync->slave_minimum, &cur_slave_min, job_min)) {
-                            break;
-                        }
-                    }
-                }
-            }
+            "working",
+            sync->text_sizes[params->job_id] = primes_text_size_wheel(params->composites, params->slice_size,
+                                                                      params->slice_start, params->limit);
         )
-        ms_ipc += get_delay(start, end);
-    }
+        ms_working += get_delay(start, end);
 
-    CTIME
-    (
-        char primes_filename[32];
-        snprintf(primes_filename, 32, "thread%lu", params->job_id);
-        FILE* primes = fopen(primes_filename, "w");
-        for(size_t i = 0; i < params->slice_size; ++i) {
-            if (!params->composites[i]) {
-                fprintf(primes, "%lu\n", i + params->slice_start);
-            }
+        // Wait for every job to size up its slice
+        TRACE_BEGIN(params->job_id, TRACE_WAIT, round);
+        PTIME("idle", futex_barrier_wait(&sync->round_end))
+        ms_idle += get_delay(start, end);
+        TRACE_END(params->job_id, TRACE_WAIT, round);
+
+        for (size_t i = 0; i < params->job_id; ++i) {
+            offset += sync->text_sizes[i];
         }
-        fclose(primes);
-    )
-    ms_working += get_delay(start, end);
 
-    char timing_filename[32];
-    snprintf(timing_filename, 32, "thread%lu.time", params->job_id);
-    FILE* timing = fopen(timing_filename, "a");
-    fprintf(timing, "time doing IPC (ms): %.4lf\n", ms_ipc);
-    fprintf(timing, "time working (ms): %.4lf\n", ms_working);
-    fclose(timing);
+        PTIME
+        (
+            "working",
+            if (write_primes_wheel(sync->primes_fd, offset, params->composites, params->slice_size,
+                                   params->slice_start, params->limit) == -1) {
+                perror("Error writing primes");
+                exit(EXIT_FAILURE);
+            }
+        )
+        ms_working += get_delay(start, end);
+    }
+    TRACE_END(params->job_id, TRACE_OUTPUT, round);
+
+    perf_job_close(&perf);
+
+    // With counters on, the phases go in the one report instead, and the scheduler's counts are printed here
+    char timing_filename[32] = PERF_REPORT_FILENAME;
+    if (perf_session_active()) {
+        printf("Job %lu sieved %lu segments and stole %lu.\n", params->job_id,
+               sync->sched.queues[params->job_id].sieved, sync->sched.queues[params->job_id].stolen);
+    } else {
+        snprintf(timing_filename, 32, "thread%lu.time", params->job_id);
+        FILE* timing = fopen(timing_filename, "a");
+        fprintf(timing, "time idle (ms): %.4lf\n", ms_idle);
+        fprintf(timing, "time working (ms): %.4lf\n", ms_working);
+        fprintf(timing, "segments sieved: %lu\n", sync->sched.queues[params->job_id].sieved);
+        fprintf(timing, "segments stolen: %lu\n", sync->sched.queues[params->job_id].stolen);
+        fclose(timing);
+    }
 
-    printf("Job %lu finished. Primes written to %s. Timing info written to %s.\n", params->job_id, primes_filename, timing_filename);
+    if (sync->format == OUTPUT_TABLE) {
+        printf("Job %lu finished. Slice copied to %s. Timing info written to %s.\n", params->job_id,
+               PRIME_TABLE_FILENAME, timing_filename);
+    } else {
+        printf("Job %lu finished. Primes written to %s at offset %ld. Timing info written to %s.\n", params->job_id,
+               PRIMES_FILENAME, (long)offset, timing_filename);
+    }
 
-    free(job_params);
-    atomic_fetch_add(&params->sync->filed_jobs, 1);
     return NULL;
 }
 
-void concurrent_sieve_thread(size_t limit, size_t num_jobs) {
-
-    char* composites = calloc(limit - 3, 1);
-    if (!composites) {
+void concurrent_sieve_thread(size_t limit, size_t num_jobs, size_t segment_size, output_format_t format) {
+    // The jobs pre-sieve their own slices, which is what faults the pages in
+    size_t len = wheel_bytes(limit);
+    sieve_arena_t arena;
+    if (arena_acquire(&arena, len, 0) == -1) {
         perror("Error while allocating memory:");
         exit(EXIT_FAILURE);
     }
+    unsigned char* composites = arena_alloc(&arena, len);
+
+    // The largest root with root * root < limit
+    size_t root = isqrt(limit - 1);
 
     thread_sync_t s;
-    s.slave_minimum = 2;
-    s.master_minimum = 0;
-    s.waiting_jobs = 0;
-    s.completed_jobs = 0;
-    s.filed_jobs = 0;
-
-    if (pthread_mutex_init(&s.cond_mutex, NULL) == -1) {
-        perror("Error while initialising mutex:");
-        free(composites);
+    futex_barrier_init(&s.round_start, num_jobs + 1);
+    futex_barrier_init(&s.round_end, num_jobs + 1);
+    s.batch_size = 0;
+    s.segment_size = segment_size;
+    s.len = len;
+    s.composites = composites;
+
+    s.format = format;
+    s.primes_fd = -1;
+    s.text_sizes = malloc(sizeof(size_t) * num_jobs);
+    if (format == OUTPUT_TABLE) {
+        if (prime_table_create(&s.table, PRIME_TABLE_FILENAME, limit) == -1) {
+            perror("Error while creating " PRIME_TABLE_FILENAME);
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        s.primes_fd = open(PRIMES_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (s.primes_fd == -1 || !s.text_sizes) {
+            perror("Error while opening " PRIMES_FILENAME);
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (scheduler_init(&s.sched, (len + segment_size - 1) / segment_size, num_jobs) == -1) {
+        perror("Error while setting up scheduler");
+        arena_destroy(&arena);
         exit(EXIT_FAILURE);
     }
 
-    if (pthread_cond_init(&s.cond_var, NULL) == -1) {
-        perror("Error while initialising cond variable:");
-        pthread_mutex_destroy(&s.cond_mutex);
-        free(composites);
+    // A batch never holds more sieving primes than there are candidates up to the root
+    s.batch = malloc(sizeof(size_t) * wheel_bytes(root + 1) * WHEEL_SPOKES);
+
+    job_params_t* params = malloc(sizeof(job_params_t) * num_jobs);
+    pthread_t* threads = malloc(sizeof(pthread_t) * num_jobs);
+    if (!s.batch || !params || !threads) {
+        perror("Error while allocating job parameters:");
+        arena_destroy(&arena);
         exit(EXIT_FAILURE);
     }
 
-    size_t start = 3;
     size_t extra;
     size_t slice_size;
 
     get_slices(num_jobs, limit, &slice_size, &extra);
 
     for (size_t i = 0; i < num_jobs; ++i) {
-        size_t slice_start = start + i * slice_size;
-        size_t cur_slice_size = slice_size + (i == num_jobs - 1 ? extra : 0);
-
-        job_params_t* params = malloc(sizeof(job_params_t));
-        if (!params) {
-            perror("Error while allocating job parameters:");
-            free(composites);
-            pthread_mutex_destroy(&s.cond_mutex);
-            pthread_cond_destroy(&s.cond_var);
-            exit(EXIT_FAILURE);
-        }
+        params[i].job_id = i;
+        params[i].slice_start = i * slice_size;
+        params[i].slice_size = slice_size + (i == num_jobs - 1 ? extra : 0);
+        params[i].limit = limit;
+        params[i].composites = composites + (i * slice_size);
+        params[i].sync = &s;
+
+        pthread_create(&threads[i], NULL, do_sieve, &params[i]);
+    }
 
-        params->job_id = i;
-        params->slice_start = slice_start;
-        params->slice_size = cur_slice_size;
-        params->composites = composites + (i * slice_size);
-        params->sync = &s;
+    // Wait for the jobs to pre-sieve their slices
+    futex_barrier_wait(&s.round_end);
 
-        pthread_t thread;
-        pthread_create(&thread, NULL, do_sieve, params);
-        pthread_detach(thread);
-    }
+    // Once every prime below lo has been struck, every number below lo * lo is settled, so the next round can
+    // sieve with all the primes in [lo, lo * lo) at once. Everything below PRESIEVE_NEXT_PRIME is taken care of by
+    // the packed layout and the pre-sieve.
+    struct timespec start, end;
+    size_t round = 0;
+    for (size_t lo = PRESIEVE_NEXT_PRIME; lo <= root; ++round) {
+        size_t hi = lo * lo < root + 1 ? lo * lo : root + 1;
+
+        CTIME
+        (
+            TRACE_BEGIN(num_jobs, TRACE_PUBLISH, round);
+            s.batch_size = 0;
+            for (size_t p = next_unmarked_wheel(composites, len, 0, lo - 1); p < hi; p = next_unmarked_wheel(composites, len, 0, p)) {
+                s.batch[s.batch_size++] = p;
+            }
 
-    size_t remaining_jobs = num_jobs;
-    size_t new_min = 2;
-    while (1) {
-        // Wait for all threads to sleep
-        while(atomic_load(&s.waiting_jobs) != remaining_jobs);
+            scheduler_reset(&s.sched);
+            TRACE_END(num_jobs, TRACE_PUBLISH, round);
 
-        remaining_jobs -= atomic_load(&s.completed_jobs);
-        if (remaining_jobs == 0) {
-            break;
-        }
+            TRACE_BEGIN(num_jobs, TRACE_WAIT, round);
+            futex_barrier_wait(&s.round_start);
+            futex_barrier_wait(&s.round_end);
+            TRACE_END(num_jobs, TRACE_WAIT, round);
+        )
+        printf("Round %lu: struck %lu sieving primes in [%lu, %lu) in %.4fms.\n", round, s.batch_size, lo, hi, get_delay(start, end));
 
-        atomic_store(&s.completed_jobs, 0);
-        atomic_store(&s.waiting_jobs, 0);
+        lo = hi;
+    }
 
-        // Reset the slave minimum
-        new_min = atomic_load(&s.slave_minimum);
-        atomic_store(&s.slave_minimum, (size_t)-1);
+    // Tell the jobs that there's nothing left to sieve
+    s.batch_size = 0;
+    futex_barrier_wait(&s.round_start);
 
-        // Signal the threads. Grab the mutex just in case one of the threads happens to spuriously
-        // wake up, read the new variable, and finish all its work between setting the new minimum
-        // and signaling the condition var
-        pthread_mutex_lock(&s.cond_mutex);
-        atomic_store(&s.master_minimum, new_min);
-        pthread_cond_broadcast(&s.cond_var);
-        pthread_mutex_unlock(&s.cond_mutex);
+    // Let the jobs write out their primes once they've all sized up their slices
+    if (format == OUTPUT_TEXT) {
+        futex_barrier_wait(&s.round_end);
     }
 
-    // Wait for all threads to finish writing to file
-    while(atomic_load(&s.filed_jobs) != num_jobs);
+    size_t stolen = 0;
+    for (size_t i = 0; i < num_jobs; ++i) {
+        pthread_join(threads[i], NULL);
+        stolen += s.sched.queues[i].stolen;
+    }
+    printf("%lu segments per round over %lu rounds; %lu stolen in total.\n", s.sched.num_segments, round, stolen);
 
-    // Clean up
-    pthread_mutex_destroy(&s.cond_mutex);
-    pthread_cond_destroy(&s.cond_var);
+    if (format == OUTPUT_TABLE) {
+        CTIME
+        (
+            if (prime_table_finish(&s.table) == -1) {
+                perror("Error writing " PRIME_TABLE_FILENAME);
+                exit(EXIT_FAILURE);
+            }
+        )
+        printf("Prime table written to %s in %.4fms.\n", PRIME_TABLE_FILENAME, get_delay(start, end));
+    } else {
+        close(s.primes_fd);
+    }
 
-    free(composites);
-}
\ No newline at end of file
+    // Clean up
+    scheduler_destroy(&s.sched);
+    free(threads);
+    free(params);
+    free(s.batch);
+    free(s.text_sizes);
+    arena_release(&arena);
+}
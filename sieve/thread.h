@@ -1,4 +1,17 @@
 #pragma once
 #include <stddef.h>
 
-void concurrent_sieve_thread(size_t limit, size_t num_jobs);
\ No newline at end of file
+#include "output.h"
+
+/**
+ * Runs the sieve using threads that share one packed composites array.
+ *
+ * The master finds the sieving primes in batches, and each round the jobs strike the whole batch over the segments
+ * handed out by a work-stealing scheduler. Each job then writes out the primes in its share of the array.
+ *
+ * @param limit        The number below which all primes will be calculated.
+ * @param num_jobs     The number of jobs (threads) to use.
+ * @param segment_size The size of each scheduled segment in bytes of the packed composites array.
+ * @param format       Whether to write the primes as text or as a binary prime table.
+ */
+void concurrent_sieve_thread(size_t limit, size_t num_jobs, size_t segment_size, output_format_t format);
\ No newline at end of file
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "topology.h"
+
+// Parses a kernel CPU or node list such as "0-3,8,10-11" into the members that are set in allowed (if given)
+static int parse_list(char const* list, cpu_set_t const* allowed, int** members, size_t* count) {
+    size_t capacity = 16;
+    *members = malloc(sizeof(int) * capacity);
+    *count = 0;
+    if (!*members) {
+        return -1;
+    }
+
+    char const* p = list;
+    while (*p && *p != '\n') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) {
+            free(*members);
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                free(*members);
+                errno = EINVAL;
+                return -1;
+            }
+        }
+
+        for (long m = first; m <= last; ++m) {
+            if (allowed && (m >= CPU_SETSIZE || !CPU_ISSET(m, allowed))) {
+                continue;
+            }
+
+            if (*count == capacity) {
+                capacity *= 2;
+                int* grown = realloc(*members, sizeof(int) * capacity);
+                if (!grown) {
+                    free(*members);
+                    return -1;
+                }
+                *members = grown;
+            }
+            (*members)[(*count)++] = (int)m;
+        }
+
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+// Reads a whole (small) sysfs file into buf
+static int read_file(char const* path, char* buf, size_t size) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    size_t n = fread(buf, 1, size - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return 0;
+}
+
+int topology_read(numa_topology_t* topo) {
+    topo->nodes = NULL;
+    topo->num_nodes = 0;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        return -1;
+    }
+
+    // Big enough for the CPU list of any machine we'd run on
+    char buf[8192];
+    int* node_ids = NULL;
+    size_t num_ids = 0;
+    if (read_file(TOPOLOGY_NODE_PATH "/online", buf, sizeof(buf)) == 0) {
+        if (parse_list(buf, NULL, &node_ids, &num_ids) == -1) {
+            return -1;
+        }
+    }
+
+    topo->nodes = malloc(sizeof(numa_node_t) * (num_ids ? num_ids : 1));
+    if (!topo->nodes) {
+        free(node_ids);
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_ids; ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), TOPOLOGY_NODE_PATH "/node%d/cpulist", node_ids[i]);
+
+        numa_node_t* node = &topo->nodes[topo->num_nodes];
+        node->id = node_ids[i];
+        if (read_file(path, buf, sizeof(buf)) == -1 || parse_list(buf, &allowed, &node->cpus, &node->num_cpus) == -1) {
+            free(node_ids);
+            topology_free(topo);
+            return -1;
+        }
+
+        if (node->num_cpus == 0) {
+            free(node->cpus);
+            continue;
+        }
+        ++topo->num_nodes;
+    }
+    free(node_ids);
+
+    // No NUMA: one node with everything
+    if (topo->num_nodes == 0) {
+        numa_node_t* node = &topo->nodes[0];
+        node->id = 0;
+        node->num_cpus = 0;
+        node->cpus = malloc(sizeof(int) * CPU_COUNT(&allowed));
+        if (!node->cpus) {
+            topology_free(topo);
+            return -1;
+        }
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                node->cpus[node->num_cpus++] = cpu;
+            }
+        }
+        topo->num_nodes = 1;
+    }
+
+    return 0;
+}
+
+void topology_free(numa_topology_t* topo) {
+    for (size_t i = 0; i < topo->num_nodes; ++i) {
+        free(topo->nodes[i].cpus);
+    }
+    free(topo->nodes);
+    topo->nodes = NULL;
+    topo->num_nodes = 0;
+}
+
+int topology_pin_node(numa_node_t const* node) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < node->num_cpus; ++i) {
+        CPU_SET(node->cpus[i], &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int topology_pin_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int topology_bind_memory(void* addr, size_t len, int node) {
+    // glibc doesn't wrap mbind, and this saves a dependency on libnuma
+    unsigned long mask[(CPU_SETSIZE + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    if (node < 0 || (size_t)node >= 8 * sizeof(mask)) {
+        errno = EINVAL;
+        return -1;
+    }
+    mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+    return (int)syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, 8 * sizeof(mask), 0);
+}
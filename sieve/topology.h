@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+
+/*
+ * NUMA topology, as read from /sys/devices/system/node.
+ *
+ * Only the CPUs that this process is allowed to run on are kept, and nodes without any of them (such as memory-only
+ * nodes) are left out. Without NUMA support in the kernel, the topology is one node (0) with every allowed CPU.
+ */
+
+// Where the kernel lists the nodes
+#define TOPOLOGY_NODE_PATH "/sys/devices/system/node"
+
+/**
+ * A NUMA node and its CPUs.
+ */
+typedef struct {
+    int id;
+    int* cpus;
+    size_t num_cpus;
+} numa_node_t;
+
+typedef struct {
+    numa_node_t* nodes;
+    size_t num_nodes;
+} numa_topology_t;
+
+/**
+ * Reads the NUMA topology.
+ *
+ * @param topo The topology to fill in.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int topology_read(numa_topology_t* topo);
+
+/**
+ * Frees a topology.
+ *
+ * @param topo The topology.
+ */
+void topology_free(numa_topology_t* topo);
+
+/**
+ * Pins the calling thread to a node's CPUs.
+ *
+ * @param node The node.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int topology_pin_node(numa_node_t const* node);
+
+/**
+ * Pins the calling thread to one CPU.
+ *
+ * @param cpu The CPU.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int topology_pin_cpu(int cpu);
+
+/**
+ * Asks for the pages of a range of memory to be placed on a node when they're first touched. A hint only: it fails
+ * harmlessly on kernels without NUMA support, and pages fall back to other nodes if the node runs out.
+ *
+ * @param addr The start of the range. Must be page aligned.
+ * @param len  The length of the range in bytes.
+ * @param node The node's ID.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int topology_bind_memory(void* addr, size_t len, int node);
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "tune.h"
+#include "common.h"
+#include "segmented.h"
+#include "topology.h"
+#include "../timing.h"
+
+#define CPUINFO_FILE "/proc/cpuinfo"
+#define CACHE_DIR "/sys/devices/system/cpu/cpu0/cache"
+
+// The most cache entries to look at in CACHE_DIR
+#define MAX_CACHE_INDEX 8
+
+// Timed runs of each candidate; the fastest counts, since anything slower was just disturbed
+#define TUNE_REPETITIONS 2
+
+#define MAX_CANDIDATES 16
+#define LINE_SIZE 512
+
+// Reads a size like "48K" or "2048K" from a sysfs file
+static size_t read_cache_size(char const* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    long size = 0;
+    char unit = 0;
+    if (fscanf(f, "%ld%c", &size, &unit) < 1 || size < 0) {
+        size = 0;
+    } else if (unit == 'K') {
+        size *= 1024;
+    } else if (unit == 'M') {
+        size *= 1024 * 1024;
+    }
+    fclose(f);
+    return (size_t)size;
+}
+
+// Fills in whichever of the cache sizes sysconf() didn't know from CACHE_DIR
+static void read_sysfs_caches(tune_hardware_t* hw) {
+    for (int i = 0; i < MAX_CACHE_INDEX; ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/index%d/level", CACHE_DIR, i);
+        FILE* f = fopen(path, "r");
+        if (!f) {
+            break;
+        }
+        int level = 0;
+        if (fscanf(f, "%d", &level) != 1) {
+            level = 0;
+        }
+        fclose(f);
+
+        char type[32] = "";
+        snprintf(path, sizeof(path), "%s/index%d/type", CACHE_DIR, i);
+        if ((f = fopen(path, "r"))) {
+            if (fscanf(f, "%31s", type) != 1) {
+                type[0] = '\0';
+            }
+            fclose(f);
+        }
+
+        snprintf(path, sizeof(path), "%s/index%d/size", CACHE_DIR, i);
+        if (level == 1 && strcmp(type, "Data") == 0 && hw->l1d == 0) {
+            hw->l1d = read_cache_size(path);
+        } else if (level == 2 && hw->l2 == 0) {
+            hw->l2 = read_cache_size(path);
+        } else if (level == 3 && hw->l3 == 0) {
+            hw->l3 = read_cache_size(path);
+        }
+    }
+}
+
+static size_t sysconf_size(int name) {
+    long value = sysconf(name);
+    return value > 0 ? (size_t)value : 0;
+}
+
+void tune_read_hardware(tune_hardware_t* hw) {
+    memset(hw, 0, sizeof(*hw));
+    strcpy(hw->model, "unknown");
+
+    FILE* f = fopen(CPUINFO_FILE, "r");
+    if (f) {
+        char line[LINE_SIZE];
+        while (fgets(line, sizeof(line), f)) {
+            char* colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) != 0 || !colon) {
+                continue;
+            }
+
+            // Trim the value, and keep it to one field of the tuning file
+            char* value = colon + 1;
+            value += strspn(value, " \t");
+            size_t len = strcspn(value, "\n");
+            while (len > 0 && value[len - 1] == ' ') {
+                --len;
+            }
+            if (len > 0) {
+                snprintf(hw->model, sizeof(hw->model), "%.*s", (int)len, value);
+                for (char* p = hw->model; *p; ++p) {
+                    if (*p == '\t') {
+                        *p = ' ';
+                    }
+                }
+            }
+            break;
+        }
+        fclose(f);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    hw->num_cpus = cpus > 0 ? (size_t)cpus : 1;
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    hw->l1d = sysconf_size(_SC_LEVEL1_DCACHE_SIZE);
+    hw->l2 = sysconf_size(_SC_LEVEL2_CACHE_SIZE);
+    hw->l3 = sysconf_size(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    if (hw->l1d == 0 || hw->l2 == 0 || hw->l3 == 0) {
+        read_sysfs_caches(hw);
+    }
+
+    numa_topology_t topo;
+    hw->num_nodes = 1;
+    if (topology_read(&topo) == 0) {
+        hw->num_nodes = topo.num_nodes;
+        topology_free(&topo);
+    }
+}
+
+static char const* const engine_names[] = {"thread", "process", "segmented", "shared", "hybrid"};
+#define NUM_ENGINES (sizeof(engine_names) / sizeof(engine_names[0]))
+
+char const* tune_engine_name(sieve_engine_t engine) {
+    return (size_t)engine < NUM_ENGINES ? engine_names[engine] : "unknown";
+}
+
+static char const* format_name(output_format_t format) {
+    return format == OUTPUT_TABLE ? "table" : "text";
+}
+
+// Splits a line of the tuning file into its fields, in place. Returns 1 if it's for this hardware and format.
+static int parse_line(char* line, tune_hardware_t const* hw, output_format_t format, tune_choice_t* choice) {
+    char* fields[7];
+    size_t n = 0;
+    line[strcspn(line, "\n")] = '\0';
+    for (char* p = line; n < 7; ++n) {
+        fields[n] = p;
+        char* tab = strchr(p, '\t');
+        if (!tab) {
+            ++n;
+            break;
+        }
+        *tab = '\0';
+        p = tab + 1;
+    }
+
+    size_t cpus;
+    if (n != 7 || strcmp(fields[0], hw->model) != 0 || sscanf(fields[1], "%lu", &cpus) != 1 ||
+        cpus != hw->num_cpus || strcmp(fields[2], format_name(format)) != 0) {
+        return 0;
+    }
+
+    size_t e = 0;
+    while (e < NUM_ENGINES && strcmp(fields[3], engine_names[e]) != 0) {
+        ++e;
+    }
+    if (e == NUM_ENGINES || sscanf(fields[4], "%lu", &choice->num_jobs) != 1 || choice->num_jobs == 0 ||
+        sscanf(fields[5], "%lu", &choice->segment_size) != 1 || sscanf(fields[6], "%lf", &choice->ms) != 1) {
+        return 0;
+    }
+    choice->engine = (sieve_engine_t)e;
+    return 1;
+}
+
+int tune_load(char const* path, tune_hardware_t const* hw, output_format_t format, tune_choice_t* choice) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    int found = 0;
+    char line[LINE_SIZE];
+    while (!found && fgets(line, sizeof(line), f)) {
+        if (line[0] != '#') {
+            found = parse_line(line, hw, format, choice);
+        }
+    }
+
+    int error = ferror(f);
+    fclose(f);
+    if (error) {
+        errno = EIO;
+        return -1;
+    }
+    return found;
+}
+
+int tune_save(char const* path, tune_hardware_t const* hw, output_format_t format, tune_choice_t const* choice) {
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE* out = fopen(tmp_path, "w");
+    if (!out) {
+        return -1;
+    }
+    fprintf(out, "# model\tcpus\tformat\tengine\tjobs\tsegment_size\tms\n");
+
+    // Keep everyone else's lines
+    FILE* in = fopen(path, "r");
+    if (in) {
+        char line[LINE_SIZE];
+        char copy[LINE_SIZE];
+        tune_choice_t ignored;
+        while (fgets(line, sizeof(line), in)) {
+            strcpy(copy, line);
+            if (line[0] != '#' && !parse_line(copy, hw, format, &ignored)) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+
+    fprintf(out, "%s\t%lu\t%s\t%s\t%lu\t%lu\t%.4f\n", hw->model, hw->num_cpus, format_name(format),
+            tune_engine_name(choice->engine), choice->num_jobs, choice->segment_size, choice->ms);
+
+    if (fflush(out) != 0 || fsync(fileno(out)) == -1) {
+        int error = errno;
+        fclose(out);
+        unlink(tmp_path);
+        errno = error;
+        return -1;
+    }
+    if (fclose(out) != 0 || rename(tmp_path, path) == -1) {
+        int error = errno;
+        unlink(tmp_path);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+void tune_clear_dir(char const* dir) {
+    DIR* d = opendir(dir);
+    if (!d) {
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(d))) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            unlinkat(dirfd(d), entry->d_name, 0);
+        }
+    }
+    closedir(d);
+}
+
+double tune_run_child(char const* dir, char const* out, tune_run_t run, void const* arg) {
+    int times[2];
+    if (pipe(times) == -1) {
+        return -1.0;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(times[0]);
+        close(times[1]);
+        return -1.0;
+    }
+
+    if (pid == 0) {
+        close(times[0]);
+
+        int fd = -1;
+        if (chdir(dir) == -1 || (fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1 ||
+            dup2(fd, STDOUT_FILENO) == -1) {
+            perror("Error setting up run");
+            _exit(EXIT_FAILURE);
+        }
+        close(fd);
+
+        struct timespec start, end;
+        CTIME(int ret = run(arg))
+        double ms = get_delay(start, end);
+        fflush(stdout);
+        if (ret == -1 || write(times[1], &ms, sizeof(ms)) != sizeof(ms)) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(times[1]);
+    double ms = -1.0;
+    if (read(times[0], &ms, sizeof(ms)) != sizeof(ms)) {
+        ms = -1.0;
+    }
+    close(times[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? ms : -1.0;
+}
+
+static int run_sieve(void const* config) {
+    return sieve_run((sieve_config_t const*)config);
+}
+
+// Times a candidate, keeping it as the choice if it's the fastest so far
+static void try_candidate(tune_choice_t const* candidate, output_format_t format, char const* dir, tune_choice_t* best) {
+    sieve_config_t config;
+    sieve_config_init(&config, TUNE_LIMIT);
+    config.engine = candidate->engine;
+    config.num_jobs = candidate->num_jobs;
+    config.segment_size = candidate->segment_size;
+    config.format = format;
+
+    double fastest = -1.0;
+    for (size_t rep = 0; rep < TUNE_REPETITIONS; ++rep) {
+        double ms = tune_run_child(dir, "/dev/null", run_sieve, &config);
+        tune_clear_dir(dir);
+        if (ms >= 0 && (fastest < 0 || ms < fastest)) {
+            fastest = ms;
+        }
+    }
+
+    if (fastest >= 0 && (best->ms < 0 || fastest < best->ms)) {
+        *best = *candidate;
+        best->ms = fastest;
+    }
+}
+
+// Adds a size to a list unless it's already there
+static size_t add_size(size_t* sizes, size_t count, size_t size) {
+    for (size_t i = 0; i < count; ++i) {
+        if (sizes[i] == size) {
+            return count;
+        }
+    }
+    sizes[count] = size;
+    return count + 1;
+}
+
+int tune_calibrate(tune_hardware_t const* hw, output_format_t format, tune_choice_t* choice) {
+    // 1, 2, 4, ... jobs, and one per CPU, but never more than the calibration sieve can split
+    size_t max_jobs = hw->num_cpus < wheel_bytes(TUNE_LIMIT) ? hw->num_cpus : wheel_bytes(TUNE_LIMIT);
+    size_t job_counts[MAX_CANDIDATES];
+    size_t num_job_counts = 0;
+    for (size_t jobs = 1; jobs < max_jobs && num_job_counts < MAX_CANDIDATES - 1; jobs *= 2) {
+        job_counts[num_job_counts++] = jobs;
+    }
+    job_counts[num_job_counts++] = max_jobs;
+
+    size_t l1d = hw->l1d ? hw->l1d : default_segment_size();
+    size_t segment_sizes[4];
+    size_t num_segment_sizes = 0;
+    num_segment_sizes = add_size(segment_sizes, num_segment_sizes, l1d / 2);
+    if (hw->l2 > l1d) {
+        num_segment_sizes = add_size(segment_sizes, num_segment_sizes, hw->l2 / 2);
+        num_segment_sizes = add_size(segment_sizes, num_segment_sizes, hw->l2);
+    }
+
+    char dir[] = "sieve_tune.XXXXXX";
+    if (!mkdtemp(dir)) {
+        return -1;
+    }
+
+    tune_choice_t best = {.ms = -1.0};
+    for (size_t e = 0; e < NUM_ENGINES; ++e) {
+        if (e == SIEVE_ENGINE_HYBRID && hw->num_nodes < 2) {
+            continue;
+        }
+        for (size_t j = 0; j < num_job_counts; ++j) {
+            tune_choice_t candidate = {(sieve_engine_t)e, job_counts[j], e == SIEVE_ENGINE_PROCESS ? 0 : l1d, 0.0};
+            try_candidate(&candidate, format, dir, &best);
+        }
+    }
+
+    // The segment size mostly trades the cost of the sieving primes' setup against cache misses, so it's tuned
+    // for the best engine and job count rather than for every combination
+    if (best.ms >= 0 && best.engine != SIEVE_ENGINE_PROCESS) {
+        tune_choice_t candidate = best;
+        for (size_t z = 0; z < num_segment_sizes; ++z) {
+            candidate.segment_size = segment_sizes[z];
+            try_candidate(&candidate, format, dir, &best);
+        }
+    }
+
+    tune_clear_dir(dir);
+    rmdir(dir);
+
+    if (best.ms < 0) {
+        errno = ECHILD;
+        return -1;
+    }
+    *choice = best;
+    return 0;
+}
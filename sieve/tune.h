@@ -0,0 +1,126 @@
+#pragma once
+#include <stddef.h>
+
+#include "output.h"
+#include "sieve.h"
+
+/*
+ * Autotuning: picks the engine, number of jobs and segment size for this machine.
+ *
+ * The candidates come from the hardware (the number of CPUs, the cache sizes and the NUMA nodes), and each one is
+ * timed on a short calibration sieve. The winner is cached in a tuning file, one line per CPU model, number of CPUs
+ * and output format, so later runs on the same kind of machine skip the calibration.
+ */
+
+// The tuning file, in the current directory
+#define TUNE_FILENAME "sieve.tune"
+
+// The limit for the calibration sieves: long enough to get past the setup, short enough to try every candidate
+#define TUNE_LIMIT 20000000
+
+#define TUNE_MODEL_SIZE 128
+
+/**
+ * What the candidates are based on.
+ */
+typedef struct {
+    char model[TUNE_MODEL_SIZE]; // From /proc/cpuinfo, or "unknown"; never contains a tab or newline
+    size_t num_cpus;
+    size_t num_nodes;
+    size_t l1d; // Cache sizes in bytes, or 0 if they couldn't be read
+    size_t l2;
+    size_t l3;
+} tune_hardware_t;
+
+/**
+ * A tuned configuration, and how long its calibration sieve took.
+ */
+typedef struct {
+    sieve_engine_t engine;
+    size_t num_jobs;
+    size_t segment_size; // 0 for the process engine, which doesn't use one
+    double ms;
+} tune_choice_t;
+
+/**
+ * Reads the CPU model, the number of online CPUs, the cache sizes (from sysconf(), or from sysfs where the libc
+ * doesn't know them) and the number of NUMA nodes. Anything that can't be read is left at a safe default.
+ *
+ * @param hw The hardware to fill in.
+ */
+void tune_read_hardware(tune_hardware_t* hw);
+
+/**
+ * Gets the name of an engine, as it's written in the tuning file.
+ *
+ * @param engine The engine.
+ * @return The name.
+ */
+char const* tune_engine_name(sieve_engine_t engine);
+
+/**
+ * Looks up the cached choice for this hardware and output format.
+ *
+ * @param path   The tuning file.
+ * @param hw     The hardware.
+ * @param format The output format.
+ * @param choice Filled in if there's a cached choice.
+ * @return 1 if there was one, 0 if there wasn't (or there's no tuning file yet), or -1 on error (with errno set).
+ */
+int tune_load(char const* path, tune_hardware_t const* hw, output_format_t format, tune_choice_t* choice);
+
+/**
+ * Times a calibration sieve up to TUNE_LIMIT for each candidate and picks the fastest. Every engine is tried with
+ * 1, 2, 4, ... jobs up to the number of CPUs and a segment the size of the L1 data cache; then the best of those is
+ * tried with segments from half the L1 data cache up to the whole L2. The hybrid engine is only tried with more
+ * than one NUMA node.
+ *
+ * Each run happens in a child process, in a scratch directory made in the current directory (so it's written to
+ * the same filesystem as the real output), with its stdout thrown away.
+ *
+ * @param hw     The hardware.
+ * @param format The output format.
+ * @param choice Set to the fastest candidate.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int tune_calibrate(tune_hardware_t const* hw, output_format_t format, tune_choice_t* choice);
+
+/**
+ * What tune_run_child() runs.
+ *
+ * @param arg Whatever was passed to tune_run_child().
+ * @return 0 on success, or -1 on error.
+ */
+typedef int (*tune_run_t)(void const* arg);
+
+/**
+ * Runs something in a child process in dir with its stdout redirected, and times it. Running in a child lets the
+ * engines write their output and timing files, fork, and exit on errors as usual; only the run itself is timed. The
+ * calibration runs go through here, and so do sieve_bench's.
+ *
+ * @param dir The directory to run in.
+ * @param out Where the child's stdout goes, relative to dir.
+ * @param run What to run.
+ * @param arg Passed to run.
+ * @return How long the run took in ms, or -1 if the child couldn't be started or the run failed.
+ */
+double tune_run_child(char const* dir, char const* out, tune_run_t run, void const* arg);
+
+/**
+ * Deletes the files in a scratch directory, but not the directory itself.
+ *
+ * @param dir The directory.
+ */
+void tune_clear_dir(char const* dir);
+
+/**
+ * Saves a choice to the tuning file, replacing any earlier one for this hardware and output format. The file is
+ * rewritten to a temporary file and renamed over the old one, so a run that's interrupted leaves it intact.
+ *
+ * @param path   The tuning file.
+ * @param hw     The hardware.
+ * @param format The output format.
+ * @param choice The choice.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int tune_save(char const* path, tune_hardware_t const* hw, output_format_t format, tune_choice_t const* choice);
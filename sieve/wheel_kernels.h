@@ -0,0 +1,30 @@
+#pragma once
+#include <stddef.h>
+
+/*
+ * Unrolled crossing-off kernels, one for each residue of a prime mod 30. The definitions are generated at build
+ * time by tools/gen_wheel_kernels.c.
+ *
+ * For a prime p = 30q + r, the multiples p * (30t + m) for the 8 residues m of the multiplier fall in the cycle of p
+ * bytes starting at byte p * t: multiple j is at byte q * wheel_residues[j] + wheel_kernel_carries[class][j] of the
+ * cycle, on a bit that only depends on r. A kernel strikes a whole cycle per iteration with those 8 offsets and
+ * masks baked in, so there's no branching or division per multiple.
+ */
+
+/**
+ * Strikes every whole cycle of a prime's multiples that fits in a segment.
+ *
+ * @param segment The segment.
+ * @param base    The index in the segment where the first cycle starts. It can be before the segment, as long as
+ *                every multiple in the cycle isn't; the index arithmetic wraps.
+ * @param len     The length of the segment in bytes.
+ * @param prime   The prime. Must be >= 30 and have the residue mod 30 that the kernel was generated for.
+ * @return The index where the first cycle that doesn't fit in the segment starts.
+ */
+typedef size_t (*wheel_kernel_t)(unsigned char* segment, size_t base, size_t len, size_t prime);
+
+// The kernel for each residue class, indexed by wheel_residue_ceil[prime % 30]
+extern const wheel_kernel_t wheel_kernels[8];
+
+// The part of each multiple's offset in its cycle that comes from prime % 30, by class and then multiplier residue
+extern const unsigned char wheel_kernel_carries[8][8];
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sieve/common.h"
+
+/*
+ * Checks the generated wheel kernels against a reference sieve that strikes one multiple at a time. Run by the
+ * build right after the kernels are generated, so a bad generator fails the build rather than the sieve.
+ *
+ * For primes of every residue class, a run of segments starting from assorted places is struck through
+ * strike_segment_wheel() (which hands whole cycles to the kernels) and compared byte for byte with the reference.
+ */
+
+#define CHECK_SEGMENT_SIZE 4096
+#define CHECK_SEGMENTS 5
+
+static const size_t check_starts[] = {0, 1, 12345, 1000003, 333333333333ul};
+
+// Strikes prime's multiples >= max(prime * prime, 30 * start_byte) one at a time
+static void reference(unsigned char* composites, size_t len, size_t start_byte, size_t prime) {
+    size_t start = start_byte * WHEEL_MODULUS;
+    size_t end = (start_byte + len) * WHEEL_MODULUS;
+    size_t first = prime * prime > start ? prime * prime : (start + prime - 1) / prime * prime;
+
+    for (size_t num = first; num < end; num += prime) {
+        size_t residue = num % WHEEL_MODULUS;
+        size_t bit = wheel_residue_ceil[residue];
+        if (bit < WHEEL_SPOKES && wheel_residues[bit] == residue) {
+            composites[num / WHEEL_MODULUS - start_byte] |= 1 << bit;
+        }
+    }
+}
+
+static int check(size_t prime, size_t start_byte, unsigned char* expected, unsigned char* actual) {
+    size_t len = CHECK_SEGMENT_SIZE * CHECK_SEGMENTS;
+    memset(expected, 0, len);
+    memset(actual, 0, len);
+
+    reference(expected, len, start_byte, prime);
+
+    // Segments of uneven lengths, so the kernels start and stop at every point in a cycle
+    sieving_prime_t sp;
+    sieving_prime_init(&sp, prime, start_byte);
+    for (size_t seg_start = 0; seg_start < len;) {
+        size_t seg_len = CHECK_SEGMENT_SIZE - (seg_start % 7) * 97;
+        seg_len = len - seg_start < seg_len ? len - seg_start : seg_len;
+        strike_segment_wheel(actual + seg_start, seg_len, start_byte + seg_start, &sp);
+        seg_start += seg_len;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        if (expected[i] != actual[i]) {
+            fprintf(stderr, "Kernel mismatch for prime %lu from byte %lu at byte %lu: expected 0x%02x, got 0x%02x.\n",
+                    prime, start_byte, start_byte + i, expected[i], actual[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(void) {
+    size_t len = CHECK_SEGMENT_SIZE * CHECK_SEGMENTS;
+    unsigned char* expected = malloc(len);
+    unsigned char* actual = malloc(len);
+    if (!expected || !actual) {
+        perror("Error allocating segments");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every class, with primes from smaller than a cycle of the segment to bigger than the whole run
+    size_t checked = 0;
+    size_t classes[WHEEL_SPOKES] = {0};
+    for (size_t prime = 31; prime < 2 * len * WHEEL_MODULUS; prime += prime < 2000 ? 2 : 1234) {
+        int is_prime = prime % 2 && prime % 3 && prime % 5;
+        for (size_t d = 7; is_prime && d * d <= prime; d += 2) {
+            is_prime = prime % d != 0;
+        }
+        if (!is_prime) {
+            continue;
+        }
+
+        for (size_t i = 0; i < sizeof(check_starts) / sizeof(check_starts[0]); ++i) {
+            if (check(prime, check_starts[i], expected, actual) == -1) {
+                exit(EXIT_FAILURE);
+            }
+            ++checked;
+        }
+        ++classes[wheel_residue_ceil[prime % WHEEL_MODULUS]];
+    }
+
+    for (size_t c = 0; c < WHEEL_SPOKES; ++c) {
+        if (classes[c] == 0) {
+            fprintf(stderr, "No primes checked for residue %u.\n", wheel_residues[c]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("Wheel kernels match the reference sieve in %lu runs.\n", checked);
+
+    free(actual);
+    free(expected);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Generates the unrolled crossing-off kernels declared in sieve/wheel_kernels.h. Run by the build:
+ *
+ *     gen_wheel_kernels output.c
+ *
+ * This is deliberately standalone (it doesn't link against the sieve) so the tables it writes out are worked out
+ * from first principles rather than copied from the code they're checked against.
+ */
+
+static const unsigned residues[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+static unsigned bit_of(unsigned residue) {
+    for (unsigned j = 0; j < 8; ++j) {
+        if (residues[j] == residue) {
+            return j;
+        }
+    }
+
+    fprintf(stderr, "%u isn't coprime to 30.\n", residue);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s output.c\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE* out = fopen(argv[1], "w");
+    if (!out) {
+        perror("Error opening output");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(out, "// Generated by tools/gen_wheel_kernels.c. Don't edit.\n\n");
+    fprintf(out, "#include \"wheel_kernels.h\"\n\n");
+
+    // Multiple j of p = 30q + r in a cycle is p * residues[j] = 30 * (q * residues[j]) + r * residues[j]
+    fprintf(out, "const unsigned char wheel_kernel_carries[8][8] = {\n");
+    for (unsigned c = 0; c < 8; ++c) {
+        fprintf(out, "    {");
+        for (unsigned j = 0; j < 8; ++j) {
+            fprintf(out, "%u%s", residues[c] * residues[j] / 30, j < 7 ? ", " : "");
+        }
+        fprintf(out, "},\n");
+    }
+    fprintf(out, "};\n");
+
+    for (unsigned c = 0; c < 8; ++c) {
+        unsigned r = residues[c];
+
+        fprintf(out, "\n// prime %% 30 == %u\n", r);
+        fprintf(out, "static size_t strike_cycles_%u(unsigned char* segment, size_t base, size_t len, size_t prime) {\n", r);
+        fprintf(out, "    size_t q = prime / 30;\n");
+        fprintf(out, "    size_t last = q * 29 + %u;\n\n", r * 29 / 30);
+        fprintf(out, "    for (; base + last < len; base += prime) {\n");
+        for (unsigned j = 0; j < 8; ++j) {
+            fprintf(out, "        segment[base + q * %u + %u] |= 0x%02x;\n", residues[j], r * residues[j] / 30,
+                    1u << bit_of(r * residues[j] % 30));
+        }
+        fprintf(out, "    }\n\n");
+        fprintf(out, "    return base;\n");
+        fprintf(out, "}\n");
+    }
+
+    fprintf(out, "\nconst wheel_kernel_t wheel_kernels[8] = {\n");
+    for (unsigned c = 0; c < 8; ++c) {
+        fprintf(out, "    strike_cycles_%u,\n", residues[c]);
+    }
+    fprintf(out, "};\n");
+
+    if (fclose(out) != 0) {
+        perror("Error writing output");
+        exit(EXIT_FAILURE);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sieve/prime_table.h"
+
+/*
+ * Answers queries against a binary prime table written by assn1 -b, one line of output per query.
+ */
+
+static void print_help(char const* prog_name) {
+    printf("usage: %s table query...\n", prog_name);
+    printf("\tqueries a binary prime table written by assn1 -b. Each query is one of:\n");
+    printf("\tpi x:       the number of primes <= x.\n");
+    printf("\tnth k:      the kth prime, counting 2 as the first.\n");
+    printf("\tis_prime x: 1 if x is prime, 0 if not.\n");
+    printf("\tinfo:       the table's limit and number of primes.\n");
+}
+
+static size_t parse_arg(char const* arg, char const* query) {
+    size_t value;
+    if (!arg || sscanf(arg, "%lu", &value) != 1) {
+        fprintf(stderr, "Invalid or missing argument for %s.\n", query);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        print_help(argv[0]);
+        exit(argc == 2 && strcmp(argv[1], "-h") == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    prime_table_t table;
+    if (prime_table_open(&table, argv[1]) == -1) {
+        perror("Error opening prime table");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "pi") == 0) {
+            size_t x = parse_arg(argv[++i], "pi");
+            printf("%lu\n", prime_table_pi(&table, x));
+        } else if (strcmp(argv[i], "nth") == 0) {
+            size_t k = parse_arg(argv[++i], "nth");
+            size_t prime = prime_table_nth_prime(&table, k);
+            if (prime == 0) {
+                fprintf(stderr, "The table doesn't have %lu primes.\n", k);
+                exit(EXIT_FAILURE);
+            }
+            printf("%lu\n", prime);
+        } else if (strcmp(argv[i], "is_prime") == 0) {
+            size_t x = parse_arg(argv[++i], "is_prime");
+            int result = prime_table_is_prime(&table, x);
+            if (result == -1) {
+                fprintf(stderr, "%lu is past the table's limit of %lu.\n", x, (size_t)table.header->limit);
+                exit(EXIT_FAILURE);
+            }
+            printf("%d\n", result);
+        } else if (strcmp(argv[i], "info") == 0) {
+            printf("limit %lu, %lu primes\n", (size_t)table.header->limit, (size_t)table.header->num_primes);
+        } else {
+            fprintf(stderr, "Unknown query %s. See %s -h for help.\n", argv[i], argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    prime_table_close(&table);
+    return EXIT_SUCCESS;
+}
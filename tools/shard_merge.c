@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <libgen.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../sieve/common.h"
+#include "../sieve/output.h"
+#include "../sieve/pi.h"
+#include "../sieve/prime_table.h"
+#include "../sieve/shard.h"
+
+/*
+ * Checks the shards of a range written by assn1 --shard and merges them: text shards are concatenated into one
+ * primes file, and bitmap shards are copied into one binary prime table.
+ *
+ * Before anything is written, the manifests have to agree on the range, the number of shards and the format, and
+ * every shard has to be there with exactly the part of the range that shard_range() gives it, so the range is
+ * covered with no gaps or overlaps. Each shard's data then has to match its manifest's size and checksum, and the
+ * primes in it are counted again: text shards are parsed, and every line has to be a number in the shard's part of
+ * the range, in increasing order.
+ */
+
+#define READ_SIZE (1 << 20)
+
+const size_t DEFAULT_NUM_JOBS = 1;
+
+typedef struct {
+    shard_manifest_t manifest;
+    char data_path[PATH_MAX];
+} shard_t;
+
+// Where parsing a text shard has got to; a line can be split between reads
+typedef struct {
+    size_t value;
+    size_t digits;
+    size_t last; // The last prime, or 0 before the first
+    size_t count;
+    int bad;
+} text_check_t;
+
+static void print_help(char const* prog_name) {
+    printf("usage: %s [-o output] [-c] [-x] [-j jobs] manifest...\n", prog_name);
+    printf("\tchecks the shards of a range written by assn1 --shard, then merges them.\n");
+    printf("\tText shards are concatenated; bitmap shards become a binary prime table, which needs the range to\n");
+    printf("\tstart at 0.\n");
+    printf("\t-o: the file to merge into. Default is %s for text and %s for bitmaps.\n", PRIMES_FILENAME,
+           PRIME_TABLE_FILENAME);
+    printf("\t-c: only check the shards, and don't write anything.\n");
+    printf("\t-x: also check the total number of primes against the Lagarias-Miller-Odlyzko count of the range.\n");
+    printf("\t-j: the number of jobs (threads) for -x. Default is %lu.\n", DEFAULT_NUM_JOBS);
+    printf("\t-h: print this help message and exit.\n");
+}
+
+static void check_text(text_check_t* check, char const* data, size_t len, size_t lo, size_t hi) {
+    for (size_t i = 0; i < len; ++i) {
+        char c = data[i];
+        if (c >= '0' && c <= '9' && check->digits < 20) {
+            check->value = check->value * 10 + (size_t)(c - '0');
+            ++check->digits;
+        } else if (c == '\n' && check->digits > 0) {
+            check->bad |= check->value < lo || check->value >= hi || check->value <= check->last;
+            check->last = check->value;
+            ++check->count;
+            check->value = 0;
+            check->digits = 0;
+        } else {
+            check->bad = 1;
+        }
+    }
+}
+
+// Reads a shard's data, checking it against its manifest and copying it to out (or into table) as it goes. Returns
+// -1, having said why, if it doesn't check out
+static int merge_shard(shard_t const* shard, int out, prime_table_t* table) {
+    shard_manifest_t const* m = &shard->manifest;
+    size_t expected_bytes = m->format == OUTPUT_TABLE ? wheel_bytes(m->hi) - m->start_byte : m->data_bytes;
+    if (m->format == OUTPUT_TABLE && (m->start_byte != m->lo / WHEEL_MODULUS || m->data_bytes != expected_bytes)) {
+        fprintf(stderr, "Shard %lu's bitmap doesn't cover [%lu, %lu).\n", m->index, m->lo, m->hi);
+        return -1;
+    }
+
+    int fd = open(shard->data_path, O_RDONLY);
+    char* buf = malloc(READ_SIZE);
+    if (fd == -1 || !buf) {
+        fprintf(stderr, "Error reading shard %lu's data %s: %s\n", m->index, shard->data_path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    uint64_t checksum = FNV_OFFSET_BASIS;
+    size_t bytes = 0;
+    size_t primes = 0;
+    text_check_t text = {0, 0, 0, 0, 0};
+    ssize_t n;
+    while ((n = read(fd, buf, READ_SIZE)) > 0) {
+        checksum = fnv1a(checksum, (unsigned char const*)buf, n);
+        if (m->format == OUTPUT_TEXT) {
+            check_text(&text, buf, n, m->lo, m->hi);
+            if (out != -1 && write_all(out, -1, buf, n) == -1) {
+                break;
+            }
+        } else if (bytes + n <= expected_bytes) {
+            primes += count_primes_wheel((unsigned char const*)buf, n, m->start_byte + bytes, m->lo, m->hi);
+            if (table) {
+                memcpy(table->bitmap + m->start_byte + bytes, buf, n);
+            }
+        }
+        bytes += n;
+    }
+    int error = errno;
+    close(fd);
+    free(buf);
+
+    if (n == -1) {
+        fprintf(stderr, "Error reading shard %lu's data %s: %s\n", m->index, shard->data_path, strerror(error));
+        return -1;
+    } else if (n > 0) {
+        fprintf(stderr, "Error writing merged primes: %s\n", strerror(error));
+        return -1;
+    }
+
+    if (m->format == OUTPUT_TEXT) {
+        primes = text.count;
+    }
+    if (bytes != m->data_bytes || checksum != m->checksum) {
+        fprintf(stderr, "Shard %lu's data %s doesn't match its manifest: %lu bytes with checksum %016lx, not %lu "
+                "with %016lx.\n", m->index, shard->data_path, bytes, checksum, m->data_bytes, m->checksum);
+        return -1;
+    } else if (text.bad || text.digits > 0) {
+        fprintf(stderr, "Shard %lu's data %s isn't one increasing number per line in [%lu, %lu).\n", m->index,
+                shard->data_path, m->lo, m->hi);
+        return -1;
+    } else if (primes != m->num_primes) {
+        fprintf(stderr, "Shard %lu's data %s has %lu primes, but its manifest says %lu.\n", m->index,
+                shard->data_path, primes, m->num_primes);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_shards(void const* a, void const* b) {
+    size_t x = ((shard_t const*)a)->manifest.index;
+    size_t y = ((shard_t const*)b)->manifest.index;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    char const* out_path = NULL;
+    int check_only = 0;
+    int check_pi = 0;
+    size_t num_jobs = DEFAULT_NUM_JOBS;
+
+    int c;
+    while ((c = getopt(argc, argv, "o:cxj:h")) != -1) {
+        switch (c) {
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'c':
+                check_only = 1;
+                break;
+            case 'x':
+                check_pi = 1;
+                break;
+            case 'j':
+                if (sscanf(optarg, "%lu", &num_jobs) != 1 || num_jobs == 0) {
+                    fprintf(stderr, "Invalid argument %s for -j.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                print_help(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "See %s -h for help.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t num_shards = argc - optind;
+    if (num_shards == 0) {
+        fprintf(stderr, "No manifests given. See %s -h for help.\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    shard_t* shards = malloc(sizeof(shard_t) * num_shards);
+    if (!shards) {
+        perror("Error allocating");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num_shards; ++i) {
+        char const* path = argv[optind + i];
+        if (shard_manifest_read(path, &shards[i].manifest) == -1) {
+            fprintf(stderr, "Error reading manifest %s: %s\n", path, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        // The data is next to its manifest
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%s", path);
+        snprintf(shards[i].data_path, sizeof(shards[i].data_path), "%s/%s", dirname(dir),
+                 shards[i].manifest.data_file);
+    }
+    qsort(shards, num_shards, sizeof(shard_t), compare_shards);
+
+    // Every shard has to be there, once, with its part of the same range
+    shard_manifest_t const* first = &shards[0].manifest;
+    for (size_t i = 0; i < num_shards; ++i) {
+        shard_manifest_t const* m = &shards[i].manifest;
+        size_t lo, hi;
+        if (m->count != first->count || m->range_lo != first->range_lo || m->range_hi != first->range_hi ||
+            m->format != first->format) {
+            fprintf(stderr, "Shard %lu/%lu of [%lu, %lu) isn't from the same run as shard %lu/%lu of [%lu, %lu).\n",
+                    m->index, m->count, m->range_lo, m->range_hi, first->index, first->count, first->range_lo,
+                    first->range_hi);
+            exit(EXIT_FAILURE);
+        } else if (m->index != i) {
+            fprintf(stderr, "Shard %lu of %lu is %s.\n", i, first->count, m->index > i ? "missing" : "given twice");
+            exit(EXIT_FAILURE);
+        }
+
+        shard_range(m->range_lo, m->range_hi, m->index, m->count, &lo, &hi);
+        if (m->lo != lo || m->hi != hi) {
+            fprintf(stderr, "Shard %lu covers [%lu, %lu), but its part of the range is [%lu, %lu).\n", m->index, m->lo,
+                    m->hi, lo, hi);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num_shards != first->count) {
+        fprintf(stderr, "Shard %lu of %lu is missing.\n", num_shards, first->count);
+        exit(EXIT_FAILURE);
+    }
+
+    output_format_t format = first->format;
+    if (!out_path) {
+        out_path = format == OUTPUT_TEXT ? PRIMES_FILENAME : PRIME_TABLE_FILENAME;
+    }
+    if (format == OUTPUT_TABLE && !check_only && first->range_lo > 0) {
+        fprintf(stderr, "Bitmap shards can only be merged into a prime table if the range starts at 0. Use -c to "
+                "just check them.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The output goes to a temporary file that's only renamed into place once every shard has checked out
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+    int out = -1;
+    prime_table_t table;
+    prime_table_t* merged_table = NULL;
+    if (!check_only && format == OUTPUT_TEXT && (out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+        perror("Error opening merged primes");
+        exit(EXIT_FAILURE);
+    } else if (!check_only && format == OUTPUT_TABLE) {
+        if (prime_table_create(&table, tmp_path, first->range_hi) == -1) {
+            perror("Error creating prime table");
+            exit(EXIT_FAILURE);
+        }
+        merged_table = &table;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < num_shards; ++i) {
+        if (merge_shard(&shards[i], out, merged_table) == -1) {
+            unlink(tmp_path);
+            exit(EXIT_FAILURE);
+        }
+        total += shards[i].manifest.num_primes;
+    }
+
+    if (check_pi) {
+        size_t below_hi, below_lo = 0;
+        if (prime_pi(first->range_hi - 1, num_jobs, &below_hi, NULL) == -1 ||
+            (first->range_lo > 0 && prime_pi(first->range_lo - 1, num_jobs, &below_lo, NULL) == -1)) {
+            perror("Error while counting primes");
+            unlink(tmp_path);
+            exit(EXIT_FAILURE);
+        }
+        if (below_hi - below_lo != total) {
+            fprintf(stderr, "The shards have %lu primes, but [%lu, %lu) has %lu.\n", total, first->range_lo,
+                    first->range_hi, below_hi - below_lo);
+            unlink(tmp_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (out != -1 && (close(out) == -1 || rename(tmp_path, out_path) == -1)) {
+        perror("Error writing merged primes");
+        unlink(tmp_path);
+        exit(EXIT_FAILURE);
+    } else if (merged_table && (prime_table_finish(merged_table) == -1 || rename(tmp_path, out_path) == -1)) {
+        perror("Error writing prime table");
+        unlink(tmp_path);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%lu shards cover [%lu, %lu) with %lu primes%s.\n", num_shards, first->range_lo, first->range_hi, total,
+           check_pi ? ", which matches pi()" : "");
+    if (!check_only) {
+        printf("Merged into %s.\n", out_path);
+    }
+
+    free(shards);
+    return EXIT_SUCCESS;
+}
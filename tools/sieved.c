@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <unistd.h>
+
+#include "../sieve/common.h"
+#include "../sieve/server.h"
+
+/*
+ * Runs a sieve server (see sieve/server.h) until it gets SIGINT or SIGTERM, then says what it did.
+ */
+
+const size_t DEFAULT_CACHE_MB = 64;
+const size_t DEFAULT_LIMIT = 1000000000000;
+
+static void print_help(char const* prog_name) {
+    printf("usage: %s [-S socket] [-j workers] [-M cache_mb] [-l limit]\n", prog_name);
+    printf("\tanswers is_prime, next_prime, count and range queries over a UNIX domain socket until it's sent\n");
+    printf("\tSIGINT or SIGTERM. Use sieve_load to send it queries.\n");
+    printf("\t-S: the socket to listen on. Default is %s.\n", SERVER_SOCKET_PATH);
+    printf("\t-j: the number of worker threads. Default is one per online CPU.\n");
+    printf("\t-M: the segment cache size in MiB, or 0 for none. Each segment is %d bytes and covers %d numbers.\n",
+           SERVER_SEGMENT_BYTES, SERVER_SEGMENT_BYTES * WHEEL_MODULUS);
+    printf("\t    Default is %lu.\n", DEFAULT_CACHE_MB);
+    printf("\t-l: queries are answered for numbers below this. The sieving primes up to its square root are found\n");
+    printf("\t    when the server starts. Default is %lu.\n", DEFAULT_LIMIT);
+    printf("\t-h: print this help message and exit.\n");
+}
+
+int main(int argc, char** argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t cache_mb = DEFAULT_CACHE_MB;
+    server_config_t config = {SERVER_SOCKET_PATH, cpus > 0 ? (size_t)cpus : 1, 0, DEFAULT_LIMIT};
+
+    int c;
+    while ((c = getopt(argc, argv, "S:j:M:l:h")) != -1) {
+        switch (c) {
+            case 'S':
+                config.socket_path = optarg;
+                break;
+            case 'j':
+                if (sscanf(optarg, "%lu", &config.num_workers) != 1 || config.num_workers == 0) {
+                    fprintf(stderr, "Invalid argument %s for -j.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'M':
+                if (sscanf(optarg, "%lu", &cache_mb) != 1) {
+                    fprintf(stderr, "Invalid argument %s for -M.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'l':
+                if (sscanf(optarg, "%lu", &config.limit) != 1 || config.limit < 10 || config.limit > SIEVE_RANGE_MAX) {
+                    fprintf(stderr, "Invalid argument %s for -l. It must be between 10 and %lu.\n", optarg,
+                            SIEVE_RANGE_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+                print_help(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                fprintf(stderr, "See %s -h for help.\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    config.cache_bytes = cache_mb << 20;
+
+    // Block the signals before the workers start, so they're only ever taken here by sigwait()
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    server_t* server = server_start(&config);
+    if (!server) {
+        perror("Error starting server");
+        exit(EXIT_FAILURE);
+    }
+    printf("Listening on %s with %lu workers and a %luMiB cache, for numbers below %lu.\n", config.socket_path,
+           config.num_workers, cache_mb, config.limit);
+    fflush(stdout);
+
+    int sig;
+    sigwait(&signals, &sig);
+
+    server_stats_t stats;
+    server_stop(server, &stats);
+    printf("Stopped. %lu connections, %lu requests, %lu queries. %lu cache hits and %lu misses, with %lu slots.\n",
+           stats.connections, stats.requests, stats.queries, stats.cache_hits, stats.cache_misses, stats.cache_slots);
+    return EXIT_SUCCESS;
+}
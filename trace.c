@@ -0,0 +1,85 @@
+#ifdef SIEVE_TRACE
+#include <stdio.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include "trace.h"
+
+trace_track_t* trace_tracks = NULL;
+
+static size_t num_tracks;
+
+// Ticks and wall-clock time at the start, to convert ticks to microseconds with at the end
+static uint64_t start_ticks;
+static struct timespec start_time;
+
+static char const* event_names[TRACE_NUM_EVENTS] = {"wait", "strike", "publish", "output"};
+
+int trace_start(size_t tracks) {
+    // Untouched pages of a track are never backed, so the capacity is mostly free
+    trace_tracks = mmap(NULL, sizeof(trace_track_t) * tracks, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (trace_tracks == MAP_FAILED) {
+        trace_tracks = NULL;
+        return -1;
+    }
+
+    num_tracks = tracks;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start_time);
+    start_ticks = trace_ticks();
+    return 0;
+}
+
+int trace_finish(char const* path) {
+    if (!trace_tracks) {
+        return 0;
+    }
+
+    // Calibrate the ticks against the wall clock over the whole run
+    struct timespec end_time;
+    uint64_t end_ticks = trace_ticks();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end_time);
+    double us = (end_time.tv_sec - start_time.tv_sec) * 1e6 + (end_time.tv_nsec - start_time.tv_nsec) / 1e3;
+    double us_per_tick = end_ticks > start_ticks && us > 0 ? us / (double)(end_ticks - start_ticks) : 0.0;
+
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        munmap(trace_tracks, sizeof(trace_track_t) * num_tracks);
+        trace_tracks = NULL;
+        return -1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"sieve\"}}");
+
+    size_t dropped = 0;
+    for (size_t t = 0; t < num_tracks; ++t) {
+        trace_track_t const* track = &trace_tracks[t];
+
+        // The last track is the master's
+        if (t + 1 == num_tracks) {
+            fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%lu,\"args\":{\"name\":\"master\"}}",
+                    t);
+        } else {
+            fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%lu,\"args\":{\"name\":\"job %lu\"}}",
+                    t, t);
+        }
+
+        for (size_t i = 0; i < track->count; ++i) {
+            trace_record_t const* r = &track->records[i];
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":0,\"tid\":%lu,\"args\":{\"round\":%u}}",
+                    event_names[r->event], r->phase, (r->ticks - start_ticks) * us_per_tick, t, r->round);
+        }
+        dropped += track->dropped;
+    }
+
+    fprintf(out, "\n],\"otherData\":{\"dropped\":%lu}}\n", dropped);
+
+    int ret = fclose(out);
+    munmap(trace_tracks, sizeof(trace_track_t) * num_tracks);
+    trace_tracks = NULL;
+    return ret;
+}
+
+#endif
@@ -0,0 +1,131 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-round event tracing, for seeing barrier skew and stragglers on a timeline rather than as totals.
+ *
+ * Only built with -DSIEVE_TRACE=ON. Otherwise every TRACE_* macro expands to nothing, so it costs nothing.
+ *
+ * Every job (and the master) records into its own track of a shared mapping, so recording never takes a lock or
+ * makes a system call and works the same for threads and forked processes. Events are stamped with the TSC where
+ * there is one, and converted to microseconds when the trace is written out as Chrome trace JSON, which
+ * chrome://tracing and Perfetto both open.
+ */
+
+// Where the trace goes
+#define TRACE_FILENAME "trace.json"
+
+// Events a track can hold. Once it's full the track stops taking new slices, though the ones already open still get
+// their ends, and everything it misses is counted as dropped. The mapping is only backed as it fills up.
+#define TRACE_TRACK_CAPACITY (1 << 18)
+
+typedef enum {
+    TRACE_WAIT, // Waiting at a barrier, or for a message or a buffer
+    TRACE_STRIKE, // Crossing off multiples
+    TRACE_PUBLISH, // Handing results on to the master, or a batch on to the jobs
+    TRACE_OUTPUT, // Writing out primes
+    TRACE_NUM_EVENTS
+} trace_event_t;
+
+typedef struct {
+    uint64_t ticks;
+    uint32_t round;
+    uint16_t event;
+    uint16_t phase; // 'B' or 'E'
+} trace_record_t;
+
+/**
+ * One job's events. Only ever written by that job.
+ */
+typedef struct {
+    size_t count;
+    size_t dropped;
+    size_t open; // Slices begun and not yet ended, whose ends are kept room for
+    size_t skipped; // Slices begun since the track filled up, whose ends are dropped too
+    int full;
+    trace_record_t records[TRACE_TRACK_CAPACITY];
+} trace_track_t;
+
+#ifdef SIEVE_TRACE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// The tracks, or NULL if there's no trace running
+extern trace_track_t* trace_tracks;
+
+/**
+ * Starts tracing. Call it before creating the jobs, so that forked ones share the tracks.
+ *
+ * @param num_tracks The number of tracks: one for each job and one for the master.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int trace_start(size_t num_tracks);
+
+/**
+ * Writes every track out as Chrome trace JSON and stops tracing.
+ *
+ * @param path The file to write the trace to.
+ * @return 0 on success, or -1 on error (with errno set).
+ */
+int trace_finish(char const* path);
+
+static inline uint64_t trace_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+static inline void trace_record(size_t track, trace_event_t event, size_t round, char phase) {
+    if (!trace_tracks) {
+        return;
+    }
+
+    // A slice is only begun if there's room for its end as well as the ends of every slice that's already open, so
+    // a B is never kept without its E. Slices nest, so the Es that come in while any skipped ones are open are theirs.
+    trace_track_t* t = &trace_tracks[track];
+    if (phase == 'B') {
+        if (t->full || t->count + t->open + 2 > TRACE_TRACK_CAPACITY) {
+            t->full = 1;
+            ++t->skipped;
+            ++t->dropped;
+            return;
+        }
+        ++t->open;
+    } else if (t->skipped > 0) {
+        --t->skipped;
+        ++t->dropped;
+        return;
+    } else if (t->open > 0) {
+        --t->open;
+    }
+
+    if (t->count == TRACE_TRACK_CAPACITY) {
+        ++t->dropped;
+        return;
+    }
+
+    trace_record_t* r = &t->records[t->count++];
+    r->ticks = trace_ticks();
+    r->round = (uint32_t)round;
+    r->event = (uint16_t)event;
+    r->phase = (uint16_t)phase;
+}
+
+#define TRACE_BEGIN(track, event, round) trace_record(track, event, round, 'B')
+#define TRACE_END(track, event, round) trace_record(track, event, round, 'E')
+
+#else
+
+#define TRACE_BEGIN(track, event, round) ((void)0)
+#define TRACE_END(track, event, round) ((void)0)
+
+#endif